@@ -62,6 +62,12 @@ struct boot_rsp {
      */
     uint8_t br_flash_dev_id;
     uint32_t br_image_off;
+
+    /**
+     * The slot the image executes from.  This is always 0, except for PIC
+     * images, which run in place from either slot.
+     */
+    uint8_t br_slot;
 };
 
 /* This is not actually used by mcuboot's code but can be used by apps
@@ -78,11 +84,53 @@ struct image_trailer {
 /* you must have pre-allocated all the entries within this structure */
 int boot_go(struct boot_rsp *rsp);
 
+/*
+ * Boot token support, only used when MCUBOOT_BOOT_TOKEN is defined.
+ *
+ * boot_token_ram() must be provided by the port.  It returns a word aligned
+ * block of BOOT_TOKEN_RAM_SZ bytes which is retained across warm resets, and
+ * which the boot loader and the application both see at the same address.
+ *
+ * boot_token_flash_changed() is called by bootutil before any write it does.
+ * The application should also call it before changing the image slots through
+ * other means: after a warm reset, the boot loader compares the trailers, and
+ * the header and hash TLV of the booted image, with the token, but not the
+ * rest of the image.
+ *
+ * boot_token_image_hash() gets the SHA256 of the image booted last; returns
+ * 0 on success, or nonzero if no token is present.
+ */
+#define BOOT_TOKEN_RAM_SZ       128
+
+void *boot_token_ram(void);
+void boot_token_flash_changed(void);
+int boot_token_image_hash(uint8_t *out_hash);
+
 int boot_swap_type(void);
 
 int boot_set_pending(int permanent);
 int boot_set_confirmed(void);
 
+/*
+ * PIC image support, only used when MCUBOOT_PIC_IMAGES is defined.
+ *
+ * boot_pic_relocate() copies the tables listed in the relocations of the
+ * image described by rsp to RAM, fixed up for the image header to execute at
+ * exec_addr.  The destination must fall within the window of ram_sz bytes at
+ * ram_addr, which the boot loader accesses through ram.  Returns 0 on
+ * success.
+ *
+ * boot_set_pending_slot() and boot_set_confirmed_slot() work like
+ * boot_set_pending() and boot_set_confirmed(), but on the PIC image in the
+ * given slot.  An application running in place from slot 1 confirms itself
+ * with boot_set_confirmed_slot(1), and requests an upgrade written to slot 0
+ * with boot_set_pending_slot(0, permanent).
+ */
+int boot_pic_relocate(const struct boot_rsp *rsp, uint32_t exec_addr,
+                      void *ram, uint32_t ram_addr, uint32_t ram_sz);
+int boot_set_pending_slot(int slot, int permanent);
+int boot_set_confirmed_slot(int slot);
+
 #define SPLIT_GO_OK                 (0)
 #define SPLIT_GO_NON_MATCHING       (-1)
 #define SPLIT_GO_ERR                (-2)
@@ -40,6 +40,14 @@ uint32_t bootutil_get_caps(void);
 #define BOOTUTIL_CAP_ENC_RSA            (1<<5)
 #define BOOTUTIL_CAP_ENC_KW             (1<<6)
 #define BOOTUTIL_CAP_VALIDATE_SLOT0     (1<<7)
+#define BOOTUTIL_CAP_SPARSE_IMAGES      (1<<8)
+#define BOOTUTIL_CAP_BANK_SWAP          (1<<9)
+#define BOOTUTIL_CAP_BOOT_TOKEN         (1<<10)
+#define BOOTUTIL_CAP_STATUS_BIT_CLEAR   (1<<11)
+#define BOOTUTIL_CAP_PIC_IMAGES         (1<<12)
+#define BOOTUTIL_CAP_VERIFY_WRITES      (1<<13)
+#define BOOTUTIL_CAP_OVERLAP_COPY       (1<<14)
+#define BOOTUTIL_CAP_DEFERRED_VALIDATION (1<<15)
 
 #ifdef __cplusplus
 }
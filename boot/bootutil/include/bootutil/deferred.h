@@ -0,0 +1,68 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef BOOTUTIL_DEFERRED_H
+#define BOOTUTIL_DEFERRED_H
+
+#include <inttypes.h>
+#include "bootutil/sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Deferred validation, only used when MCUBOOT_DEFERRED_VALIDATION is defined.
+ *
+ * Before booting an image whose hash is in two parts, the boot loader only
+ * reads its header, TLVs and first part, and checks the signature.  The
+ * application checks the rest once it runs: boot_deferred_check_start(),
+ * which checks the first part and the signature again and keeps the hash of
+ * the rest they cover, then boot_deferred_check() until it returns something
+ * else than BOOT_DEFERRED_MORE, each call reading a bounded number of bytes so
+ * that the check can be spread over idle time.
+ *
+ * An image being tested is then confirmed with boot_set_confirmed().  If the
+ * check fails, boot_deferred_revert() makes the next boot go back to the
+ * previous image, which overwrite-only upgrades do not keep; see its
+ * description.
+ */
+#define BOOT_DEFERRED_OK            (0)
+#define BOOT_DEFERRED_MORE          (1)
+#define BOOT_DEFERRED_BAD           (-1)
+#define BOOT_DEFERRED_ERR           (-2)
+
+struct boot_deferred_check {
+    bootutil_sha256_context bdc_sha;
+    uint32_t bdc_split;     /* Start of the second part; 0 once checked. */
+    uint32_t bdc_off;       /* Next byte to hash. */
+    uint32_t bdc_end;       /* End of the image body. */
+    uint8_t bdc_rest[32];   /* Authenticated hash of the second part. */
+    uint8_t bdc_ranges[32]; /* Hash of the fill ranges it was made with. */
+};
+
+int boot_deferred_check_start(struct boot_deferred_check *chk);
+int boot_deferred_check(struct boot_deferred_check *chk, uint32_t max_bytes);
+int boot_deferred_revert(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOOTUTIL_DEFERRED_H */
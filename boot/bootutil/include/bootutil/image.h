@@ -42,7 +42,13 @@ struct flash_area;
 /*
  * Image header flags.
  */
-#define IMAGE_F_PIC                      0x00000001 /* Not supported. */
+/*
+ * Indicates a position-independent image, which runs from whichever slot it
+ * is in.  Tables of absolute addresses, such as a vector table or a GOT, are
+ * copied to RAM and fixed up as described by the IMAGE_TLV_RELOC record; see
+ * struct image_reloc.
+ */
+#define IMAGE_F_PIC                      0x00000001
 #define IMAGE_F_NON_BOOTABLE             0x00000010 /* Split image app. */
 #define IMAGE_F_ENCRYPTED                0x00000004 /* Encrypted. */
 /*
@@ -51,6 +57,18 @@ struct flash_area;
  * ih_load_addr field of the header.
  */
 #define IMAGE_F_RAM_LOAD                 0x00000020
+/*
+ * Indicates that the image body contains fill ranges described by an
+ * IMAGE_TLV_SPARSE record.  The bytes within those ranges are left out of
+ * the image hash; see struct image_sparse_range.
+ */
+#define IMAGE_F_SPARSE                   0x00000040
+/*
+ * Indicates that the image hash is made of two parts, hashed separately: the
+ * header and the start of the body, then the rest.  The boot loader can then
+ * check the first part alone; see struct image_hash_parts.
+ */
+#define IMAGE_F_HASH_PARTS               0x00000080
 
 /*
  * ECSDA224 is with NIST P-224
@@ -74,6 +92,9 @@ struct flash_area;
 #define IMAGE_TLV_ECDSA256          0x22   /* ECDSA of hash output */
 #define IMAGE_TLV_ENC_RSA2048       0x30   /* Key encrypted with RSA-OAEP-2048 */
 #define IMAGE_TLV_ENC_KW128         0x31   /* Key encrypted with AES-KW-128 */
+#define IMAGE_TLV_SPARSE            0x40   /* Fill ranges of a sparse image */
+#define IMAGE_TLV_RELOC             0x50   /* Relocations of a PIC image */
+#define IMAGE_TLV_HASH_PARTS        0x60   /* Second part of a two-part hash */
 
 struct image_version {
     uint8_t iv_major;
@@ -107,6 +128,49 @@ struct image_tlv {
     uint16_t it_len;    /* Data length (not including TLV header). */
 };
 
+/**
+ * Fill range of a sparse image, an array of which forms the payload of the
+ * IMAGE_TLV_SPARSE record.  Offsets are relative to the start of the image
+ * header and the ranges are sorted and do not overlap.  All fields in little
+ * endian.
+ */
+struct image_sparse_range {
+    uint32_t isr_off;   /* Offset of the first byte of the range. */
+    uint32_t isr_len;   /* Number of bytes in the range. */
+    uint8_t  isr_fill;  /* Value of every byte in the range. */
+    uint8_t  _pad[3];
+};
+
+/**
+ * Relocation of a PIC image, an array of which forms the payload of the
+ * IMAGE_TLV_RELOC record.  It describes a run of 32-bit words of the image
+ * which the boot loader copies to RAM before starting the image.  With
+ * IMAGE_RELOC_F_REL set, the words hold offsets from the start of the image
+ * header, and the address the header executes from is added to each of them.
+ * All fields in little endian.
+ */
+struct image_reloc {
+    uint32_t ir_off;    /* Offset of the first word, from the header start. */
+    uint32_t ir_dst;    /* RAM address the words are copied to. */
+    uint16_t ir_count;  /* Number of words. */
+    uint16_t ir_flags;  /* IMAGE_RELOC_F_[...]. */
+};
+
+#define IMAGE_RELOC_F_REL           0x0001
+
+/**
+ * Payload of the IMAGE_TLV_HASH_PARTS record.  The first part is the SHA256
+ * of the image up to ihp_split, an offset from the start of the header,
+ * followed by the sparse and reloc descriptors, if any; the second is the
+ * SHA256 of the rest.  The image hash, which the signature covers, is then
+ * the SHA256 of both parts, one after the other.  All fields in little
+ * endian.
+ */
+struct image_hash_parts {
+    uint32_t ihp_split;     /* Offset of the first byte of the second part. */
+    uint8_t  ihp_rest[32];  /* SHA256 of the second part. */
+};
+
 #define IS_ENCRYPTED(hdr) ((hdr)->ih_flags & IMAGE_F_ENCRYPTED)
 
 #ifdef __ZEPHYR__
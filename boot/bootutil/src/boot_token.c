@@ -0,0 +1,263 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Boot token kept in RAM retained across warm resets.
+ *
+ * After a boot that leaves no swap pending, the boot loader records what it
+ * booted in a token, along with the current flash generation.  Every write
+ * done through bootutil, by the boot loader or by the application, first
+ * bumps the generation.  On the next boot, a token whose CRC and generation
+ * still match proves nothing was changed through bootutil.  Flash may still
+ * have been changed by other means, such as a debugger or a DFU agent writing
+ * the slots directly, so the trailers and the booted image's header and hash
+ * are read again and compared with the token.  If they match, the same image
+ * is booted again without validating it.
+ *
+ * After a cold reset the retained RAM holds garbage, which the magic and
+ * CRC reject.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sysflash/sysflash.h"
+#include "flash_map_backend/flash_map_backend.h"
+
+#include "bootutil/bootutil.h"
+#include "bootutil/image.h"
+#include "bootutil_priv.h"
+
+#ifdef MCUBOOT_BOOT_TOKEN
+
+#define BOOT_TOKEN_MAGIC        0x7b6f6f74
+
+struct boot_token {
+    uint32_t bt_magic;
+    uint32_t bt_generation;
+    struct image_header bt_hdr;
+    uint8_t bt_hash[32];
+    struct boot_swap_state bt_slot0;
+    struct boot_swap_state bt_slot1;
+    uint8_t bt_flash_dev_id;
+    uint8_t bt_slot;
+    uint32_t bt_image_off;
+    uint32_t bt_crc;
+};
+
+/** Layout of the block returned by boot_token_ram(). */
+struct boot_retained {
+    /* Bumped before every flash write done through bootutil. */
+    uint32_t br_generation;
+    struct boot_token br_token;
+};
+
+static uint32_t
+boot_token_crc32(const void *data, size_t len)
+{
+    const uint8_t *u8data;
+    uint32_t crc;
+    int bit;
+
+    crc = 0xffffffff;
+    for (u8data = data; len > 0; u8data++, len--) {
+        crc ^= *u8data;
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static struct boot_retained *
+boot_retained(void)
+{
+    return boot_token_ram();
+}
+
+static bool
+boot_token_valid(const struct boot_token *token)
+{
+    return token->bt_magic == BOOT_TOKEN_MAGIC &&
+           token->bt_crc == boot_token_crc32(token,
+                                             offsetof(struct boot_token,
+                                                      bt_crc));
+}
+
+void
+boot_token_flash_changed(void)
+{
+    boot_retained()->br_generation++;
+}
+
+static bool
+boot_token_state_equal(const struct boot_swap_state *a,
+                       const struct boot_swap_state *b)
+{
+    return a->magic == b->magic &&
+           a->copy_done == b->copy_done &&
+           a->image_ok == b->image_ok;
+}
+
+/*
+ * Compares the token with flash: the trailer states of both slots, and the
+ * header and recorded hash of the booted image.
+ *
+ * Returns 0 if they match; nonzero otherwise.
+ */
+static int
+boot_token_matches_flash(const struct boot_token *token)
+{
+    const struct flash_area *fap;
+    struct boot_swap_state state;
+    struct image_header hdr;
+    uint8_t hash[32];
+    int rc;
+
+    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_0, &state);
+    if (rc != 0 || !boot_token_state_equal(&state, &token->bt_slot0)) {
+        return -1;
+    }
+    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_1, &state);
+    if (rc != 0 || !boot_token_state_equal(&state, &token->bt_slot1)) {
+        return -1;
+    }
+
+    rc = flash_area_open(flash_area_id_from_image_slot(token->bt_slot), &fap);
+    if (rc != 0) {
+        return -1;
+    }
+    rc = flash_area_read(fap, 0, &hdr, sizeof hdr);
+    if (rc == 0 && memcmp(&hdr, &token->bt_hdr, sizeof hdr) != 0) {
+        rc = -1;
+    }
+    if (rc == 0) {
+        rc = bootutil_img_recorded_hash(&hdr, fap, hash);
+    }
+    if (rc == 0 && memcmp(hash, token->bt_hash, sizeof hash) != 0) {
+        rc = -1;
+    }
+    flash_area_close(fap);
+
+    return rc;
+}
+
+/**
+ * Checks for a token left by a previous boot, with no flash change since.
+ * Besides the generation, the trailers, and the header and recorded hash of
+ * the booted image, are checked against flash.
+ *
+ * @param hdr                   The booted image header is copied here.
+ * @param rsp                   Filled in as the previous boot did.
+ *
+ * @return                      0 if the token is valid; nonzero otherwise.
+ */
+int
+boot_token_check(struct image_header *hdr, struct boot_rsp *rsp)
+{
+    const struct boot_retained *ret;
+    const struct boot_token *token;
+
+    ret = boot_retained();
+    token = &ret->br_token;
+
+    if (!boot_token_valid(token) ||
+            token->bt_generation != ret->br_generation) {
+        return -1;
+    }
+
+    /* Only saved when no swap was pending, so this cannot happen. */
+    if (boot_swap_type_from_states(&token->bt_slot0,
+                                   &token->bt_slot1) != BOOT_SWAP_TYPE_NONE) {
+        return -1;
+    }
+
+    if (boot_token_matches_flash(token) != 0) {
+        return -1;
+    }
+
+    memcpy(hdr, &token->bt_hdr, sizeof *hdr);
+    rsp->br_hdr = hdr;
+    rsp->br_flash_dev_id = token->bt_flash_dev_id;
+    rsp->br_image_off = token->bt_image_off;
+    rsp->br_slot = token->bt_slot;
+
+    return 0;
+}
+
+/**
+ * Records the boot described by rsp, if the next boot would make the same
+ * decision; otherwise clears the token.
+ *
+ * @param rsp                   The response about to be returned by boot_go.
+ * @param fap                   The area rsp boots from.
+ * @param slot0                 The slot 0 trailer state after the boot.
+ * @param slot1                 The slot 1 trailer state after the boot.
+ */
+void
+boot_token_save(const struct boot_rsp *rsp, const struct flash_area *fap,
+                const struct boot_swap_state *slot0,
+                const struct boot_swap_state *slot1)
+{
+    struct boot_retained *ret;
+    struct boot_token *token;
+
+    ret = boot_retained();
+    token = &ret->br_token;
+    memset(token, 0, sizeof *token);
+
+    if (boot_swap_type_from_states(slot0, slot1) != BOOT_SWAP_TYPE_NONE) {
+        return;
+    }
+    if (bootutil_img_recorded_hash(rsp->br_hdr, fap, token->bt_hash) != 0) {
+        return;
+    }
+
+    token->bt_generation = ret->br_generation;
+    memcpy(&token->bt_hdr, rsp->br_hdr, sizeof token->bt_hdr);
+    token->bt_slot0 = *slot0;
+    token->bt_slot1 = *slot1;
+    token->bt_flash_dev_id = rsp->br_flash_dev_id;
+    token->bt_image_off = rsp->br_image_off;
+    token->bt_slot = rsp->br_slot;
+    token->bt_magic = BOOT_TOKEN_MAGIC;
+    token->bt_crc = boot_token_crc32(token, offsetof(struct boot_token,
+                                                     bt_crc));
+}
+
+int
+boot_token_image_hash(uint8_t *out_hash)
+{
+    const struct boot_retained *ret;
+    const struct boot_token *token;
+
+    ret = boot_retained();
+    token = &ret->br_token;
+
+    if (!boot_token_valid(token)) {
+        return -1;
+    }
+
+    memcpy(out_hash, token->bt_hash, sizeof token->bt_hash);
+    return 0;
+}
+
+#endif /* MCUBOOT_BOOT_TOKEN */
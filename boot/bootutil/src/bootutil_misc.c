@@ -32,6 +32,9 @@
 #ifdef MCUBOOT_ENC_IMAGES
 #include "bootutil/enc_key.h"
 #endif
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+#include "bootutil/deferred.h"
+#endif
 
 MCUBOOT_LOG_MODULE_DECLARE(mcuboot);
 
@@ -44,9 +47,6 @@ const uint32_t boot_img_magic[] = {
     0x8079b62c,
 };
 
-#define BOOT_MAGIC_ARR_SZ \
-    (sizeof boot_img_magic / sizeof boot_img_magic[0])
-
 const uint32_t BOOT_MAGIC_SZ = sizeof boot_img_magic;
 const uint32_t BOOT_MAX_ALIGN = MAX_FLASH_ALIGN;
 
@@ -118,11 +118,25 @@ boot_flag_decode(uint8_t flag)
     return BOOT_FLAG_SET;
 }
 
+/**
+ * Size of the swap status kept for the given number of sectors.
+ */
+uint32_t
+boot_status_sz(uint8_t min_write_sz, int num_sectors)
+{
+#ifdef MCUBOOT_STATUS_BIT_CLEAR
+    /* One byte per sector, rounded up to whole writes. */
+    return (num_sectors + min_write_sz - 1) / min_write_sz * min_write_sz;
+#else
+    return num_sectors * BOOT_STATUS_STATE_COUNT * min_write_sz;
+#endif
+}
+
 uint32_t
 boot_slots_trailer_sz(uint8_t min_write_sz)
 {
     return /* state for all sectors */
-           BOOT_STATUS_MAX_ENTRIES * BOOT_STATUS_STATE_COUNT * min_write_sz +
+           boot_status_sz(min_write_sz, BOOT_STATUS_MAX_ENTRIES) +
 #ifdef MCUBOOT_ENC_IMAGES
            /* encryption keys */
            BOOT_ENC_KEY_SIZE * 2                  +
@@ -136,7 +150,7 @@ static uint32_t
 boot_scratch_trailer_sz(uint8_t min_write_sz)
 {
            /* state for one sector */
-    return BOOT_STATUS_STATE_COUNT * min_write_sz +
+    return boot_status_sz(min_write_sz, 1)        +
 #ifdef MCUBOOT_ENC_IMAGES
            /* encryption keys */
            BOOT_ENC_KEY_SIZE * 2                  +
@@ -159,9 +173,17 @@ boot_status_entries(const struct flash_area *fap)
     switch (fap->fa_id) {
     case FLASH_AREA_IMAGE_0:
     case FLASH_AREA_IMAGE_1:
+#ifdef MCUBOOT_STATUS_BIT_CLEAR
+        return BOOT_STATUS_MAX_ENTRIES;
+#else
         return BOOT_STATUS_STATE_COUNT * BOOT_STATUS_MAX_ENTRIES;
+#endif
     case FLASH_AREA_IMAGE_SCRATCH:
+#ifdef MCUBOOT_STATUS_BIT_CLEAR
+        return 1;
+#else
         return BOOT_STATUS_STATE_COUNT;
+#endif
     default:
         return BOOT_EBADARGS;
     }
@@ -228,53 +250,126 @@ boot_enc_key_off(const struct flash_area *fap, uint8_t slot)
 }
 #endif
 
+/**
+ * Fills in the read vectors fetching the trailer fields of a swap state.
+ *
+ * @param fap                   The area holding the trailer.
+ * @param raw                   Where the fields are read to.
+ * @param iov                   Room for BOOT_SWAP_STATE_IOV_MAX read vectors.
+ *
+ * @return                      The number of read vectors used.
+ */
 int
-boot_read_swap_state(const struct flash_area *fap,
-                     struct boot_swap_state *state)
+boot_swap_state_iov(const struct flash_area *fap,
+                    struct boot_swap_state_raw *raw,
+                    struct flash_area_iov *iov)
 {
-    uint32_t magic[BOOT_MAGIC_ARR_SZ];
-    uint32_t off;
-    int rc;
+    int cnt;
 
-    off = boot_magic_off(fap);
-    rc = flash_area_read_is_empty(fap, off, magic, BOOT_MAGIC_SZ);
-    if (rc < 0) {
-        return BOOT_EFLASH;
+    cnt = 0;
+    iov[cnt].fiov_fa = fap;
+    iov[cnt].fiov_off = boot_magic_off(fap);
+    iov[cnt].fiov_dst = raw->magic;
+    iov[cnt].fiov_len = BOOT_MAGIC_SZ;
+    cnt++;
+
+    if (fap->fa_id != FLASH_AREA_IMAGE_SCRATCH) {
+        iov[cnt].fiov_fa = fap;
+        iov[cnt].fiov_off = boot_copy_done_off(fap);
+        iov[cnt].fiov_dst = &raw->copy_done;
+        iov[cnt].fiov_len = sizeof raw->copy_done;
+        cnt++;
     }
-    if (rc == 1) {
+
+    iov[cnt].fiov_fa = fap;
+    iov[cnt].fiov_off = boot_image_ok_off(fap);
+    iov[cnt].fiov_dst = &raw->image_ok;
+    iov[cnt].fiov_len = sizeof raw->image_ok;
+    cnt++;
+
+    return cnt;
+}
+
+/**
+ * Decodes trailer fields read with the vectors from boot_swap_state_iov().
+ *
+ * @param fap                   The area holding the trailer.
+ * @param raw                   The fields read.
+ * @param iov                   The read vectors, telling which fields are
+ *                                  erased.
+ * @param state                 The decoded state gets written here.
+ */
+void
+boot_swap_state_decode(const struct flash_area *fap,
+                       const struct boot_swap_state_raw *raw,
+                       const struct flash_area_iov *iov,
+                       struct boot_swap_state *state)
+{
+    if (iov->fiov_empty) {
         state->magic = BOOT_MAGIC_UNSET;
     } else {
-        state->magic = boot_magic_decode(magic);
+        state->magic = boot_magic_decode(raw->magic);
     }
+    iov++;
 
     if (fap->fa_id != FLASH_AREA_IMAGE_SCRATCH) {
-        off = boot_copy_done_off(fap);
-        rc = flash_area_read_is_empty(fap, off, &state->copy_done,
-                sizeof state->copy_done);
-        if (rc < 0) {
-            return BOOT_EFLASH;
-        }
-        if (rc == 1) {
+        if (iov->fiov_empty) {
             state->copy_done = BOOT_FLAG_UNSET;
         } else {
-            state->copy_done = boot_flag_decode(state->copy_done);
+            state->copy_done = boot_flag_decode(raw->copy_done);
         }
+        iov++;
     }
 
-    off = boot_image_ok_off(fap);
-    rc = flash_area_read_is_empty(fap, off, &state->image_ok, sizeof state->image_ok);
-    if (rc < 0) {
-        return BOOT_EFLASH;
-    }
-    if (rc == 1) {
+    if (iov->fiov_empty) {
         state->image_ok = BOOT_FLAG_UNSET;
     } else {
-        state->image_ok = boot_flag_decode(state->image_ok);
+        state->image_ok = boot_flag_decode(raw->image_ok);
+    }
+}
+
+/*
+ * Generic vectored read, servicing the elements in order.  Backends whose
+ * flash gains from batching the requests provide their own.
+ */
+int __attribute__((weak))
+flash_area_readv(struct flash_area_iov *iov, int iovcnt)
+{
+    int rc;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        rc = flash_area_read_is_empty(iov[i].fiov_fa, iov[i].fiov_off,
+                                      iov[i].fiov_dst, iov[i].fiov_len);
+        if (rc < 0) {
+            return rc;
+        }
+        iov[i].fiov_empty = rc;
     }
 
     return 0;
 }
 
+int
+boot_read_swap_state(const struct flash_area *fap,
+                     struct boot_swap_state *state)
+{
+    struct flash_area_iov iov[BOOT_SWAP_STATE_IOV_MAX];
+    struct boot_swap_state_raw raw;
+    int cnt;
+    int rc;
+
+    cnt = boot_swap_state_iov(fap, &raw, iov);
+    rc = flash_area_readv(iov, cnt);
+    if (rc != 0) {
+        return BOOT_EFLASH;
+    }
+
+    boot_swap_state_decode(fap, &raw, iov, state);
+
+    return 0;
+}
+
 /**
  * Reads the image trailer from the scratch area.
  */
@@ -426,6 +521,7 @@ boot_write_magic(const struct flash_area *fap)
 
     off = boot_magic_off(fap);
 
+    BOOT_TOKEN_FLASH_CHANGED();
     rc = flash_area_write(fap, off, boot_img_magic, BOOT_MAGIC_SZ);
     if (rc != 0) {
         return BOOT_EFLASH;
@@ -460,6 +556,7 @@ boot_write_flag(int flag, const struct flash_area *fap)
     memset(buf, erased_val, BOOT_MAX_ALIGN);
     buf[0] = BOOT_FLAG_SET;
 
+    BOOT_TOKEN_FLASH_CHANGED();
     rc = flash_area_write(fap, off, buf, align);
     if (rc != 0) {
         return BOOT_EFLASH;
@@ -499,6 +596,7 @@ boot_write_swap_size(const struct flash_area *fap, uint32_t swap_size)
     memset(buf, erased_val, BOOT_MAX_ALIGN);
     memcpy(buf, (uint8_t *)&swap_size, sizeof swap_size);
 
+    BOOT_TOKEN_FLASH_CHANGED();
     rc = flash_area_write(fap, off, buf, align);
     if (rc != 0) {
         return BOOT_EFLASH;
@@ -515,6 +613,7 @@ boot_write_enc_key(const struct flash_area *fap, uint8_t slot, const uint8_t *en
     int rc;
 
     off = boot_enc_key_off(fap, slot);
+    BOOT_TOKEN_FLASH_CHANGED();
     rc = flash_area_write(fap, off, enckey, BOOT_ENC_KEY_SIZE);
     if (rc != 0) {
         return BOOT_EFLASH;
@@ -524,38 +623,30 @@ boot_write_enc_key(const struct flash_area *fap, uint8_t slot, const uint8_t *en
 }
 #endif
 
+/**
+ * Determines the swap type requested by the given slot 0 and slot 1 trailer
+ * states.
+ */
 int
-boot_swap_type(void)
+boot_swap_type_from_states(const struct boot_swap_state *slot0,
+                           const struct boot_swap_state *slot1)
 {
     const struct boot_swap_table *table;
-    struct boot_swap_state slot0;
-    struct boot_swap_state slot1;
-    int rc;
     size_t i;
 
-    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_0, &slot0);
-    if (rc) {
-        return BOOT_SWAP_TYPE_PANIC;
-    }
-
-    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_1, &slot1);
-    if (rc) {
-        return BOOT_SWAP_TYPE_PANIC;
-    }
-
     for (i = 0; i < BOOT_SWAP_TABLES_COUNT; i++) {
         table = boot_swap_tables + i;
 
         if ((table->magic_slot0 == BOOT_MAGIC_ANY ||
-                    table->magic_slot0 == slot0.magic) &&
+                    table->magic_slot0 == slot0->magic) &&
             (table->magic_slot1 == BOOT_MAGIC_ANY ||
-                    table->magic_slot1 == slot1.magic) &&
+                    table->magic_slot1 == slot1->magic) &&
             (table->image_ok_slot0 == BOOT_FLAG_ANY ||
-                    table->image_ok_slot0 == slot0.image_ok) &&
+                    table->image_ok_slot0 == slot0->image_ok) &&
             (table->image_ok_slot1 == BOOT_FLAG_ANY ||
-                    table->image_ok_slot1 == slot1.image_ok) &&
+                    table->image_ok_slot1 == slot1->image_ok) &&
             (table->copy_done_slot0 == BOOT_FLAG_ANY ||
-                    table->copy_done_slot0 == slot0.copy_done)) {
+                    table->copy_done_slot0 == slot0->copy_done)) {
             BOOT_LOG_INF("Swap type: %s",
                          table->swap_type == BOOT_SWAP_TYPE_TEST   ? "test"   :
                          table->swap_type == BOOT_SWAP_TYPE_PERM   ? "perm"   :
@@ -572,36 +663,46 @@ boot_swap_type(void)
     return BOOT_SWAP_TYPE_NONE;
 }
 
-/**
- * Marks the image in slot 1 as pending.  On the next reboot, the system will
- * perform a one-time boot of the slot 1 image.
- *
- * @param permanent         Whether the image should be used permanently or
- *                              only tested once:
- *                                  0=run image once, then confirm or revert.
- *                                  1=run image forever.
- *
- * @return                  0 on success; nonzero on failure.
- */
 int
-boot_set_pending(int permanent)
+boot_swap_type(void)
+{
+    struct boot_swap_state slot0;
+    struct boot_swap_state slot1;
+    int rc;
+
+    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_0, &slot0);
+    if (rc) {
+        return BOOT_SWAP_TYPE_PANIC;
+    }
+
+    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_1, &slot1);
+    if (rc) {
+        return BOOT_SWAP_TYPE_PANIC;
+    }
+
+    return boot_swap_type_from_states(&slot0, &slot1);
+}
+
+/* Writes the trailer of a pending image to the given area. */
+static int
+boot_set_pending_area(int area_id, int permanent)
 {
     const struct flash_area *fap;
-    struct boot_swap_state state_slot1;
+    struct boot_swap_state state;
     int rc;
 
-    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_1, &state_slot1);
+    rc = boot_read_swap_state_by_id(area_id, &state);
     if (rc != 0) {
         return rc;
     }
 
-    switch (state_slot1.magic) {
+    switch (state.magic) {
     case BOOT_MAGIC_GOOD:
         /* Swap already scheduled. */
         return 0;
 
     case BOOT_MAGIC_UNSET:
-        rc = flash_area_open(FLASH_AREA_IMAGE_1, &fap);
+        rc = flash_area_open(area_id, &fap);
         if (rc != 0) {
             rc = BOOT_EFLASH;
         } else {
@@ -623,23 +724,49 @@ boot_set_pending(int permanent)
 }
 
 /**
- * Marks the image in slot 0 as confirmed.  The system will continue booting into the image in slot 0 until told to boot from a different slot.
+ * Marks the image in slot 1 as pending.  On the next reboot, the system will
+ * perform a one-time boot of the slot 1 image.
+ *
+ * @param permanent         Whether the image should be used permanently or
+ *                              only tested once:
+ *                                  0=run image once, then confirm or revert.
+ *                                  1=run image forever.
  *
  * @return                  0 on success; nonzero on failure.
  */
 int
-boot_set_confirmed(void)
+boot_set_pending(int permanent)
+{
+    return boot_set_pending_area(FLASH_AREA_IMAGE_1, permanent);
+}
+
+#ifdef MCUBOOT_PIC_IMAGES
+/**
+ * Marks the PIC image in the given slot as pending.  On the next reboot, the
+ * system will boot it in place, once or permanently.
+ */
+int
+boot_set_pending_slot(int slot, int permanent)
+{
+    return boot_set_pending_area(flash_area_id_from_image_slot(slot),
+                                 permanent);
+}
+#endif
+
+/* Sets image_ok in the trailer of a booted image in the given area. */
+static int
+boot_set_confirmed_area(int area_id)
 {
     const struct flash_area *fap;
-    struct boot_swap_state state_slot0;
+    struct boot_swap_state state;
     int rc;
 
-    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_0, &state_slot0);
+    rc = boot_read_swap_state_by_id(area_id, &state);
     if (rc != 0) {
         return rc;
     }
 
-    switch (state_slot0.magic) {
+    switch (state.magic) {
     case BOOT_MAGIC_GOOD:
         /* Confirm needed; proceed. */
         break;
@@ -653,19 +780,19 @@ boot_set_confirmed(void)
         return BOOT_EBADVECT;
     }
 
-    rc = flash_area_open(FLASH_AREA_IMAGE_0, &fap);
+    rc = flash_area_open(area_id, &fap);
     if (rc) {
         rc = BOOT_EFLASH;
         goto done;
     }
 
-    if (state_slot0.copy_done == BOOT_FLAG_UNSET) {
+    if (state.copy_done == BOOT_FLAG_UNSET) {
         /* Swap never completed.  This is unexpected. */
         rc = BOOT_EBADVECT;
         goto done;
     }
 
-    if (state_slot0.image_ok != BOOT_FLAG_UNSET) {
+    if (state.image_ok != BOOT_FLAG_UNSET) {
         /* Already confirmed. */
         goto done;
     }
@@ -676,3 +803,64 @@ done:
     flash_area_close(fap);
     return rc;
 }
+
+/**
+ * Marks the image in slot 0 as confirmed.  The system will continue booting into the image in slot 0 until told to boot from a different slot.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+int
+boot_set_confirmed(void)
+{
+    return boot_set_confirmed_area(FLASH_AREA_IMAGE_0);
+}
+
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+/**
+ * Makes the next boot go back to the previous image, after the image in
+ * slot 0 failed its deferred check.  An image being tested is reverted anyway
+ * as long as it is not confirmed.  For a confirmed image, the one in slot 1,
+ * where the last swap left the previous image, is made pending permanently;
+ * if it is not valid either, the boot loader discards it and boots slot 0
+ * again.
+ *
+ * Overwrite-only upgrades keep no previous image, so there is nothing to go
+ * back to.
+ *
+ * @return                  0 on success; BOOT_EBADIMAGE with
+ *                              MCUBOOT_OVERWRITE_ONLY; nonzero on failure.
+ */
+int
+boot_deferred_revert(void)
+{
+#ifdef MCUBOOT_OVERWRITE_ONLY
+    return BOOT_EBADIMAGE;
+#else
+    struct boot_swap_state state;
+    int rc;
+
+    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_0, &state);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (state.magic == BOOT_MAGIC_GOOD && state.image_ok == BOOT_FLAG_UNSET) {
+        /* Still being tested. */
+        return 0;
+    }
+
+    return boot_set_pending(1);
+#endif
+}
+#endif
+
+#ifdef MCUBOOT_PIC_IMAGES
+/**
+ * Marks the PIC image running in place from the given slot as confirmed.
+ */
+int
+boot_set_confirmed_slot(int slot)
+{
+    return boot_set_confirmed_area(flash_area_id_from_image_slot(slot));
+}
+#endif
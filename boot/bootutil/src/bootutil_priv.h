@@ -42,6 +42,7 @@ extern "C" {
 #endif
 
 struct flash_area;
+struct boot_rsp;
 
 #define BOOT_EFLASH     1
 #define BOOT_EFILE      2
@@ -85,6 +86,15 @@ struct boot_status {
 #define BOOT_STATUS_STATE_1 2
 #define BOOT_STATUS_STATE_2 3
 
+#ifdef MCUBOOT_STATUS_BIT_CLEAR
+/*
+ * With the bit-clearing status encoding, each sector has a single status
+ * byte.  Every state reached moves one more bit away from the erased value,
+ * so the byte is programmed again in place instead of using a new entry.
+ */
+#define BOOT_STATUS_BITS(state) ((1 << (state)) - 1)
+#endif
+
 /**
  * End-of-image slot structure.
  *
@@ -109,12 +119,25 @@ struct boot_status {
 
 extern const uint32_t boot_img_magic[4];
 
+#define BOOT_MAGIC_ARR_SZ \
+    (sizeof boot_img_magic / sizeof boot_img_magic[0])
+
 struct boot_swap_state {
     uint8_t magic;  /* One of the BOOT_MAGIC_[...] values. */
     uint8_t copy_done;
     uint8_t image_ok;
 };
 
+/** Trailer fields backing a struct boot_swap_state, as stored in flash. */
+struct boot_swap_state_raw {
+    uint32_t magic[BOOT_MAGIC_ARR_SZ];
+    uint8_t copy_done;
+    uint8_t image_ok;
+};
+
+/** Maximum number of read vectors needed to fetch one swap state. */
+#define BOOT_SWAP_STATE_IOV_MAX    3
+
 #define BOOT_MAX_IMG_SECTORS       MCUBOOT_MAX_IMG_SECTORS
 
 /*
@@ -142,6 +165,22 @@ struct boot_swap_state {
 #define BOOT_FLAG_IMAGE_OK         0
 #define BOOT_FLAG_COPY_DONE        1
 
+#ifdef MCUBOOT_SPARSE_IMAGES
+/** Maximum number of fill ranges accepted in a sparse image. */
+#ifndef MCUBOOT_SPARSE_MAX_RANGES
+#define MCUBOOT_SPARSE_MAX_RANGES  8
+#endif
+#define BOOT_SPARSE_MAX_RANGES     MCUBOOT_SPARSE_MAX_RANGES
+#endif
+
+#ifdef MCUBOOT_VERIFY_WRITES
+/** Number of times a copy that does not read back correctly is redone. */
+#ifndef MCUBOOT_VERIFY_WRITES_RETRIES
+#define MCUBOOT_VERIFY_WRITES_RETRIES  2
+#endif
+#define BOOT_VERIFY_WRITES_RETRIES     MCUBOOT_VERIFY_WRITES_RETRIES
+#endif
+
 extern const uint32_t BOOT_MAGIC_SZ;
 
 /**
@@ -176,6 +215,7 @@ struct boot_loader_state {
 int bootutil_verify_sig(uint8_t *hash, uint32_t hlen, uint8_t *sig,
                         size_t slen, uint8_t key_id);
 
+uint32_t boot_status_sz(uint8_t min_write_sz, int num_sectors);
 uint32_t boot_slots_trailer_sz(uint8_t min_write_sz);
 int boot_status_entries(const struct flash_area *fap);
 uint32_t boot_status_off(const struct flash_area *fap);
@@ -183,6 +223,15 @@ int boot_read_swap_state(const struct flash_area *fap,
                          struct boot_swap_state *state);
 int boot_read_swap_state_by_id(int flash_area_id,
                                struct boot_swap_state *state);
+int boot_swap_state_iov(const struct flash_area *fap,
+                        struct boot_swap_state_raw *raw,
+                        struct flash_area_iov *iov);
+void boot_swap_state_decode(const struct flash_area *fap,
+                            const struct boot_swap_state_raw *raw,
+                            const struct flash_area_iov *iov,
+                            struct boot_swap_state *state);
+int boot_swap_type_from_states(const struct boot_swap_state *slot0,
+                               const struct boot_swap_state *slot1);
 int boot_write_magic(const struct flash_area *fap);
 int boot_write_status(struct boot_status *bs);
 int boot_schedule_test_swap(void);
@@ -195,6 +244,33 @@ int boot_write_enc_key(const struct flash_area *fap, uint8_t slot,
                        const uint8_t *enckey);
 int boot_read_enc_key(uint8_t slot, uint8_t *enckey);
 #endif
+#ifdef MCUBOOT_BOOT_TOKEN
+int boot_token_check(struct image_header *hdr, struct boot_rsp *rsp);
+void boot_token_save(const struct boot_rsp *rsp, const struct flash_area *fap,
+                     const struct boot_swap_state *slot0,
+                     const struct boot_swap_state *slot1);
+int bootutil_img_recorded_hash(const struct image_header *hdr,
+                               const struct flash_area *fap,
+                               uint8_t *out_hash);
+#define BOOT_TOKEN_FLASH_CHANGED()  boot_token_flash_changed()
+#else
+#define BOOT_TOKEN_FLASH_CHANGED()  do { } while (0)
+#endif
+#ifdef MCUBOOT_SPARSE_IMAGES
+int bootutil_img_sparse_ranges(struct image_header *hdr,
+                               const struct flash_area *fap,
+                               struct image_sparse_range *ranges,
+                               int max_ranges);
+#endif
+#ifdef MCUBOOT_PIC_IMAGES
+int bootutil_img_relocs(const struct image_header *hdr,
+                        const struct flash_area *fap, uint32_t *out_off);
+#endif
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+int bootutil_img_validate_prefix(struct image_header *hdr,
+                                 const struct flash_area *fap,
+                                 uint8_t *tmp_buf, uint32_t tmp_buf_sz);
+#endif
 
 /*
  * Accessors for the contents of struct boot_loader_state.
@@ -44,6 +44,30 @@ uint32_t bootutil_get_caps(void)
 #if defined(MCUBOOT_VALIDATE_SLOT0)
 	res |= BOOTUTIL_CAP_VALIDATE_SLOT0;
 #endif
+#if defined(MCUBOOT_SPARSE_IMAGES)
+	res |= BOOTUTIL_CAP_SPARSE_IMAGES;
+#endif
+#if defined(MCUBOOT_BANK_SWAP)
+	res |= BOOTUTIL_CAP_BANK_SWAP;
+#endif
+#if defined(MCUBOOT_BOOT_TOKEN)
+	res |= BOOTUTIL_CAP_BOOT_TOKEN;
+#endif
+#if defined(MCUBOOT_STATUS_BIT_CLEAR)
+	res |= BOOTUTIL_CAP_STATUS_BIT_CLEAR;
+#endif
+#if defined(MCUBOOT_PIC_IMAGES)
+	res |= BOOTUTIL_CAP_PIC_IMAGES;
+#endif
+#if defined(MCUBOOT_VERIFY_WRITES)
+	res |= BOOTUTIL_CAP_VERIFY_WRITES;
+#endif
+#if defined(MCUBOOT_OVERLAP_COPY)
+	res |= BOOTUTIL_CAP_OVERLAP_COPY;
+#endif
+#if defined(MCUBOOT_DEFERRED_VALIDATION)
+	res |= BOOTUTIL_CAP_DEFERRED_VALIDATION;
+#endif
 
         return res;
 }
@@ -30,6 +30,56 @@
 #include "tinycrypt/ecc_dsa.h"
 #include "bootutil_priv.h"
 
+#ifdef MCUBOOT_EC256_NO_ASN1
+/*
+ * Keys are stored as DER, but a P-256 SubjectPublicKeyInfo always starts
+ * with these bytes, followed by the X and Y coordinates of the point:
+ * SEQUENCE { SEQUENCE { id-ecPublicKey, secp256r1 }, BIT STRING { 0x04 } }.
+ */
+static const uint8_t ec256_pubkey_prefix[] = {
+    0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86,
+    0x48, 0xce, 0x3d, 0x02, 0x01, 0x06, 0x08, 0x2a,
+    0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03,
+    0x42, 0x00, 0x04,
+};
+
+/*
+ * Check the public key used for signing, without parsing it.
+ */
+static int
+tinycrypt_import_key(uint8_t **cp, uint8_t *end)
+{
+    if ((size_t)(end - *cp) !=
+            sizeof(ec256_pubkey_prefix) + 2 * NUM_ECC_BYTES) {
+        return -1;
+    }
+    if (memcmp(*cp, ec256_pubkey_prefix, sizeof(ec256_pubkey_prefix))) {
+        return -2;
+    }
+
+    *cp += sizeof(ec256_pubkey_prefix);
+    return 0;
+}
+
+/*
+ * Read the tag and length of a DER element.  A signature is at most 72 bytes
+ * long, so only the short form of lengths is needed.
+ */
+static int
+tinycrypt_get_tag(uint8_t **cp, uint8_t *end, size_t *len, int tag)
+{
+    if (end - *cp < 2 || (*cp)[0] != tag || ((*cp)[1] & 0x80)) {
+        return -1;
+    }
+    *len = (*cp)[1];
+    *cp += 2;
+
+    if (*len > (size_t)(end - *cp)) {
+        return -1;
+    }
+    return 0;
+}
+#else
 /*
  * Declaring these like this adds NULL termination.
  */
@@ -86,6 +136,13 @@ tinycrypt_import_key(uint8_t **cp, uint8_t *end)
     return 0;
 }
 
+static int
+tinycrypt_get_tag(uint8_t **cp, uint8_t *end, size_t *len, int tag)
+{
+    return mbedtls_asn1_get_tag(cp, end, len, tag);
+}
+#endif /* MCUBOOT_EC256_NO_ASN1 */
+
 /*
  * cp points to ASN1 string containing an integer.
  * Verify the tag, and that the length is 32 bytes.
@@ -95,7 +152,7 @@ tinycrypt_read_bigint(uint8_t i[NUM_ECC_BYTES], uint8_t **cp, uint8_t *end)
 {
     size_t len;
 
-    if (mbedtls_asn1_get_tag(cp, end, &len, MBEDTLS_ASN1_INTEGER)) {
+    if (tinycrypt_get_tag(cp, end, &len, MBEDTLS_ASN1_INTEGER)) {
         return -3;
     }
 
@@ -118,8 +175,8 @@ tinycrypt_decode_sig(uint8_t signature[NUM_ECC_BYTES * 2], uint8_t *cp, uint8_t
     int rc;
     size_t len;
 
-    rc = mbedtls_asn1_get_tag(&cp, end, &len,
-                              MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE);
+    rc = tinycrypt_get_tag(&cp, end, &len,
+                           MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE);
     if (rc) {
         return -1;
     }
@@ -0,0 +1,135 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Load-time fixups of position-independent images.
+ *
+ * A PIC image is hashed and signed as linked, so it cannot be patched in
+ * flash.  Instead, the few tables holding absolute addresses, typically the
+ * vector table and the GOT, are copied to RAM, where the address the image
+ * runs from is added to the words flagged as relative.  The image finds its
+ * tables in RAM at the addresses given when it was signed.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <flash_map_backend/flash_map_backend.h>
+
+#include "bootutil/bootutil.h"
+#include "bootutil/image.h"
+#include "bootutil_priv.h"
+#include "bootutil/bootutil_log.h"
+
+#ifdef MCUBOOT_PIC_IMAGES
+
+MCUBOOT_LOG_MODULE_DECLARE(mcuboot);
+
+/* Words copied to RAM per flash read. */
+#define BOOT_RELOC_CHUNK        16
+
+static int
+boot_pic_apply(const struct flash_area *fap, const struct image_reloc *reloc,
+               uint32_t exec_addr, uint8_t *dst)
+{
+    uint32_t words[BOOT_RELOC_CHUNK];
+    uint32_t chunk;
+    uint32_t done;
+    uint32_t i;
+    int rc;
+
+    for (done = 0; done < reloc->ir_count; done += chunk) {
+        chunk = reloc->ir_count - done;
+        if (chunk > BOOT_RELOC_CHUNK) {
+            chunk = BOOT_RELOC_CHUNK;
+        }
+        rc = flash_area_read(fap, reloc->ir_off + done * 4, words, chunk * 4);
+        if (rc != 0) {
+            return BOOT_EFLASH;
+        }
+        if (reloc->ir_flags & IMAGE_RELOC_F_REL) {
+            for (i = 0; i < chunk; i++) {
+                words[i] += exec_addr;
+            }
+        }
+        memcpy(dst + done * 4, words, chunk * 4);
+    }
+
+    return 0;
+}
+
+int
+boot_pic_relocate(const struct boot_rsp *rsp, uint32_t exec_addr,
+                  void *ram, uint32_t ram_addr, uint32_t ram_sz)
+{
+    const struct flash_area *fap;
+    struct image_reloc reloc;
+    uint32_t off;
+    uint32_t len;
+    int count;
+    int rc;
+    int i;
+
+    if (!(rsp->br_hdr->ih_flags & IMAGE_F_PIC)) {
+        return 0;
+    }
+
+    rc = flash_area_open(flash_area_id_from_image_slot(rsp->br_slot), &fap);
+    if (rc != 0) {
+        return BOOT_EFLASH;
+    }
+
+    count = bootutil_img_relocs(rsp->br_hdr, fap, &off);
+    if (count < 0) {
+        rc = BOOT_EBADIMAGE;
+        goto done;
+    }
+
+    for (i = 0; i < count; i++) {
+        rc = flash_area_read(fap, off + i * sizeof(reloc), &reloc,
+                             sizeof(reloc));
+        if (rc != 0) {
+            rc = BOOT_EFLASH;
+            goto done;
+        }
+
+        len = reloc.ir_count * 4;
+        if (reloc.ir_dst < ram_addr || reloc.ir_dst - ram_addr > ram_sz ||
+                len > ram_sz - (reloc.ir_dst - ram_addr)) {
+            BOOT_LOG_ERR("Relocation to 0x%lx outside of RAM",
+                         (unsigned long)reloc.ir_dst);
+            rc = BOOT_EBADIMAGE;
+            goto done;
+        }
+
+        rc = boot_pic_apply(fap, &reloc, exec_addr,
+                            (uint8_t *)ram + (reloc.ir_dst - ram_addr));
+        if (rc != 0) {
+            goto done;
+        }
+    }
+    rc = 0;
+
+done:
+    flash_area_close(fap);
+    return rc;
+}
+
+#endif /* MCUBOOT_PIC_IMAGES */
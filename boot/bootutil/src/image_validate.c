@@ -33,6 +33,9 @@
 #ifdef MCUBOOT_ENC_IMAGES
 #include "bootutil/enc_key.h"
 #endif
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+#include "bootutil/deferred.h"
+#endif
 #if defined(MCUBOOT_SIGN_RSA)
 #include "mbedtls/rsa.h"
 #endif
@@ -43,70 +46,568 @@
 
 #include "bootutil_priv.h"
 
+#ifdef MCUBOOT_SPARSE_IMAGES
 /*
- * Compute SHA256 over the image.
+ * Read the fill ranges declared by a sparse image.  Ranges must be sorted,
+ * must not overlap and must lie within the image body.
+ *
+ * Returns the number of ranges, 0 if the image is not sparse, or -1 if the
+ * IMAGE_TLV_SPARSE record is missing or malformed.
  */
-static int
-bootutil_img_hash(struct image_header *hdr, const struct flash_area *fap,
-                  uint8_t *tmp_buf, uint32_t tmp_buf_sz,
-                  uint8_t *hash_result, uint8_t *seed, int seed_len)
+int
+bootutil_img_sparse_ranges(struct image_header *hdr,
+                           const struct flash_area *fap,
+                           struct image_sparse_range *ranges, int max_ranges)
 {
-    bootutil_sha256_context sha256_ctx;
-    uint32_t blk_sz;
-    uint32_t size;
-    uint16_t hdr_size;
+    struct image_tlv_info info;
+    struct image_tlv tlv;
+    uint32_t img_end;
+    uint32_t prev_end;
     uint32_t off;
+    uint32_t end;
+    int count;
+    int i;
     int rc;
-#ifdef MCUBOOT_ENC_IMAGES
-    uint32_t blk_off;
+
+    if (!(hdr->ih_flags & IMAGE_F_SPARSE)) {
+        return 0;
+    }
+
+    img_end = hdr->ih_hdr_size + hdr->ih_img_size;
+    off = img_end;
+    rc = flash_area_read(fap, off, &info, sizeof(info));
+    if (rc) {
+        return -1;
+    }
+    if (info.it_magic != IMAGE_TLV_INFO_MAGIC) {
+        return -1;
+    }
+    end = off + info.it_tlv_tot;
+    off += sizeof(info);
+
+    for (; off < end; off += sizeof(tlv) + tlv.it_len) {
+        rc = flash_area_read(fap, off, &tlv, sizeof tlv);
+        if (rc) {
+            return -1;
+        }
+        if (tlv.it_type != IMAGE_TLV_SPARSE) {
+            continue;
+        }
+
+        if (tlv.it_len == 0 || tlv.it_len % sizeof(*ranges) != 0) {
+            return -1;
+        }
+        count = tlv.it_len / sizeof(*ranges);
+        if (count > max_ranges) {
+            return -1;
+        }
+        rc = flash_area_read(fap, off + sizeof(tlv), ranges, tlv.it_len);
+        if (rc) {
+            return -1;
+        }
+
+        prev_end = hdr->ih_hdr_size;
+        for (i = 0; i < count; i++) {
+            if (ranges[i].isr_off < prev_end || ranges[i].isr_len == 0 ||
+                    ranges[i].isr_off > img_end ||
+                    ranges[i].isr_len > img_end - ranges[i].isr_off) {
+                return -1;
+            }
+            prev_end = ranges[i].isr_off + ranges[i].isr_len;
+        }
+
+        return count;
+    }
+
+    return -1;
+}
 #endif
 
-    bootutil_sha256_init(&sha256_ctx);
+#ifdef MCUBOOT_PIC_IMAGES
+/*
+ * Find the relocations declared by a PIC image.  Each relocated run of words
+ * must lie within the image body, and be copied to a word aligned address.
+ *
+ * Returns the number of relocations, with the flash offset of the first one
+ * in out_off, or 0 if there are none, or -1 if the IMAGE_TLV_RELOC record is
+ * malformed.
+ */
+int
+bootutil_img_relocs(const struct image_header *hdr,
+                    const struct flash_area *fap, uint32_t *out_off)
+{
+    struct image_tlv_info info;
+    struct image_reloc reloc;
+    struct image_tlv tlv;
+    uint32_t img_end;
+    uint32_t off;
+    uint32_t end;
+    int count;
+    int i;
+    int rc;
 
-    /* in some cases (split image) the hash is seeded with data from
-     * the loader image */
-    if (seed && (seed_len > 0)) {
-        bootutil_sha256_update(&sha256_ctx, seed, seed_len);
+    if (!(hdr->ih_flags & IMAGE_F_PIC)) {
+        return 0;
     }
 
-#ifdef MCUBOOT_ENC_IMAGES
-    /* Encrypted images only exist in slot1 */
-    if (fap->fa_id == FLASH_AREA_IMAGE_1 && IS_ENCRYPTED(hdr) && !boot_enc_valid(fap)) {
+    img_end = hdr->ih_hdr_size + hdr->ih_img_size;
+    off = img_end;
+    rc = flash_area_read(fap, off, &info, sizeof(info));
+    if (rc) {
+        return -1;
+    }
+    if (info.it_magic != IMAGE_TLV_INFO_MAGIC) {
         return -1;
     }
+    end = off + info.it_tlv_tot;
+    off += sizeof(info);
+
+    for (; off < end; off += sizeof(tlv) + tlv.it_len) {
+        rc = flash_area_read(fap, off, &tlv, sizeof tlv);
+        if (rc) {
+            return -1;
+        }
+        if (tlv.it_type != IMAGE_TLV_RELOC) {
+            continue;
+        }
+
+        if (tlv.it_len == 0 || tlv.it_len % sizeof(reloc) != 0) {
+            return -1;
+        }
+        count = tlv.it_len / sizeof(reloc);
+        off += sizeof(tlv);
+
+        for (i = 0; i < count; i++) {
+            rc = flash_area_read(fap, off + i * sizeof(reloc), &reloc,
+                                 sizeof(reloc));
+            if (rc) {
+                return -1;
+            }
+            if (reloc.ir_off < hdr->ih_hdr_size || reloc.ir_count == 0 ||
+                    reloc.ir_off > img_end ||
+                    reloc.ir_count * 4 > img_end - reloc.ir_off ||
+                    (reloc.ir_dst & 3) != 0) {
+                return -1;
+            }
+        }
+
+        *out_off = off;
+        return count;
+    }
+
+    /* Nothing to fix up. */
+    return 0;
+}
 #endif
 
-    /*
-     * Hash is computed over image header and image itself. No TLV is
-     * included ATM.
-     */
-    hdr_size = hdr->ih_hdr_size;
-    size = hdr->ih_img_size + hdr_size;
-    for (off = 0; off < size; off += blk_sz) {
-        blk_sz = size - off;
+#ifdef MCUBOOT_BOOT_TOKEN
+/*
+ * Read the SHA256 recorded in the image's TLVs, without checking it against
+ * the image.
+ */
+int
+bootutil_img_recorded_hash(const struct image_header *hdr,
+                           const struct flash_area *fap, uint8_t *out_hash)
+{
+    struct image_tlv_info info;
+    struct image_tlv tlv;
+    uint32_t off;
+    uint32_t end;
+    int rc;
+
+    off = hdr->ih_hdr_size + hdr->ih_img_size;
+    rc = flash_area_read(fap, off, &info, sizeof(info));
+    if (rc) {
+        return -1;
+    }
+    if (info.it_magic != IMAGE_TLV_INFO_MAGIC) {
+        return -1;
+    }
+    end = off + info.it_tlv_tot;
+    off += sizeof(info);
+
+    for (; off < end; off += sizeof(tlv) + tlv.it_len) {
+        rc = flash_area_read(fap, off, &tlv, sizeof tlv);
+        if (rc) {
+            return -1;
+        }
+        if (tlv.it_type == IMAGE_TLV_SHA256) {
+            if (tlv.it_len != 32) {
+                return -1;
+            }
+            rc = flash_area_read(fap, off + sizeof(tlv), out_hash, 32);
+            return rc ? -1 : 0;
+        }
+    }
+
+    return -1;
+}
+#endif
+
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+/*
+ * Read the IMAGE_TLV_HASH_PARTS record of an image whose hash is in two
+ * parts.  The second part must start within the image body.
+ *
+ * Returns 0, with parts->ihp_split set to 0 if the hash is in one part, or
+ * -1 if the record is missing or malformed.
+ */
+static int
+bootutil_img_hash_parts(const struct image_header *hdr,
+                        const struct flash_area *fap,
+                        struct image_hash_parts *parts)
+{
+    struct image_tlv_info info;
+    struct image_tlv tlv;
+    uint32_t img_end;
+    uint32_t off;
+    uint32_t end;
+    int rc;
+
+    if (!(hdr->ih_flags & IMAGE_F_HASH_PARTS)) {
+        parts->ihp_split = 0;
+        return 0;
+    }
+
+    img_end = hdr->ih_hdr_size + hdr->ih_img_size;
+    off = img_end;
+    rc = flash_area_read(fap, off, &info, sizeof(info));
+    if (rc) {
+        return -1;
+    }
+    if (info.it_magic != IMAGE_TLV_INFO_MAGIC) {
+        return -1;
+    }
+    end = off + info.it_tlv_tot;
+    off += sizeof(info);
+
+    for (; off < end; off += sizeof(tlv) + tlv.it_len) {
+        rc = flash_area_read(fap, off, &tlv, sizeof tlv);
+        if (rc) {
+            return -1;
+        }
+        if (tlv.it_type != IMAGE_TLV_HASH_PARTS) {
+            continue;
+        }
+
+        if (tlv.it_len != sizeof(*parts)) {
+            return -1;
+        }
+        rc = flash_area_read(fap, off + sizeof(tlv), parts, sizeof(*parts));
+        if (rc) {
+            return -1;
+        }
+        if (parts->ihp_split < hdr->ih_hdr_size || parts->ihp_split > img_end) {
+            return -1;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+#endif
+
+/* What hashing an image needs to know, besides its header. */
+struct bootutil_img_layout {
+    uint32_t size;      /* Of the header and body. */
+#ifdef MCUBOOT_SPARSE_IMAGES
+    struct image_sparse_range ranges[BOOT_SPARSE_MAX_RANGES];
+    int nranges;
+#endif
+#ifdef MCUBOOT_PIC_IMAGES
+    uint32_t reloc_off;
+    int nrelocs;
+#endif
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+    struct image_hash_parts parts;
+#endif
+};
+
+static int
+bootutil_img_layout(struct image_header *hdr, const struct flash_area *fap,
+                    struct bootutil_img_layout *layout)
+{
+    layout->size = hdr->ih_hdr_size + hdr->ih_img_size;
+
+#if !defined(MCUBOOT_SPARSE_IMAGES) && !defined(MCUBOOT_PIC_IMAGES) && \
+    !defined(MCUBOOT_DEFERRED_VALIDATION)
+    (void)fap;
+#endif
+
+#ifdef MCUBOOT_SPARSE_IMAGES
+    layout->nranges = bootutil_img_sparse_ranges(hdr, fap, layout->ranges,
+                                                 BOOT_SPARSE_MAX_RANGES);
+    if (layout->nranges < 0) {
+        return -1;
+    }
+#endif
+#ifdef MCUBOOT_PIC_IMAGES
+    layout->nrelocs = bootutil_img_relocs(hdr, fap, &layout->reloc_off);
+    if (layout->nrelocs < 0) {
+        return -1;
+    }
+#endif
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+    if (bootutil_img_hash_parts(hdr, fap, &layout->parts) != 0) {
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Hash the header and body of the image from off up to end.
+ *
+ * For sparse images the bytes within the declared fill ranges are not
+ * hashed; they are only compared against their fill value.
+ *
+ * Returns 0, BOOT_EFLASH if the flash cannot be read, or BOOT_EBADIMAGE if a
+ * fill range does not hold its fill value.
+ */
+static int
+bootutil_img_hash_range(struct image_header *hdr, const struct flash_area *fap,
+                        const struct bootutil_img_layout *layout,
+                        bootutil_sha256_context *sha256_ctx,
+                        uint32_t off, uint32_t end,
+                        uint8_t *tmp_buf, uint32_t tmp_buf_sz)
+{
+    uint32_t blk_sz;
+    int rc;
+#ifdef MCUBOOT_ENC_IMAGES
+    uint32_t blk_off;
+#endif
+#ifdef MCUBOOT_SPARSE_IMAGES
+    const struct image_sparse_range *ranges;
+    uint32_t range_end;
+    uint32_t i;
+    int hole;
+    int r;
+
+    ranges = layout->ranges;
+    r = 0;
+#else
+    (void)layout;
+#endif
+#ifndef MCUBOOT_ENC_IMAGES
+    (void)hdr;
+#endif
+
+    for (; off < end; off += blk_sz) {
+        blk_sz = end - off;
         if (blk_sz > tmp_buf_sz) {
             blk_sz = tmp_buf_sz;
         }
+#ifdef MCUBOOT_SPARSE_IMAGES
+        /* Never mix bytes from inside and outside of a fill range. */
+        while (r < layout->nranges &&
+                off >= ranges[r].isr_off + ranges[r].isr_len) {
+            r++;
+        }
+        hole = 0;
+        if (r < layout->nranges) {
+            range_end = ranges[r].isr_off + ranges[r].isr_len;
+            if (off < ranges[r].isr_off) {
+                if (off + blk_sz > ranges[r].isr_off) {
+                    blk_sz = ranges[r].isr_off - off;
+                }
+            } else {
+                hole = 1;
+                if (off + blk_sz > range_end) {
+                    blk_sz = range_end - off;
+                }
+            }
+        }
+#endif
 #ifdef MCUBOOT_ENC_IMAGES
         /* Avoid reading header data together with other image data
          * because the header is not encrypted, so maintain correct
          * bounds when sending encrypted data to decrypt routine.
          */
-        if ((off < hdr_size) && ((off + blk_sz) > hdr_size)) {
-            blk_sz = hdr_size - off;
+        if ((off < hdr->ih_hdr_size) && ((off + blk_sz) > hdr->ih_hdr_size)) {
+            blk_sz = hdr->ih_hdr_size - off;
         }
 #endif
         rc = flash_area_read(fap, off, tmp_buf, blk_sz);
+        if (rc) {
+            return BOOT_EFLASH;
+        }
+#ifdef MCUBOOT_ENC_IMAGES
+        if (fap->fa_id == FLASH_AREA_IMAGE_1 && IS_ENCRYPTED(hdr) &&
+                off >= hdr->ih_hdr_size) {
+            blk_off = (off - hdr->ih_hdr_size) & 0xf;
+            boot_encrypt(fap, off - hdr->ih_hdr_size, blk_sz, blk_off,
+                         tmp_buf);
+        }
+#endif
+#ifdef MCUBOOT_SPARSE_IMAGES
+        if (hole) {
+            for (i = 0; i < blk_sz; i++) {
+                if (tmp_buf[i] != ranges[r].isr_fill) {
+                    return BOOT_EBADIMAGE;
+                }
+            }
+            continue;
+        }
+#endif
+        bootutil_sha256_update(sha256_ctx, tmp_buf, blk_sz);
+    }
+
+    return 0;
+}
+
+/*
+ * Hash what follows the image body: the fill range descriptors of a sparse
+ * image, then the relocations of a PIC image.
+ */
+static int
+bootutil_img_hash_descs(const struct flash_area *fap,
+                        const struct bootutil_img_layout *layout,
+                        bootutil_sha256_context *sha256_ctx,
+                        uint8_t *tmp_buf, uint32_t tmp_buf_sz)
+{
+#ifdef MCUBOOT_PIC_IMAGES
+    uint32_t blk_sz;
+    uint32_t size;
+    uint32_t off;
+    int rc;
+#endif
+
+#if !defined(MCUBOOT_SPARSE_IMAGES) && !defined(MCUBOOT_PIC_IMAGES)
+    (void)layout;
+    (void)sha256_ctx;
+#endif
+#ifndef MCUBOOT_PIC_IMAGES
+    (void)fap;
+    (void)tmp_buf;
+    (void)tmp_buf_sz;
+#endif
+
+#ifdef MCUBOOT_SPARSE_IMAGES
+    if (layout->nranges > 0) {
+        bootutil_sha256_update(sha256_ctx, layout->ranges,
+                               layout->nranges * sizeof(layout->ranges[0]));
+    }
+#endif
+#ifdef MCUBOOT_PIC_IMAGES
+    size = layout->nrelocs * sizeof(struct image_reloc);
+    for (off = 0; off < size; off += blk_sz) {
+        blk_sz = size - off;
+        if (blk_sz > tmp_buf_sz) {
+            blk_sz = tmp_buf_sz;
+        }
+        rc = flash_area_read(fap, layout->reloc_off + off, tmp_buf, blk_sz);
         if (rc) {
             return rc;
         }
+        bootutil_sha256_update(sha256_ctx, tmp_buf, blk_sz);
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Compute SHA256 over the image.
+ *
+ * For sparse images the bytes within the declared fill ranges are not
+ * hashed; they are only compared against their fill value.  The range
+ * descriptors themselves are hashed after the image body instead.
+ *
+ * The relocations of PIC images are hashed last.
+ *
+ * The hash of an image in two parts is the hash of both parts.  The
+ * descriptors are hashed with the first part, since the boot loader uses
+ * them before the second part is checked.  With prefix_only set, only the
+ * first part is computed, and the recorded hash of the second one is used
+ * as is.
+ *
+ * The layout the image was hashed with is left in layout.
+ */
+static int
+bootutil_img_hash(struct image_header *hdr, const struct flash_area *fap,
+                  uint8_t *tmp_buf, uint32_t tmp_buf_sz,
+                  uint8_t *hash_result, uint8_t *seed, int seed_len,
+                  int prefix_only, struct bootutil_img_layout *layout)
+{
+    bootutil_sha256_context sha256_ctx;
+    int rc;
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+    uint8_t parts[64];
+#endif
+
 #ifdef MCUBOOT_ENC_IMAGES
-        if (fap->fa_id == FLASH_AREA_IMAGE_1 && IS_ENCRYPTED(hdr) && off >= hdr_size) {
-            blk_off = (off - hdr_size) & 0xf;
-            boot_encrypt(fap, off - hdr_size, blk_sz, blk_off, tmp_buf);
+    /* Encrypted images only exist in slot1 */
+    if (fap->fa_id == FLASH_AREA_IMAGE_1 && IS_ENCRYPTED(hdr) && !boot_enc_valid(fap)) {
+        return -1;
+    }
+#endif
+
+    if (bootutil_img_layout(hdr, fap, layout) != 0) {
+        return -1;
+    }
+
+    bootutil_sha256_init(&sha256_ctx);
+
+    /* in some cases (split image) the hash is seeded with data from
+     * the loader image */
+    if (seed && (seed_len > 0)) {
+        bootutil_sha256_update(&sha256_ctx, seed, seed_len);
+    }
+
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+    if (layout->parts.ihp_split != 0) {
+        rc = bootutil_img_hash_range(hdr, fap, layout, &sha256_ctx, 0,
+                                     layout->parts.ihp_split,
+                                     tmp_buf, tmp_buf_sz);
+        if (rc) {
+            return rc;
+        }
+        rc = bootutil_img_hash_descs(fap, layout, &sha256_ctx,
+                                     tmp_buf, tmp_buf_sz);
+        if (rc) {
+            return rc;
         }
+        bootutil_sha256_finish(&sha256_ctx, parts);
+
+        if (prefix_only) {
+            memcpy(&parts[32], layout->parts.ihp_rest, 32);
+        } else {
+            bootutil_sha256_init(&sha256_ctx);
+            rc = bootutil_img_hash_range(hdr, fap, layout, &sha256_ctx,
+                                         layout->parts.ihp_split, layout->size,
+                                         tmp_buf, tmp_buf_sz);
+            if (rc) {
+                return rc;
+            }
+            bootutil_sha256_finish(&sha256_ctx, &parts[32]);
+            if (memcmp(&parts[32], layout->parts.ihp_rest, 32)) {
+                return -1;
+            }
+        }
+
+        bootutil_sha256_init(&sha256_ctx);
+        bootutil_sha256_update(&sha256_ctx, parts, sizeof parts);
+        bootutil_sha256_finish(&sha256_ctx, hash_result);
+        return 0;
+    }
+#else
+    (void)prefix_only;
 #endif
-        bootutil_sha256_update(&sha256_ctx, tmp_buf, blk_sz);
+
+    /*
+     * Hash is computed over image header and image itself. No TLV is
+     * included ATM.
+     */
+    rc = bootutil_img_hash_range(hdr, fap, layout, &sha256_ctx, 0,
+                                 layout->size, tmp_buf, tmp_buf_sz);
+    if (rc) {
+        return rc;
+    }
+    rc = bootutil_img_hash_descs(fap, layout, &sha256_ctx,
+                                 tmp_buf, tmp_buf_sz);
+    if (rc) {
+        return rc;
     }
     bootutil_sha256_finish(&sha256_ctx, hash_result);
 
@@ -160,14 +661,11 @@ bootutil_find_key(uint8_t *keyhash, uint8_t keyhash_len)
 }
 #endif
 
-/*
- * Verify the integrity of the image.
- * Return non-zero if image could not be validated/does not validate.
- */
-int
-bootutil_img_validate(struct image_header *hdr, const struct flash_area *fap,
-                      uint8_t *tmp_buf, uint32_t tmp_buf_sz,
-                      uint8_t *seed, int seed_len, uint8_t *out_hash)
+static int
+bootutil_img_verify(struct image_header *hdr, const struct flash_area *fap,
+                    uint8_t *tmp_buf, uint32_t tmp_buf_sz,
+                    uint8_t *seed, int seed_len, uint8_t *out_hash,
+                    int prefix_only, struct bootutil_img_layout *layout)
 {
     uint32_t off;
     uint32_t end;
@@ -182,7 +680,8 @@ bootutil_img_validate(struct image_header *hdr, const struct flash_area *fap,
     uint8_t hash[32];
     int rc;
 
-    rc = bootutil_img_hash(hdr, fap, tmp_buf, tmp_buf_sz, hash, seed, seed_len);
+    rc = bootutil_img_hash(hdr, fap, tmp_buf, tmp_buf_sz, hash, seed, seed_len,
+                           prefix_only, layout);
     if (rc) {
         return rc;
     }
@@ -283,3 +782,219 @@ bootutil_img_validate(struct image_header *hdr, const struct flash_area *fap,
 
     return 0;
 }
+
+/*
+ * Verify the integrity of the image.
+ * Return non-zero if image could not be validated/does not validate.
+ */
+int
+bootutil_img_validate(struct image_header *hdr, const struct flash_area *fap,
+                      uint8_t *tmp_buf, uint32_t tmp_buf_sz,
+                      uint8_t *seed, int seed_len, uint8_t *out_hash)
+{
+    struct bootutil_img_layout layout;
+
+    return bootutil_img_verify(hdr, fap, tmp_buf, tmp_buf_sz, seed, seed_len,
+                               out_hash, 0, &layout);
+}
+
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+/*
+ * Verify the image like bootutil_img_validate(), except that the second part
+ * of an image whose hash is in two parts is not read: its recorded hash is
+ * used as is, which the image hash and signature still cover.  Checking that
+ * it matches the image is left to boot_deferred_check().
+ */
+int
+bootutil_img_validate_prefix(struct image_header *hdr,
+                             const struct flash_area *fap,
+                             uint8_t *tmp_buf, uint32_t tmp_buf_sz)
+{
+    struct bootutil_img_layout layout;
+
+    return bootutil_img_verify(hdr, fap, tmp_buf, tmp_buf_sz, NULL, 0, NULL,
+                               1, &layout);
+}
+
+/*
+ * Opens slot 0, and reads the header and layout of its image.
+ */
+static int
+boot_deferred_open(const struct flash_area **fapp, struct image_header *hdr,
+                   struct bootutil_img_layout *layout)
+{
+    int rc;
+
+    if (flash_area_open(FLASH_AREA_IMAGE_0, fapp) != 0) {
+        return BOOT_DEFERRED_ERR;
+    }
+
+    rc = flash_area_read(*fapp, 0, hdr, sizeof *hdr);
+    if (rc != 0) {
+        rc = BOOT_DEFERRED_ERR;
+    } else if (hdr->ih_magic != IMAGE_MAGIC ||
+               bootutil_img_layout(hdr, *fapp, layout) != 0) {
+        rc = BOOT_DEFERRED_BAD;
+    }
+
+    if (rc != 0) {
+        flash_area_close(*fapp);
+    }
+    return rc;
+}
+
+/*
+ * Hash the fill ranges of the layout, which decide what the second part of
+ * the hash covers.
+ */
+static void
+boot_deferred_ranges_hash(const struct bootutil_img_layout *layout,
+                          uint8_t *hash)
+{
+    bootutil_sha256_context sha256_ctx;
+
+    bootutil_sha256_init(&sha256_ctx);
+#ifdef MCUBOOT_SPARSE_IMAGES
+    if (layout->nranges > 0) {
+        bootutil_sha256_update(&sha256_ctx, layout->ranges,
+                               layout->nranges * sizeof(layout->ranges[0]));
+    }
+#else
+    (void)layout;
+#endif
+    bootutil_sha256_finish(&sha256_ctx, hash);
+}
+
+/**
+ * Prepares checking the part of the image in slot 0 that the boot loader left
+ * out.  The first part and the signature are checked again, as the boot
+ * loader did, so that the rest is checked against the hash they
+ * authenticate, not whatever the TLVs hold by then.
+ *
+ * @param chk                   The state of the check.
+ *
+ * @return                      BOOT_DEFERRED_OK on success, BOOT_DEFERRED_BAD
+ *                                  if the image is not valid, or
+ *                                  BOOT_DEFERRED_ERR.
+ */
+int
+boot_deferred_check_start(struct boot_deferred_check *chk)
+{
+    const struct flash_area *fap;
+    struct image_header hdr;
+    struct bootutil_img_layout layout;
+    uint8_t tmp_buf[BOOT_TMPBUF_SZ];
+    int rc;
+
+    rc = boot_deferred_open(&fap, &hdr, &layout);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* The boot loader checked an image in one part in full. */
+    chk->bdc_split = 0;
+    if (layout.parts.ihp_split == 0) {
+        rc = BOOT_DEFERRED_OK;
+        goto out;
+    }
+
+    rc = bootutil_img_verify(&hdr, fap, tmp_buf, sizeof tmp_buf, NULL, 0, NULL,
+                             1, &layout);
+    if (rc == BOOT_EFLASH) {
+        rc = BOOT_DEFERRED_ERR;
+        goto out;
+    } else if (rc != 0) {
+        rc = BOOT_DEFERRED_BAD;
+        goto out;
+    }
+
+    chk->bdc_split = layout.parts.ihp_split;
+    chk->bdc_off = layout.parts.ihp_split;
+    chk->bdc_end = layout.size;
+    memcpy(chk->bdc_rest, layout.parts.ihp_rest, sizeof chk->bdc_rest);
+    boot_deferred_ranges_hash(&layout, chk->bdc_ranges);
+    bootutil_sha256_init(&chk->bdc_sha);
+    rc = BOOT_DEFERRED_OK;
+
+out:
+    flash_area_close(fap);
+    return rc;
+}
+
+/**
+ * Hashes up to max_bytes more of the image in slot 0, and once all of it is,
+ * compares the result with the hash authenticated by
+ * boot_deferred_check_start().
+ *
+ * @param chk                   The state of the check, as left by
+ *                                  boot_deferred_check_start() and previous
+ *                                  calls.
+ * @param max_bytes             The most image bytes to read in this call.
+ *
+ * @return                      BOOT_DEFERRED_MORE if there is more to hash,
+ *                                  BOOT_DEFERRED_OK if the image is valid,
+ *                                  BOOT_DEFERRED_BAD if it is not, or
+ *                                  BOOT_DEFERRED_ERR.
+ */
+int
+boot_deferred_check(struct boot_deferred_check *chk, uint32_t max_bytes)
+{
+    const struct flash_area *fap;
+    struct image_header hdr;
+    struct bootutil_img_layout layout;
+    uint8_t tmp_buf[BOOT_TMPBUF_SZ];
+    uint8_t hash[32];
+    uint32_t end;
+    int rc;
+
+    if (chk->bdc_split == 0) {
+        return BOOT_DEFERRED_OK;
+    }
+
+    rc = boot_deferred_open(&fap, &hdr, &layout);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* The image must not change while it is being checked. */
+    boot_deferred_ranges_hash(&layout, hash);
+    if (layout.parts.ihp_split != chk->bdc_split ||
+            layout.size != chk->bdc_end ||
+            memcmp(hash, chk->bdc_ranges, sizeof hash) != 0) {
+        rc = BOOT_DEFERRED_BAD;
+        goto out;
+    }
+
+    end = chk->bdc_end;
+    if (max_bytes < end - chk->bdc_off) {
+        end = chk->bdc_off + max_bytes;
+    }
+    rc = bootutil_img_hash_range(&hdr, fap, &layout, &chk->bdc_sha,
+                                 chk->bdc_off, end, tmp_buf, sizeof tmp_buf);
+    if (rc == BOOT_EBADIMAGE) {
+        rc = BOOT_DEFERRED_BAD;
+        goto out;
+    } else if (rc != 0) {
+        rc = BOOT_DEFERRED_ERR;
+        goto out;
+    }
+    chk->bdc_off = end;
+    if (end < chk->bdc_end) {
+        rc = BOOT_DEFERRED_MORE;
+        goto out;
+    }
+
+    bootutil_sha256_finish(&chk->bdc_sha, hash);
+
+    if (memcmp(hash, chk->bdc_rest, sizeof hash) != 0) {
+        rc = BOOT_DEFERRED_BAD;
+    } else {
+        chk->bdc_split = 0;
+        rc = BOOT_DEFERRED_OK;
+    }
+
+out:
+    flash_area_close(fap);
+    return rc;
+}
+#endif /* MCUBOOT_DEFERRED_VALIDATION */
@@ -37,6 +37,9 @@
 #ifdef MCUBOOT_ENC_IMAGES
 #include "bootutil/enc_key.h"
 #endif
+#ifdef MCUBOOT_VERIFY_WRITES
+#include "bootutil/sha256.h"
+#endif
 
 #include "mcuboot_config/mcuboot_config.h"
 
@@ -144,41 +147,45 @@ static const struct boot_status_table boot_status_tables[] = {
                  (state)->copy_done,                                \
                  (state)->image_ok)
 
+/** Trailer states gathered along with the image headers at startup. */
+struct boot_metadata {
+    struct boot_swap_state slots[BOOT_NUM_SLOTS];
+    struct boot_swap_state scratch;
+};
+
 /**
  * Determines where in flash the most recent boot status is stored.  The boot
  * status is necessary for completing a swap that was interrupted by a boot
  * loader reset.
  *
+ * @param meta                  The trailer states read at startup.
+ *
  * @return                      A BOOT_STATUS_SOURCE_[...] code indicating where *                                  status should be read from.
  */
 static int
-boot_status_source(void)
+boot_status_source(const struct boot_metadata *meta)
 {
     const struct boot_status_table *table;
-    struct boot_swap_state state_scratch;
-    struct boot_swap_state state_slot0;
-    int rc;
+    const struct boot_swap_state *state_scratch;
+    const struct boot_swap_state *state_slot0;
     size_t i;
     uint8_t source;
 
-    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_0, &state_slot0);
-    assert(rc == 0);
-
-    rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_SCRATCH, &state_scratch);
-    assert(rc == 0);
+    state_slot0 = &meta->slots[0];
+    state_scratch = &meta->scratch;
 
-    BOOT_LOG_SWAP_STATE("Image 0", &state_slot0);
-    BOOT_LOG_SWAP_STATE("Scratch", &state_scratch);
+    BOOT_LOG_SWAP_STATE("Image 0", state_slot0);
+    BOOT_LOG_SWAP_STATE("Scratch", state_scratch);
 
     for (i = 0; i < BOOT_STATUS_TABLES_COUNT; i++) {
         table = &boot_status_tables[i];
 
         if ((table->bst_magic_slot0     == BOOT_MAGIC_ANY    ||
-             table->bst_magic_slot0     == state_slot0.magic)   &&
+             table->bst_magic_slot0     == state_slot0->magic)   &&
             (table->bst_magic_scratch   == BOOT_MAGIC_ANY    ||
-             table->bst_magic_scratch   == state_scratch.magic) &&
+             table->bst_magic_scratch   == state_scratch->magic) &&
             (table->bst_copy_done_slot0 == BOOT_FLAG_ANY     ||
-             table->bst_copy_done_slot0 == state_slot0.copy_done)) {
+             table->bst_copy_done_slot0 == state_slot0->copy_done)) {
             source = table->bst_status_source;
             BOOT_LOG_INF("Boot source: %s",
                          source == BOOT_STATUS_SOURCE_NONE ? "none" :
@@ -307,6 +314,96 @@ boot_read_image_headers(bool require_all)
     return 0;
 }
 
+/**
+ * Reads the image headers and trailer states like boot_read_metadata(), one
+ * read at a time.  Slot 1 failing to read is taken as it holding no image,
+ * and an erased trailer.
+ */
+static int
+boot_read_metadata_one_by_one(struct boot_metadata *meta)
+{
+    int rc;
+    int i;
+
+    for (i = 0; i < BOOT_NUM_SLOTS; i++) {
+        rc = boot_read_image_header(i, boot_img_hdr(&boot_data, i));
+        if (rc == 0) {
+            rc = boot_read_swap_state(BOOT_IMG_AREA(&boot_data, i),
+                                      &meta->slots[i]);
+        }
+        if (rc != 0) {
+            if (i == 0) {
+                return rc;
+            }
+            BOOT_LOG_WRN("Failed reading slot %d; ignoring it", i);
+            memset(boot_img_hdr(&boot_data, i), 0,
+                   sizeof(struct image_header));
+            meta->slots[i].magic = BOOT_MAGIC_UNSET;
+            meta->slots[i].copy_done = BOOT_FLAG_UNSET;
+            meta->slots[i].image_ok = BOOT_FLAG_UNSET;
+        }
+    }
+
+    return boot_read_swap_state(BOOT_SCRATCH_AREA(&boot_data), &meta->scratch);
+}
+
+/**
+ * Reads everything needed to decide how to boot: the image header of each
+ * slot, and the trailer states of the slots and of the scratch area.  These
+ * are small reads scattered over the areas, so they are issued as a single
+ * vectored read.  If that fails, they are re-read one by one, so that a
+ * failure reading slot 1 does not prevent booting slot 0: slot 1 is then
+ * taken to hold no image, and an erased trailer.
+ *
+ * @param meta                  The trailer states get written here.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+boot_read_metadata(struct boot_metadata *meta)
+{
+    struct flash_area_iov iov[BOOT_NUM_SLOTS * (1 + BOOT_SWAP_STATE_IOV_MAX) +
+                              BOOT_SWAP_STATE_IOV_MAX];
+    struct boot_swap_state_raw raw[BOOT_NUM_SLOTS + 1];
+    int state_iov[BOOT_NUM_SLOTS + 1];
+    const struct flash_area *fap;
+    int cnt;
+    int rc;
+    int i;
+
+    cnt = 0;
+    for (i = 0; i < BOOT_NUM_SLOTS; i++) {
+        iov[cnt].fiov_fa = BOOT_IMG_AREA(&boot_data, i);
+        iov[cnt].fiov_off = 0;
+        iov[cnt].fiov_dst = boot_img_hdr(&boot_data, i);
+        iov[cnt].fiov_len = sizeof(struct image_header);
+        cnt++;
+
+        state_iov[i] = cnt;
+        cnt += boot_swap_state_iov(BOOT_IMG_AREA(&boot_data, i), &raw[i],
+                                   &iov[cnt]);
+    }
+    state_iov[BOOT_NUM_SLOTS] = cnt;
+    cnt += boot_swap_state_iov(BOOT_SCRATCH_AREA(&boot_data),
+                               &raw[BOOT_NUM_SLOTS], &iov[cnt]);
+
+    rc = flash_area_readv(iov, cnt);
+    if (rc != 0) {
+        return boot_read_metadata_one_by_one(meta);
+    }
+
+    for (i = 0; i < BOOT_NUM_SLOTS; i++) {
+        fap = BOOT_IMG_AREA(&boot_data, i);
+        boot_swap_state_decode(fap, &raw[i], &iov[state_iov[i]],
+                               &meta->slots[i]);
+    }
+    boot_swap_state_decode(BOOT_SCRATCH_AREA(&boot_data),
+                           &raw[BOOT_NUM_SLOTS],
+                           &iov[state_iov[BOOT_NUM_SLOTS]], &meta->scratch);
+
+    return 0;
+}
+
 static uint8_t
 boot_write_sz(void)
 {
@@ -406,6 +503,15 @@ boot_slots_compatible(void)
         return 0;
     }
 
+#if defined(MCUBOOT_STATUS_BIT_CLEAR) && !defined(MCUBOOT_OVERWRITE_ONLY)
+    /* The swap status is programmed more than once in place. */
+    if (!flash_area_can_reprogram(boot_data.imgs[0].area) ||
+        !flash_area_can_reprogram(boot_data.scratch.area)) {
+        BOOT_LOG_WRN("Cannot upgrade: flash does not allow reprogramming");
+        return 0;
+    }
+#endif
+
     return 1;
 }
 
@@ -440,6 +546,7 @@ boot_read_sectors(void)
     return 0;
 }
 
+#ifndef MCUBOOT_STATUS_BIT_CLEAR
 static uint32_t
 boot_status_internal_off(int idx, int state, int elem_sz)
 {
@@ -518,15 +625,118 @@ boot_read_status_bytes(const struct flash_area *fap, struct boot_status *bs)
 
     return 0;
 }
+#else /* MCUBOOT_STATUS_BIT_CLEAR */
+/**
+ * Decodes a sector's status byte, as written by boot_write_status().
+ *
+ * @return                      The state reached, 0 if the byte is still
+ *                                  erased, or -1 if it is not a valid status.
+ */
+static int
+boot_status_bits_decode(uint8_t status, uint8_t erased_val)
+{
+    uint8_t bits;
+
+    /* Like a partially written entry of the regular encoding, a state whose
+     * bits were only partially programmed counts as reached.
+     */
+    bits = status ^ erased_val;
+    if (bits & ~BOOT_STATUS_BITS(BOOT_STATUS_STATE_2)) {
+        return -1;
+    } else if (bits & (1 << (BOOT_STATUS_STATE_2 - 1))) {
+        return BOOT_STATUS_STATE_2;
+    } else if (bits & (1 << (BOOT_STATUS_STATE_1 - 1))) {
+        return BOOT_STATUS_STATE_1;
+    } else if (bits & (1 << (BOOT_STATUS_STATE_0 - 1))) {
+        return BOOT_STATUS_STATE_0;
+    }
+    return 0;
+}
+
+/**
+ * Reads the status of a partially-completed swap, kept with the bit-clearing
+ * encoding: every sector before the one in progress must be at the last
+ * state, and every sector after it still erased.
+ */
+static int
+boot_read_status_bits(const struct flash_area *fap, struct boot_status *bs)
+{
+    uint8_t status[32];
+    uint32_t off;
+    uint32_t len;
+    uint8_t erased_val;
+    int max_entries;
+    int found;
+    int found_state;
+    int invalid;
+    int state;
+    int rc;
+    int i;
+
+    off = boot_status_off(fap);
+    max_entries = boot_status_entries(fap);
+    erased_val = flash_area_erased_val(fap);
+
+    found = 0;
+    found_state = 0;
+    invalid = 0;
+    for (i = 0; i < max_entries; i++) {
+        if (i % sizeof status == 0) {
+            len = max_entries - i;
+            if (len > sizeof status) {
+                len = sizeof status;
+            }
+            rc = flash_area_read(fap, off + i, status, len);
+            if (rc != 0) {
+                return BOOT_EFLASH;
+            }
+        }
+
+        state = boot_status_bits_decode(status[i % sizeof status],
+                                        erased_val);
+        if (state == 0) {
+            continue;
+        }
+
+        if (state < 0 || (found && (found != i ||
+                                    found_state != BOOT_STATUS_STATE_2))) {
+            invalid = 1;
+            break;
+        }
+        found = i + 1;
+        found_state = state;
+    }
+
+    if (invalid) {
+        BOOT_LOG_ERR("Detected inconsistent status!");
+
+#if !defined(MCUBOOT_VALIDATE_SLOT0)
+        /* With validation of slot0 disabled, there is no way to be sure the
+         * swapped slot0 is OK, so abort!
+         */
+        assert(0);
+#endif
+    }
+
+    if (found) {
+        bs->idx = BOOT_STATUS_IDX_0 + found - 1;
+        bs->state = found_state;
+    }
+
+    return 0;
+}
+#endif /* MCUBOOT_STATUS_BIT_CLEAR */
 
 /**
  * Reads the boot status from the flash.  The boot status contains
  * the current state of an interrupted image copy operation.  If the boot
  * status is not present, or it indicates that previous copy finished,
  * there is no operation in progress.
+ *
+ * @param meta                  The trailer states read at startup.
  */
 static int
-boot_read_status(struct boot_status *bs)
+boot_read_status(const struct boot_metadata *meta, struct boot_status *bs)
 {
     const struct flash_area *fap;
     int status_loc;
@@ -542,7 +752,7 @@ boot_read_status(struct boot_status *bs)
     return 0;
 #endif
 
-    status_loc = boot_status_source();
+    status_loc = boot_status_source(meta);
     switch (status_loc) {
     case BOOT_STATUS_SOURCE_NONE:
         return 0;
@@ -565,7 +775,11 @@ boot_read_status(struct boot_status *bs)
         return BOOT_EFLASH;
     }
 
+#ifdef MCUBOOT_STATUS_BIT_CLEAR
+    rc = boot_read_status_bits(fap, bs);
+#else
     rc = boot_read_status_bytes(fap, bs);
+#endif
 
     flash_area_close(fap);
 
@@ -585,6 +799,9 @@ boot_write_status(struct boot_status *bs)
 {
     const struct flash_area *fap;
     uint32_t off;
+#ifdef MCUBOOT_STATUS_BIT_CLEAR
+    uint32_t idx_off;
+#endif
     int area_id;
     int rc;
     uint8_t buf[BOOT_MAX_ALIGN];
@@ -610,13 +827,28 @@ boot_write_status(struct boot_status *bs)
         goto done;
     }
 
+    align = flash_area_align(fap);
+    erased_val = flash_area_erased_val(fap);
+
+#ifdef MCUBOOT_STATUS_BIT_CLEAR
+    /* Program the whole write unit holding this sector's status byte again;
+     * the bytes of the other sectors are written back unchanged.
+     */
+    idx_off = bs->idx - BOOT_STATUS_IDX_0;
+    off = boot_status_off(fap) + idx_off / align * align;
+    rc = flash_area_read(fap, off, buf, align);
+    if (rc != 0) {
+        rc = BOOT_EFLASH;
+        goto done;
+    }
+    buf[idx_off % align] = erased_val ^ BOOT_STATUS_BITS(bs->state);
+#else
     off = boot_status_off(fap) +
           boot_status_internal_off(bs->idx, bs->state,
                                    BOOT_WRITE_SZ(&boot_data));
-    align = flash_area_align(fap);
-    erased_val = flash_area_erased_val(fap);
     memset(buf, erased_val, BOOT_MAX_ALIGN);
     buf[0] = bs->state;
+#endif
 
     rc = flash_area_write(fap, off, buf, align);
     if (rc != 0) {
@@ -632,11 +864,13 @@ done:
 }
 
 /*
- * Validate image hash/signature in a slot.
+ * Validate image hash/signature in a slot.  With prefix_only set, an image
+ * signed with a two-part hash only has its first part checked; the rest is
+ * left to boot_deferred_check(), run by the application.
  */
 static int
 boot_image_check(struct image_header *hdr, const struct flash_area *fap,
-        struct boot_status *bs)
+        struct boot_status *bs, int prefix_only)
 {
     static uint8_t tmpbuf[BOOT_TMPBUF_SZ];
     int rc;
@@ -656,6 +890,17 @@ boot_image_check(struct image_header *hdr, const struct flash_area *fap,
     }
 #endif
 
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+    if (prefix_only) {
+        if (bootutil_img_validate_prefix(hdr, fap, tmpbuf, BOOT_TMPBUF_SZ)) {
+            return BOOT_EBADIMAGE;
+        }
+        return 0;
+    }
+#else
+    (void)prefix_only;
+#endif
+
     if (bootutil_img_validate(hdr, fap, tmpbuf, BOOT_TMPBUF_SZ,
                               NULL, 0, NULL)) {
         return BOOT_EBADIMAGE;
@@ -698,7 +943,7 @@ split_image_check(struct image_header *app_hdr,
 static inline bool
 boot_data_is_set_to(uint8_t val, void *data, size_t len)
 {
-    uint8_t i;
+    size_t i;
     uint8_t *p = (uint8_t *)data;
     for (i = 0; i < len; i++) {
         if (val != p[i]) {
@@ -733,7 +978,7 @@ boot_check_header_erased(int slot)
 }
 
 static int
-boot_validate_slot(int slot, struct boot_status *bs)
+boot_validate_slot_image(int slot, struct boot_status *bs, int prefix_only)
 {
     const struct flash_area *fap;
     struct image_header *hdr;
@@ -751,7 +996,7 @@ boot_validate_slot(int slot, struct boot_status *bs)
         goto out;
     }
 
-    if ((hdr->ih_magic != IMAGE_MAGIC || boot_image_check(hdr, fap, bs) != 0)) {
+    if ((hdr->ih_magic != IMAGE_MAGIC || boot_image_check(hdr, fap, bs, prefix_only) != 0)) {
         if (slot != 0) {
             flash_area_erase(fap, 0, fap->fa_size);
             /* Image in slot 1 is invalid. Erase the image and
@@ -771,20 +1016,46 @@ out:
     return rc;
 }
 
+static int
+boot_validate_slot(int slot, struct boot_status *bs)
+{
+    return boot_validate_slot_image(slot, bs, 0);
+}
+
+#if defined(MCUBOOT_VALIDATE_SLOT0) || defined(MCUBOOT_BOOTSTRAP)
+/*
+ * Validate the image about to be booted from slot 0.  With deferred
+ * validation, slot 1 was fully validated before any upgrade, so the image is
+ * only checked up to its split; the application checks the rest.
+ */
+static int
+boot_validate_slot0(struct boot_status *bs)
+{
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+    return boot_validate_slot_image(0, bs, 1);
+#else
+    return boot_validate_slot(0, bs);
+#endif
+}
+#endif
+
 /**
  * Determines which swap operation to perform, if any.  If it is determined
  * that a swap operation is required, the image in the second slot is checked
  * for validity.  If the image in the second slot is invalid, it is erased, and
  * a swap type of "none" is indicated.
  *
+ * @param meta                  The trailer states read at startup.
+ *
  * @return                      The type of swap to perform (BOOT_SWAP_TYPE...)
  */
 static int
-boot_validated_swap_type(struct boot_status *bs)
+boot_validated_swap_type(const struct boot_metadata *meta,
+                         struct boot_status *bs)
 {
     int swap_type;
 
-    swap_type = boot_swap_type();
+    swap_type = boot_swap_type_from_states(&meta->slots[0], &meta->slots[1]);
     switch (swap_type) {
     case BOOT_SWAP_TYPE_TEST:
     case BOOT_SWAP_TYPE_PERM:
@@ -860,9 +1131,46 @@ boot_erase_sector(const struct flash_area *fap, uint32_t off, uint32_t sz)
     return flash_area_erase(fap, off, sz);
 }
 
+static uint8_t boot_copy_buf[1024];
+
+#ifdef MCUBOOT_OVERLAP_COPY
+/*
+ * While one buffer is being programmed, the next chunk is read to the other
+ * one.
+ */
+static uint8_t boot_copy_buf2[sizeof boot_copy_buf];
+
+/**
+ * Waits for the erase or write started on the device holding an area.
+ *
+ * @param fap                   The flash area.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+boot_flash_wait(const struct flash_area *fap)
+{
+    int rc;
+
+    do {
+        rc = flash_area_poll(fap);
+    } while (rc > 0);
+
+    return rc;
+}
+#endif
+
+#ifdef MCUBOOT_VERIFY_WRITES
+/* Hash of the data programmed by the copy under way. */
+static bootutil_sha256_context boot_copy_sha;
+#endif
+
 /**
  * Copies the contents of one flash region to another.  You must erase the
- * destination region prior to calling this function.
+ * destination region prior to calling this function; chunks which read back
+ * as the erased value are not programmed.  With MCUBOOT_OVERLAP_COPY, each
+ * chunk is read, and decrypted, while the previous one is being programmed,
+ * or while the erase started before the call completes.
  *
  * @param flash_area_id_src     The ID of the source flash area.
  * @param flash_area_id_dst     The ID of the destination flash area.
@@ -880,6 +1188,8 @@ boot_copy_sector(const struct flash_area *fap_src,
                  uint32_t off_src, uint32_t off_dst, uint32_t sz)
 {
     uint32_t bytes_copied;
+    uint8_t erased_val;
+    uint8_t *buf;
     int chunk_sz;
     int rc;
 #ifdef MCUBOOT_ENC_IMAGES
@@ -890,12 +1200,13 @@ boot_copy_sector(const struct flash_area *fap_src,
     uint32_t blk_sz;
 #endif
 
-    static uint8_t buf[1024];
+    buf = boot_copy_buf;
+    erased_val = flash_area_erased_val(fap_dst);
 
     bytes_copied = 0;
     while (bytes_copied < sz) {
-        if (sz - bytes_copied > sizeof buf) {
-            chunk_sz = sizeof buf;
+        if (sz - bytes_copied > sizeof boot_copy_buf) {
+            chunk_sz = sizeof boot_copy_buf;
         } else {
             chunk_sz = sz - bytes_copied;
         }
@@ -941,16 +1252,244 @@ boot_copy_sector(const struct flash_area *fap_src,
         }
 #endif
 
-        rc = flash_area_write(fap_dst, off_dst + bytes_copied, buf, chunk_sz);
+#ifdef MCUBOOT_VERIFY_WRITES
+        bootutil_sha256_update(&boot_copy_sha, buf, chunk_sz);
+#endif
+
+        if (!boot_data_is_set_to(erased_val, buf, chunk_sz)) {
+#ifdef MCUBOOT_OVERLAP_COPY
+            rc = boot_flash_wait(fap_dst);
+            if (rc != 0) {
+                return BOOT_EFLASH;
+            }
+
+            rc = flash_area_write_start(fap_dst, off_dst + bytes_copied, buf,
+                                        chunk_sz);
+            buf = (buf == boot_copy_buf) ? boot_copy_buf2 : boot_copy_buf;
+#else
+            rc = flash_area_write(fap_dst, off_dst + bytes_copied, buf,
+                                  chunk_sz);
+#endif
+            if (rc != 0) {
+                return BOOT_EFLASH;
+            }
+        }
+
+        bytes_copied += chunk_sz;
+    }
+
+#ifdef MCUBOOT_OVERLAP_COPY
+    rc = boot_flash_wait(fap_dst);
+    if (rc != 0) {
+        return BOOT_EFLASH;
+    }
+#endif
+
+    return 0;
+}
+
+#if defined(MCUBOOT_SPARSE_IMAGES) && \
+    (defined(MCUBOOT_OVERWRITE_ONLY) || defined(MCUBOOT_BOOTSTRAP))
+/**
+ * Copies the image in slot 1 to slot 0, skipping the fill ranges of a sparse
+ * image.  Chunks lying entirely within a fill range are not read: they are
+ * left erased if the fill matches the erased value of the destination and
+ * are programmed from a constant buffer otherwise.  You must erase the
+ * destination region prior to calling this function.
+ *
+ * @param fap_src               The slot 1 flash area.
+ * @param fap_dst               The slot 0 flash area.
+ * @param off_src               The offset within slot 1 to copy from.
+ * @param off_dst               The offset within slot 0 to copy to.
+ * @param sz                    The number of bytes to copy.
+ * @param ranges                The fill ranges of the image, as read by
+ *                                  bootutil_img_sparse_ranges().
+ * @param nranges               The number of fill ranges; with none, the
+ *                                  region is copied as is.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+boot_copy_sparse(const struct flash_area *fap_src,
+                 const struct flash_area *fap_dst,
+                 uint32_t off_src, uint32_t off_dst, uint32_t sz,
+                 const struct image_sparse_range *ranges, int nranges)
+{
+    uint32_t chunk_sz;
+    uint32_t off;
+    uint8_t erased_val;
+    int r;
+    int rc;
+
+    if (nranges <= 0) {
+        return boot_copy_sector(fap_src, fap_dst, off_src, off_dst, sz);
+    }
+
+    erased_val = flash_area_erased_val(fap_dst);
+
+    for (off = off_src, r = 0; off < off_src + sz; off += chunk_sz) {
+        chunk_sz = off_src + sz - off;
+        if (chunk_sz > sizeof boot_copy_buf) {
+            chunk_sz = sizeof boot_copy_buf;
+        }
+
+        while (r < nranges && off >= ranges[r].isr_off + ranges[r].isr_len) {
+            r++;
+        }
+
+        if (r < nranges && off >= ranges[r].isr_off &&
+                off + chunk_sz <= ranges[r].isr_off + ranges[r].isr_len) {
+            if (ranges[r].isr_fill != erased_val) {
+#ifdef MCUBOOT_OVERLAP_COPY
+                rc = boot_flash_wait(fap_dst);
+                if (rc != 0) {
+                    return BOOT_EFLASH;
+                }
+#endif
+                memset(boot_copy_buf, ranges[r].isr_fill, chunk_sz);
+                rc = flash_area_write(fap_dst, off_dst + (off - off_src),
+                                      boot_copy_buf, chunk_sz);
+                if (rc != 0) {
+                    return BOOT_EFLASH;
+                }
+            }
+#ifdef MCUBOOT_VERIFY_WRITES
+            memset(boot_copy_buf, ranges[r].isr_fill, chunk_sz);
+            bootutil_sha256_update(&boot_copy_sha, boot_copy_buf, chunk_sz);
+#endif
+        } else {
+            rc = boot_copy_sector(fap_src, fap_dst, off,
+                                  off_dst + (off - off_src), chunk_sz);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+#ifdef MCUBOOT_OVERLAP_COPY
+    rc = boot_flash_wait(fap_dst);
+    if (rc != 0) {
+        return BOOT_EFLASH;
+    }
+#endif
+
+    return 0;
+}
+#endif
+
+#ifdef MCUBOOT_VERIFY_WRITES
+/**
+ * Checks that a region just programmed by a copy holds what was written, by
+ * comparing the hash accumulated during the copy with the hash of the region
+ * read back.
+ *
+ * @param fap                   The flash area that was copied to.
+ * @param off                   The offset of the region within the area.
+ * @param sz                    The size of the region.
+ *
+ * @return                      0 if the region matches; nonzero otherwise.
+ */
+static int
+boot_copy_check(const struct flash_area *fap, uint32_t off, uint32_t sz)
+{
+    bootutil_sha256_context sha256_ctx;
+    uint8_t expected[32];
+    uint8_t actual[32];
+    uint32_t chunk_sz;
+    uint32_t done;
+    int rc;
+
+    bootutil_sha256_finish(&boot_copy_sha, expected);
+
+    bootutil_sha256_init(&sha256_ctx);
+    for (done = 0; done < sz; done += chunk_sz) {
+        chunk_sz = sz - done;
+        if (chunk_sz > sizeof boot_copy_buf) {
+            chunk_sz = sizeof boot_copy_buf;
+        }
+
+        rc = flash_area_read(fap, off + done, boot_copy_buf, chunk_sz);
         if (rc != 0) {
             return BOOT_EFLASH;
         }
+        bootutil_sha256_update(&sha256_ctx, boot_copy_buf, chunk_sz);
+    }
+    bootutil_sha256_finish(&sha256_ctx, actual);
 
-        bytes_copied += chunk_sz;
+    if (memcmp(expected, actual, sizeof actual) != 0) {
+        return BOOT_EFLASH;
     }
 
     return 0;
 }
+#endif
+
+/**
+ * Erases a region of flash and copies data to it.  With
+ * MCUBOOT_OVERLAP_COPY, the erase is only started, and the copy waits for it
+ * before programming.  With MCUBOOT_VERIFY_WRITES, the region is then
+ * checked, and erased and copied again up to BOOT_VERIFY_WRITES_RETRIES times
+ * if it does not hold what was written.
+ *
+ * @param fap_src               The flash area to copy from.
+ * @param fap_dst               The flash area to erase and copy to.
+ * @param off_src               The offset within fap_src to copy from.
+ * @param off_dst               The offset within fap_dst of the region.
+ * @param erase_sz              The number of bytes to erase.
+ * @param copy_sz               The number of bytes to copy.
+ * @param ranges                The fill ranges of the sparse image being
+ *                                  copied to slot 0, or NULL.
+ * @param nranges               The number of fill ranges.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+boot_erase_copy(const struct flash_area *fap_src,
+                const struct flash_area *fap_dst, uint32_t off_src,
+                uint32_t off_dst, uint32_t erase_sz, uint32_t copy_sz,
+                const struct image_sparse_range *ranges, int nranges)
+{
+    int rc;
+#ifdef MCUBOOT_VERIFY_WRITES
+    int retries;
+
+    for (retries = 0; ; retries++) {
+        bootutil_sha256_init(&boot_copy_sha);
+#endif
+#ifdef MCUBOOT_OVERLAP_COPY
+        rc = flash_area_erase_start(fap_dst, off_dst, erase_sz);
+#else
+        rc = boot_erase_sector(fap_dst, off_dst, erase_sz);
+#endif
+        if (rc != 0) {
+            return BOOT_EFLASH;
+        }
+
+#if defined(MCUBOOT_SPARSE_IMAGES) && \
+    (defined(MCUBOOT_OVERWRITE_ONLY) || defined(MCUBOOT_BOOTSTRAP))
+        rc = boot_copy_sparse(fap_src, fap_dst, off_src, off_dst, copy_sz,
+                              ranges, nranges);
+#else
+        (void)ranges;
+        (void)nranges;
+        rc = boot_copy_sector(fap_src, fap_dst, off_src, off_dst, copy_sz);
+#endif
+#ifdef MCUBOOT_VERIFY_WRITES
+        if (rc != 0) {
+            return rc;
+        }
+
+        rc = boot_copy_check(fap_dst, off_dst, copy_sz);
+        if (rc == 0 || retries == BOOT_VERIFY_WRITES_RETRIES) {
+            return rc;
+        }
+        BOOT_LOG_WRN("Bad copy to flash area %d at 0x%x, retrying",
+                     fap_dst->fa_id, (unsigned)off_dst);
+    }
+#else
+    return rc;
+#endif
+}
 
 #ifndef MCUBOOT_OVERWRITE_ONLY
 static inline int
@@ -1084,11 +1623,9 @@ boot_swap_sectors(int idx, uint32_t sz, struct boot_status *bs)
     assert (rc == 0);
 
     if (bs->state == BOOT_STATUS_STATE_0) {
-        rc = boot_erase_sector(fap_scratch, 0, sz);
-        assert(rc == 0);
-
-        rc = boot_copy_sector(fap_slot1, fap_scratch, img_off, 0, copy_sz);
-        assert(rc == 0);
+        rc = boot_erase_copy(fap_slot1, fap_scratch, img_off, 0, sz, copy_sz,
+                             NULL, 0);
+        ASSERT(rc == 0);
 
         if (bs->idx == BOOT_STATUS_IDX_0) {
             if (bs->use_scratch) {
@@ -1111,11 +1648,9 @@ boot_swap_sectors(int idx, uint32_t sz, struct boot_status *bs)
     }
 
     if (bs->state == BOOT_STATUS_STATE_1) {
-        rc = boot_erase_sector(fap_slot1, img_off, sz);
-        assert(rc == 0);
-
-        rc = boot_copy_sector(fap_slot0, fap_slot1, img_off, img_off, copy_sz);
-        assert(rc == 0);
+        rc = boot_erase_copy(fap_slot0, fap_slot1, img_off, img_off, sz,
+                             copy_sz, NULL, 0);
+        ASSERT(rc == 0);
 
         if (bs->idx == BOOT_STATUS_IDX_0 && !bs->use_scratch) {
             /* If not all sectors of the slot are being swapped,
@@ -1131,12 +1666,10 @@ boot_swap_sectors(int idx, uint32_t sz, struct boot_status *bs)
     }
 
     if (bs->state == BOOT_STATUS_STATE_2) {
-        rc = boot_erase_sector(fap_slot0, img_off, sz);
-        assert(rc == 0);
-
         /* NOTE: also copy trailer from scratch (has status info) */
-        rc = boot_copy_sector(fap_scratch, fap_slot0, 0, img_off, copy_sz);
-        assert(rc == 0);
+        rc = boot_erase_copy(fap_scratch, fap_slot0, 0, img_off, sz, copy_sz,
+                             NULL, 0);
+        ASSERT(rc == 0);
 
         if (bs->use_scratch) {
             scratch_trailer_off = boot_status_off(fap_scratch);
@@ -1144,7 +1677,7 @@ boot_swap_sectors(int idx, uint32_t sz, struct boot_status *bs)
             /* copy current status that is being maintained in scratch */
             rc = boot_copy_sector(fap_scratch, fap_slot0, scratch_trailer_off,
                         img_off + copy_sz,
-                        BOOT_STATUS_STATE_COUNT * BOOT_WRITE_SZ(&boot_data));
+                        boot_status_sz(BOOT_WRITE_SZ(&boot_data), 1));
             BOOT_STATUS_ASSERT(rc == 0);
 
             rc = boot_read_swap_state_by_id(FLASH_AREA_IMAGE_SCRATCH,
@@ -1209,6 +1742,10 @@ boot_copy_image(struct boot_status *bs)
     size_t last_sector;
     const struct flash_area *fap_slot0;
     const struct flash_area *fap_slot1;
+#ifdef MCUBOOT_SPARSE_IMAGES
+    struct image_sparse_range ranges[BOOT_SPARSE_MAX_RANGES];
+    int nranges;
+#endif
 
     (void)bs;
 
@@ -1219,7 +1756,6 @@ boot_copy_image(struct boot_status *bs)
 #endif
 
     BOOT_LOG_INF("Image upgrade slot1 -> slot0");
-    BOOT_LOG_INF("Erasing slot0");
 
     rc = flash_area_open(FLASH_AREA_IMAGE_0, &fap_slot0);
     assert (rc == 0);
@@ -1227,21 +1763,6 @@ boot_copy_image(struct boot_status *bs)
     rc = flash_area_open(FLASH_AREA_IMAGE_1, &fap_slot1);
     assert (rc == 0);
 
-    sect_count = boot_img_num_sectors(&boot_data, 0);
-    for (sect = 0, size = 0; sect < sect_count; sect++) {
-        this_size = boot_img_sector_size(&boot_data, 0, sect);
-        rc = boot_erase_sector(fap_slot0, size, this_size);
-        assert(rc == 0);
-
-        size += this_size;
-
-#if defined(MCUBOOT_OVERWRITE_ONLY_FAST)
-        if (size >= src_size) {
-            break;
-        }
-#endif
-    }
-
 #ifdef MCUBOOT_ENC_IMAGES
     if (IS_ENCRYPTED(boot_img_hdr(&boot_data, 1))) {
         rc = boot_enc_load(boot_img_hdr(&boot_data, 1), fap_slot1, bs->enckey[1]);
@@ -1254,8 +1775,41 @@ boot_copy_image(struct boot_status *bs)
     }
 #endif
 
-    BOOT_LOG_INF("Copying slot 1 to slot 0: 0x%zx bytes", size);
-    rc = boot_copy_sector(fap_slot1, fap_slot0, 0, 0, size);
+#ifdef MCUBOOT_SPARSE_IMAGES
+    /* Read the fill ranges once for the whole copy.  Those of an encrypted
+     * image describe its plaintext, not what slot 1 holds, so it is copied
+     * and decrypted in full.
+     */
+    nranges = 0;
+    if (!IS_ENCRYPTED(boot_img_hdr(&boot_data, 1))) {
+        nranges = bootutil_img_sparse_ranges(boot_img_hdr(&boot_data, 1),
+                                             fap_slot1, ranges,
+                                             BOOT_SPARSE_MAX_RANGES);
+    }
+#endif
+
+    /* Slot 0 is erased and copied to one sector at a time. */
+    sect_count = boot_img_num_sectors(&boot_data, 0);
+    for (sect = 0, size = 0; sect < sect_count; sect++) {
+        this_size = boot_img_sector_size(&boot_data, 0, sect);
+#ifdef MCUBOOT_SPARSE_IMAGES
+        rc = boot_erase_copy(fap_slot1, fap_slot0, size, size, this_size,
+                             this_size, ranges, nranges);
+#else
+        rc = boot_erase_copy(fap_slot1, fap_slot0, size, size, this_size,
+                             this_size, NULL, 0);
+#endif
+        ASSERT(rc == 0);
+
+        size += this_size;
+
+#if defined(MCUBOOT_OVERWRITE_ONLY_FAST)
+        if (size >= src_size) {
+            break;
+        }
+#endif
+    }
+    BOOT_LOG_INF("Copied slot 1 to slot 0: 0x%zx bytes", size);
 
     /*
      * Erases header and trailer. The trailer is erased because when a new
@@ -1452,14 +2006,156 @@ boot_swap_image(struct boot_status *bs)
 }
 #endif
 
+#if defined(MCUBOOT_BANK_SWAP) && !defined(MCUBOOT_OVERWRITE_ONLY)
+/**
+ * Returns the offset of the first sector holding the trailer of the given
+ * slot, that is the first sector erased by boot_erase_trailer_sectors().
+ */
+static uint32_t
+boot_trailer_sector_off(int slot)
+{
+    uint32_t trailer_sz;
+    uint32_t total_sz;
+    size_t sector;
+
+    sector = boot_img_num_sectors(&boot_data, slot) - 1;
+    trailer_sz = boot_slots_trailer_sz(BOOT_WRITE_SZ(&boot_data));
+    total_sz = boot_img_sector_size(&boot_data, slot, sector);
+    while (total_sz < trailer_sz && sector > 0) {
+        sector--;
+        total_sz += boot_img_sector_size(&boot_data, slot, sector);
+    }
+
+    return boot_img_sector_off(&boot_data, slot, sector);
+}
+
+/**
+ * Determines whether the images can be exchanged by swapping flash banks
+ * instead of copying them.  Besides support from the flash backend, this
+ * requires plaintext images which stay clear of their slot's trailer
+ * sectors, since those get erased by the bank swap.
+ *
+ * @return                      true if a bank swap can be used.
+ */
+static bool
+boot_bank_swap_usable(void)
+{
+    struct image_header *hdr;
+    uint32_t size;
+    int slot;
+    int rc;
+
+    if (!flash_area_can_bank_swap(BOOT_IMG_AREA(&boot_data, 0),
+                                  BOOT_IMG_AREA(&boot_data, 1))) {
+        return false;
+    }
+
+    for (slot = 0; slot < BOOT_NUM_SLOTS; slot++) {
+        hdr = boot_img_hdr(&boot_data, slot);
+        if (hdr->ih_magic != IMAGE_MAGIC) {
+            continue;
+        }
+        if (IS_ENCRYPTED(hdr)) {
+            return false;
+        }
+        rc = boot_read_image_size(slot, hdr, &size);
+        if (rc != 0 || size > boot_trailer_sector_off(slot)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Exchanges the images in slot 0 and slot 1 by swapping flash banks.
+ *
+ * The trailers are left the way a copy-based swap leaves them: slot 0 has the
+ * magic and image_ok of the image moved into it, with copy_done set, and slot
+ * 1's trailer is erased.  Each step is ordered so that after a reset the
+ * trailers still request a swap between the same two images, and the whole
+ * sequence is simply restarted on the next boot.
+ *
+ * @param swap_type             The type of swap to perform; one of
+ *                                  BOOT_SWAP_TYPE_TEST, BOOT_SWAP_TYPE_PERM
+ *                                  or BOOT_SWAP_TYPE_REVERT.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+boot_bank_swap_image(int swap_type)
+{
+    const struct flash_area *fap_slot0;
+    const struct flash_area *fap_slot1;
+    struct boot_swap_state state;
+    int rc;
+
+    BOOT_LOG_INF("Swapping flash banks");
+
+    fap_slot0 = BOOT_IMG_AREA(&boot_data, 0);
+    fap_slot1 = BOOT_IMG_AREA(&boot_data, 1);
+
+    rc = boot_read_swap_state(fap_slot1, &state);
+    if (rc != 0) {
+        return BOOT_EFLASH;
+    }
+
+    /*
+     * Complete the trailer which is about to become slot 0's.  A revert also
+     * confirms the image it goes back to.  Its magic is written last: from
+     * then on the trailers request a permanent swap to that same image, which
+     * ends in the same state.
+     */
+    if (swap_type == BOOT_SWAP_TYPE_REVERT &&
+            state.image_ok == BOOT_FLAG_UNSET) {
+        rc = boot_write_image_ok(fap_slot1);
+        if (rc != 0) {
+            return BOOT_EFLASH;
+        }
+    }
+
+    if (state.copy_done == BOOT_FLAG_UNSET) {
+        rc = boot_write_copy_done(fap_slot1);
+        if (rc != 0) {
+            return BOOT_EFLASH;
+        }
+    }
+
+    if (swap_type == BOOT_SWAP_TYPE_REVERT &&
+            state.magic == BOOT_MAGIC_UNSET) {
+        rc = boot_write_magic(fap_slot1);
+        if (rc != 0) {
+            return BOOT_EFLASH;
+        }
+    }
+
+    /* The trailer moving into slot 1 must not request another swap. */
+    rc = boot_erase_trailer_sectors(fap_slot0);
+    if (rc != 0) {
+        return BOOT_EFLASH;
+    }
+
+    rc = flash_area_bank_swap(fap_slot0, fap_slot1);
+    if (rc != 0) {
+        return BOOT_EFLASH;
+    }
+
+    return 0;
+}
+#endif /* MCUBOOT_BANK_SWAP && !MCUBOOT_OVERWRITE_ONLY */
+
 /**
  * Marks the image in slot 0 as fully copied.
+ *
+ * NOTE: copy_done is tested before writing because a bank swap moves in a
+ * trailer which already has it set.
  */
 #ifndef MCUBOOT_OVERWRITE_ONLY
 static int
 boot_set_copy_done(void)
 {
     const struct flash_area *fap;
+    struct boot_swap_state state;
     int rc;
 
     rc = flash_area_open(FLASH_AREA_IMAGE_0, &fap);
@@ -1467,7 +2163,17 @@ boot_set_copy_done(void)
         return BOOT_EFLASH;
     }
 
-    rc = boot_write_copy_done(fap);
+    rc = boot_read_swap_state(fap, &state);
+    if (rc != 0) {
+        rc = BOOT_EFLASH;
+        goto out;
+    }
+
+    if (state.copy_done == BOOT_FLAG_UNSET) {
+        rc = boot_write_copy_done(fap);
+    }
+
+out:
     flash_area_close(fap);
     return rc;
 }
@@ -1514,13 +2220,14 @@ out:
 /**
  * Performs an image swap if one is required.
  *
+ * @param meta                  The trailer states read at startup.
  * @param out_swap_type         On success, the type of swap performed gets
  *                                  written here.
  *
  * @return                      0 on success; nonzero on failure.
  */
 static int
-boot_swap_if_needed(int *out_swap_type)
+boot_swap_if_needed(const struct boot_metadata *meta, int *out_swap_type)
 {
     struct boot_status bs;
     int swap_type;
@@ -1529,7 +2236,7 @@ boot_swap_if_needed(int *out_swap_type)
     /* Determine if we rebooted in the middle of an image swap
      * operation.
      */
-    rc = boot_read_status(&bs);
+    rc = boot_read_status(meta, &bs);
     assert(rc == 0);
     if (rc != 0) {
         return rc;
@@ -1556,13 +2263,19 @@ boot_swap_if_needed(int *out_swap_type)
          */
         swap_type = boot_previous_swap_type();
     } else {
-        swap_type = boot_validated_swap_type(&bs);
+        swap_type = boot_validated_swap_type(meta, &bs);
         switch (swap_type) {
         case BOOT_SWAP_TYPE_TEST:
         case BOOT_SWAP_TYPE_PERM:
         case BOOT_SWAP_TYPE_REVERT:
 #ifdef MCUBOOT_OVERWRITE_ONLY
             rc = boot_copy_image(&bs);
+#elif defined(MCUBOOT_BANK_SWAP)
+            if (boot_bank_swap_usable()) {
+                rc = boot_bank_swap_image(swap_type);
+            } else {
+                rc = boot_swap_image(&bs);
+            }
 #else
             rc = boot_swap_image(&bs);
 #endif
@@ -1577,7 +2290,7 @@ boot_swap_if_needed(int *out_swap_type)
              * run validation on slot0 to be sure it's not OK.
              */
             if (boot_check_header_erased(0) == 0 ||
-                    boot_validate_slot(0, &bs) != 0) {
+                    boot_validate_slot0(&bs) != 0) {
                 if (boot_img_hdr(&boot_data, 1)->ih_magic == IMAGE_MAGIC &&
                         boot_validate_slot(1, &bs) == 0) {
                     rc = boot_copy_image(&bs);
@@ -1596,6 +2309,175 @@ boot_swap_if_needed(int *out_swap_type)
     return 0;
 }
 
+#ifdef MCUBOOT_PIC_IMAGES
+/**
+ * Determines whether the images can run in place, with no swap: each slot
+ * holds a PIC image or nothing, at least one holds an image, neither is
+ * encrypted, and no swap was interrupted.
+ *
+ * @param meta                  The trailer states read at startup.
+ */
+static bool
+boot_pic_in_place(const struct boot_metadata *meta)
+{
+    const struct image_header *hdr;
+    struct boot_status bs;
+    bool found;
+    int slot;
+
+    found = false;
+    for (slot = 0; slot < BOOT_NUM_SLOTS; slot++) {
+        hdr = boot_img_hdr(&boot_data, slot);
+        if (hdr->ih_magic != IMAGE_MAGIC) {
+            continue;
+        }
+        if (!(hdr->ih_flags & IMAGE_F_PIC) || IS_ENCRYPTED(hdr)) {
+            return false;
+        }
+        found = true;
+    }
+    if (!found) {
+        return false;
+    }
+
+    if (boot_read_status(meta, &bs) != 0) {
+        return false;
+    }
+    return bs.idx == BOOT_STATUS_IDX_0 && bs.state == BOOT_STATUS_STATE_0;
+}
+
+static int
+boot_pic_version_cmp(const struct image_version *a,
+                     const struct image_version *b)
+{
+    if (a->iv_major != b->iv_major) {
+        return a->iv_major < b->iv_major ? -1 : 1;
+    }
+    if (a->iv_minor != b->iv_minor) {
+        return a->iv_minor < b->iv_minor ? -1 : 1;
+    }
+    if (a->iv_revision != b->iv_revision) {
+        return a->iv_revision < b->iv_revision ? -1 : 1;
+    }
+    if (a->iv_build_num != b->iv_build_num) {
+        return a->iv_build_num < b->iv_build_num ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Picks the slot a PIC image runs in place from.
+ *
+ * A trial image which was booted before but never confirmed is erased, unless
+ * it is the only image left, in which case it runs again.  A pending image is
+ * validated, marked as booted by setting copy_done, and runs; with both slots
+ * pending, the higher version is tried first.  Otherwise the image with the
+ * highest version runs, slot 0 winning ties.  The image in slot 1 is only
+ * considered once it was set pending.
+ *
+ * @param meta                  The trailer states read at startup.
+ * @param out_slot              On success, the slot to run is written here.
+ *
+ * @return                      0 on success; BOOT_EBADIMAGE if there is no
+ *                                  bootable image; BOOT_EFLASH if an image
+ *                                  could not be erased or marked as booted.
+ */
+static int
+boot_pic_select(const struct boot_metadata *meta, int *out_slot)
+{
+    const struct boot_swap_state *state;
+    const struct image_header *hdr;
+    const struct flash_area *fap;
+    bool present[BOOT_NUM_SLOTS];
+    bool pending[BOOT_NUM_SLOTS];
+    int order[BOOT_NUM_SLOTS];
+    int slot;
+    int rc;
+    int i;
+
+    for (slot = 0; slot < BOOT_NUM_SLOTS; slot++) {
+        hdr = boot_img_hdr(&boot_data, slot);
+        present[slot] = hdr->ih_magic == IMAGE_MAGIC;
+        state = &meta->slots[slot];
+        pending[slot] = present[slot] && state->magic == BOOT_MAGIC_GOOD &&
+                        state->copy_done == BOOT_FLAG_UNSET;
+    }
+
+    /* Revert a trial which did not confirm itself. */
+    for (slot = 0; slot < BOOT_NUM_SLOTS; slot++) {
+        state = &meta->slots[slot];
+        if (present[slot] && present[!slot] &&
+                state->magic == BOOT_MAGIC_GOOD &&
+                state->copy_done == BOOT_FLAG_SET &&
+                state->image_ok == BOOT_FLAG_UNSET) {
+            BOOT_LOG_INF("Reverting unconfirmed image in slot %d", slot);
+            fap = BOOT_IMG_AREA(&boot_data, slot);
+            rc = flash_area_erase(fap, 0, fap->fa_size);
+            if (rc != 0) {
+                BOOT_LOG_ERR("Failed to erase slot %d", slot);
+                return BOOT_EFLASH;
+            }
+            present[slot] = false;
+        }
+    }
+
+    order[0] = 0;
+    order[1] = 1;
+    if (boot_pic_version_cmp(&boot_img_hdr(&boot_data, 1)->ih_ver,
+                             &boot_img_hdr(&boot_data, 0)->ih_ver) > 0) {
+        order[0] = 1;
+        order[1] = 0;
+    }
+
+    for (i = 0; i < BOOT_NUM_SLOTS; i++) {
+        slot = order[i];
+        if (!pending[slot]) {
+            continue;
+        }
+        fap = BOOT_IMG_AREA(&boot_data, slot);
+        if (boot_validate_slot(slot, NULL) != 0) {
+            if (slot == 0) {
+                rc = flash_area_erase(fap, 0, fap->fa_size);
+                if (rc != 0) {
+                    BOOT_LOG_ERR("Failed to erase slot %d", slot);
+                    return BOOT_EFLASH;
+                }
+            }
+            present[slot] = false;
+            continue;
+        }
+        rc = boot_write_copy_done(fap);
+        if (rc != 0) {
+            return BOOT_EFLASH;
+        }
+        *out_slot = slot;
+        return 0;
+    }
+
+    for (i = 0; i < BOOT_NUM_SLOTS; i++) {
+        slot = order[i];
+        state = &meta->slots[slot];
+        if (!present[slot] || pending[slot]) {
+            continue;
+        }
+        /* An unconfirmed trial left alone has nothing to revert to. */
+        if (slot == 1 && (state->magic != BOOT_MAGIC_GOOD ||
+                          (state->image_ok != BOOT_FLAG_SET && present[0]))) {
+            continue;
+        }
+#ifdef MCUBOOT_VALIDATE_SLOT0
+        if (boot_validate_slot(slot, NULL) != 0) {
+            continue;
+        }
+#endif
+        *out_slot = slot;
+        return 0;
+    }
+
+    return BOOT_EBADIMAGE;
+}
+#endif /* MCUBOOT_PIC_IMAGES */
+
 /**
  * Prepares the booting process.  This function moves images around in flash as
  * appropriate, and tells you what address to boot from.
@@ -1607,10 +2489,12 @@ boot_swap_if_needed(int *out_swap_type)
 int
 boot_go(struct boot_rsp *rsp)
 {
+    struct boot_metadata meta;
     int swap_type;
     size_t slot;
     int rc;
     int fa_id;
+    int exec_slot = 0;
     bool reload_headers = false;
 
     /* The array of slot sectors are defined here (as opposed to file scope) so
@@ -1625,6 +2509,16 @@ boot_go(struct boot_rsp *rsp)
     boot_data.imgs[1].sectors = slot1_sectors;
     boot_data.scratch.sectors = scratch_sectors;
 
+#ifdef MCUBOOT_BOOT_TOKEN
+    if (boot_token_check(boot_img_hdr(&boot_data, 0), rsp) == 0) {
+        BOOT_LOG_INF("Boot token valid; booting the same image");
+        return 0;
+    }
+
+    /* Anything this boot writes makes the current token stale. */
+    boot_token_flash_changed();
+#endif
+
 #ifdef MCUBOOT_ENC_IMAGES
     /* FIXME: remove this after RAM is cleared by sim */
     boot_enc_zeroize();
@@ -1648,17 +2542,31 @@ boot_go(struct boot_rsp *rsp)
         goto out;
     }
 
-    /* Attempt to read an image header from each slot. */
-    rc = boot_read_image_headers(false);
+    /* Attempt to read an image header and trailer from each slot. */
+    rc = boot_read_metadata(&meta);
     if (rc != 0) {
         goto out;
     }
 
+#ifdef MCUBOOT_PIC_IMAGES
+    /* PIC images run from either slot, so they never need a swap. */
+    if (boot_pic_in_place(&meta)) {
+        rc = boot_pic_select(&meta, &exec_slot);
+        if (rc != 0) {
+            BOOT_LOG_ERR("No bootable PIC image");
+            goto out;
+        }
+        BOOT_LOG_INF("Running PIC image in place from slot %d", exec_slot);
+        slot = exec_slot;
+        goto fill_rsp;
+    }
+#endif
+
     /* If the image slots aren't compatible, no swap is possible.  Just boot
      * into slot 0.
      */
     if (boot_slots_compatible()) {
-        rc = boot_swap_if_needed(&swap_type);
+        rc = boot_swap_if_needed(&meta, &swap_type);
         assert(rc == 0);
         if (rc != 0) {
             goto out;
@@ -1733,7 +2641,7 @@ boot_go(struct boot_rsp *rsp)
     }
 
 #ifdef MCUBOOT_VALIDATE_SLOT0
-    rc = boot_validate_slot(0, NULL);
+    rc = boot_validate_slot0(NULL);
     ASSERT(rc == 0);
     if (rc != 0) {
         rc = BOOT_EBADIMAGE;
@@ -1751,10 +2659,25 @@ boot_go(struct boot_rsp *rsp)
     }
 #endif
 
-    /* Always boot from the primary slot. */
-    rsp->br_flash_dev_id = boot_data.imgs[0].area->fa_device_id;
-    rsp->br_image_off = boot_img_slot_off(&boot_data, 0);
+#ifdef MCUBOOT_PIC_IMAGES
+fill_rsp:
+#endif
+    /* Boot from the primary slot, unless a PIC image runs in place. */
+    rsp->br_flash_dev_id = boot_data.imgs[exec_slot].area->fa_device_id;
+    rsp->br_image_off = boot_img_slot_off(&boot_data, exec_slot);
     rsp->br_hdr = boot_img_hdr(&boot_data, slot);
+    rsp->br_slot = exec_slot;
+
+#ifdef MCUBOOT_BOOT_TOKEN
+    /* Unless flash changes, the next warm reset can go straight to here. */
+    if (boot_read_swap_state(BOOT_IMG_AREA(&boot_data, 0),
+                             &meta.slots[0]) == 0 &&
+            boot_read_swap_state(BOOT_IMG_AREA(&boot_data, 1),
+                                 &meta.slots[1]) == 0) {
+        boot_token_save(rsp, BOOT_IMG_AREA(&boot_data, exec_slot),
+                        &meta.slots[0], &meta.slots[1]);
+    }
+#endif
 
  out:
     flash_area_close(BOOT_SCRATCH_AREA(&boot_data));
@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <flash_map_backend/flash_map_backend.h>
+
+/*
+ * hal_flash knows nothing of flash banks; BSPs of dual-bank parts which can
+ * exchange them provide both of these.
+ */
+int __attribute__((weak))
+flash_area_can_bank_swap(const struct flash_area *fa0,
+                         const struct flash_area *fa1)
+{
+    (void)fa0;
+    (void)fa1;
+    return 0;
+}
+
+int __attribute__((weak))
+flash_area_bank_swap(const struct flash_area *fa0,
+                     const struct flash_area *fa1)
+{
+    (void)fa0;
+    (void)fa1;
+    return -1;
+}
+
+/*
+ * hal_flash operations are blocking, so nothing is left in progress when
+ * they return; BSPs driving the flash controller directly can do better.
+ */
+int __attribute__((weak))
+flash_area_erase_start(const struct flash_area *fap, uint32_t off,
+                       uint32_t len)
+{
+    return flash_area_erase(fap, off, len);
+}
+
+int __attribute__((weak))
+flash_area_write_start(const struct flash_area *fap, uint32_t off,
+                       const void *src, uint32_t len)
+{
+    return flash_area_write(fap, off, src, len);
+}
+
+int __attribute__((weak))
+flash_area_poll(const struct flash_area *fap)
+{
+    (void)fap;
+    return 0;
+}
@@ -66,6 +66,30 @@
 #if MYNEWT_VAL(BOOTUTIL_BOOTSTRAP)
 #define MCUBOOT_BOOTSTRAP 1
 #endif
+#if MYNEWT_VAL(BOOTUTIL_SPARSE_IMAGES)
+#define MCUBOOT_SPARSE_IMAGES 1
+#endif
+#if MYNEWT_VAL(BOOTUTIL_BANK_SWAP)
+#define MCUBOOT_BANK_SWAP 1
+#endif
+#if MYNEWT_VAL(BOOTUTIL_BOOT_TOKEN)
+#define MCUBOOT_BOOT_TOKEN 1
+#endif
+#if MYNEWT_VAL(BOOTUTIL_STATUS_BIT_CLEAR)
+#define MCUBOOT_STATUS_BIT_CLEAR 1
+#endif
+#if MYNEWT_VAL(BOOTUTIL_VERIFY_WRITES)
+#define MCUBOOT_VERIFY_WRITES 1
+#endif
+#if MYNEWT_VAL(BOOTUTIL_OVERLAP_COPY)
+#define MCUBOOT_OVERLAP_COPY 1
+#endif
+#if MYNEWT_VAL(BOOTUTIL_EC256_NO_ASN1)
+#define MCUBOOT_EC256_NO_ASN1 1
+#endif
+#if MYNEWT_VAL(BOOTUTIL_DEFERRED_VALIDATION)
+#define MCUBOOT_DEFERRED_VALIDATION 1
+#endif
 
 #define MCUBOOT_MAX_IMG_SECTORS       MYNEWT_VAL(BOOTUTIL_MAX_IMG_SECTORS)
 
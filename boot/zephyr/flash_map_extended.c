@@ -99,3 +99,13 @@ int flash_area_read_is_empty(const struct flash_area *fa, uint32_t off,
 
     return 1;
 }
+
+/*
+ * The flash API does not tell whether a word can be programmed more than
+ * once, so the board or SoC configuration states it.
+ */
+int flash_area_can_reprogram(const struct flash_area *fap)
+{
+    (void)fap;
+    return IS_ENABLED(CONFIG_BOOT_FLASH_MULTI_PASS);
+}
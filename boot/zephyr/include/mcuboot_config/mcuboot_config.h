@@ -30,10 +30,18 @@
 #define MCUBOOT_USE_TINYCRYPT
 #endif
 
+#ifdef CONFIG_BOOT_EC256_NO_ASN1
+#define MCUBOOT_EC256_NO_ASN1
+#endif
+
 #ifdef CONFIG_BOOT_VALIDATE_SLOT0
 #define MCUBOOT_VALIDATE_SLOT0
 #endif
 
+#ifdef CONFIG_BOOT_DEFERRED_VALIDATION
+#define MCUBOOT_DEFERRED_VALIDATION
+#endif
+
 #ifdef CONFIG_BOOT_UPGRADE_ONLY
 #define MCUBOOT_OVERWRITE_ONLY
 #define MCUBOOT_OVERWRITE_ONLY_FAST
@@ -52,6 +60,30 @@
 #define MCUBOOT_BOOTSTRAP 1
 #endif
 
+#ifdef CONFIG_BOOT_SPARSE_IMAGES
+#define MCUBOOT_SPARSE_IMAGES
+#endif
+
+#ifdef CONFIG_BOOT_BANK_SWAP
+#define MCUBOOT_BANK_SWAP
+#endif
+
+#ifdef CONFIG_BOOT_TOKEN
+#define MCUBOOT_BOOT_TOKEN
+#endif
+
+#ifdef CONFIG_BOOT_STATUS_BIT_CLEAR
+#define MCUBOOT_STATUS_BIT_CLEAR
+#endif
+
+#ifdef CONFIG_BOOT_PIC_IMAGES
+#define MCUBOOT_PIC_IMAGES
+#endif
+
+#ifdef CONFIG_BOOT_VERIFY_WRITES
+#define MCUBOOT_VERIFY_WRITES
+#endif
+
 /*
  * Enabling this option uses newer flash map APIs. This saves RAM and
  * avoids deprecated API usage.
@@ -44,6 +44,22 @@ MCUBOOT_LOG_MODULE_REGISTER(mcuboot);
 
 void os_heap_init(void);
 
+#ifdef CONFIG_BOOT_TOKEN
+#ifndef CONFIG_BOOT_TOKEN_ADDR
+#error "CONFIG_BOOT_TOKEN needs CONFIG_BOOT_TOKEN_ADDR"
+#endif
+BUILD_ASSERT_MSG((CONFIG_BOOT_TOKEN_ADDR & 3) == 0 &&
+                 CONFIG_BOOT_TOKEN_ADDR >= CONFIG_SRAM_BASE_ADDRESS &&
+                 CONFIG_BOOT_TOKEN_ADDR + BOOT_TOKEN_RAM_SZ <=
+                 CONFIG_SRAM_BASE_ADDRESS + CONFIG_SRAM_SIZE * 1024,
+                 "CONFIG_BOOT_TOKEN_ADDR must be a word aligned block of SRAM");
+
+void *boot_token_ram(void)
+{
+    return (void *)CONFIG_BOOT_TOKEN_ADDR;
+}
+#endif
+
 #if defined(CONFIG_ARM)
 struct arm_vector_table {
     uint32_t msp;
@@ -56,6 +72,7 @@ static void do_boot(struct boot_rsp *rsp)
 {
     struct arm_vector_table *vt;
     uintptr_t flash_base;
+    uint32_t reset;
     int rc;
 
     /* The beginning of the image is the ARM vector table, containing
@@ -69,6 +86,13 @@ static void do_boot(struct boot_rsp *rsp)
     vt = (struct arm_vector_table *)(flash_base +
                                      rsp->br_image_off +
                                      rsp->br_hdr->ih_hdr_size);
+    reset = vt->reset;
+#ifdef CONFIG_BOOT_PIC_IMAGES
+    /* The vector table of a PIC image holds offsets from its header. */
+    if (rsp->br_hdr->ih_flags & IMAGE_F_PIC) {
+        reset += flash_base + rsp->br_image_off;
+    }
+#endif
     irq_lock();
     sys_clock_disable();
 #ifdef CONFIG_BOOT_SERIAL_CDC_ACM
@@ -76,7 +100,7 @@ static void do_boot(struct boot_rsp *rsp)
     usb_disable();
 #endif
     __set_MSP(vt->msp);
-    ((void (*)(void))vt->reset)();
+    ((void (*)(void))reset)();
 }
 
 #elif defined(CONFIG_XTENSA)
@@ -149,6 +173,39 @@ static void do_boot(struct boot_rsp *rsp)
 }
 #endif
 
+#ifdef CONFIG_BOOT_PIC_IMAGES
+#if !defined(CONFIG_BOOT_PIC_RAM_ADDR) || !defined(CONFIG_BOOT_PIC_RAM_SIZE)
+#error "CONFIG_BOOT_PIC_IMAGES needs CONFIG_BOOT_PIC_RAM_ADDR and _SIZE"
+#endif
+BUILD_ASSERT_MSG(CONFIG_BOOT_PIC_RAM_ADDR >= CONFIG_SRAM_BASE_ADDRESS &&
+                 CONFIG_BOOT_PIC_RAM_ADDR + CONFIG_BOOT_PIC_RAM_SIZE <=
+                 CONFIG_SRAM_BASE_ADDRESS + CONFIG_SRAM_SIZE * 1024,
+                 "CONFIG_BOOT_PIC_RAM_ADDR must be a block of SRAM");
+#ifdef CONFIG_BOOT_TOKEN
+BUILD_ASSERT_MSG(CONFIG_BOOT_PIC_RAM_ADDR + CONFIG_BOOT_PIC_RAM_SIZE <=
+                 CONFIG_BOOT_TOKEN_ADDR ||
+                 CONFIG_BOOT_TOKEN_ADDR + BOOT_TOKEN_RAM_SZ <=
+                 CONFIG_BOOT_PIC_RAM_ADDR,
+                 "The PIC relocation RAM overlaps the boot token");
+#endif
+
+static int pic_relocate(const struct boot_rsp *rsp)
+{
+    uintptr_t flash_base;
+    int rc;
+
+    rc = flash_device_base(rsp->br_flash_dev_id, &flash_base);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return boot_pic_relocate(rsp, flash_base + rsp->br_image_off,
+                             (void *)CONFIG_BOOT_PIC_RAM_ADDR,
+                             CONFIG_BOOT_PIC_RAM_ADDR,
+                             CONFIG_BOOT_PIC_RAM_SIZE);
+}
+#endif
+
 void main(void)
 {
     struct boot_rsp rsp;
@@ -207,7 +264,16 @@ void main(void)
     BOOT_LOG_INF("Bootloader chainload address offset: 0x%x",
                  rsp.br_image_off);
 
-    BOOT_LOG_INF("Jumping to the first image slot");
+#ifdef CONFIG_BOOT_PIC_IMAGES
+    rc = pic_relocate(&rsp);
+    if (rc != 0) {
+        BOOT_LOG_ERR("Unable to relocate PIC image");
+        while (1)
+            ;
+    }
+#endif
+
+    BOOT_LOG_INF("Jumping to the image in slot %d", rsp.br_slot);
     do_boot(&rsp);
 
     BOOT_LOG_ERR("Never should get here");
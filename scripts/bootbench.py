@@ -0,0 +1,292 @@
+#! /usr/bin/env python3
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""
+Count the instructions and flash operations of the boot loader's boot path.
+
+The simulator is built once per feature set, and its bench command boots once
+per scenario (none, test, resume and revert, see sim/src/bench.rs) under
+callgrind, which only collects while bootsim_bench_boot() runs.  Instruction
+counts don't depend on the load of the machine, so that small changes to the
+boot path show up as exact differences.
+
+Results are printed one per line, sorted, as tab separated fields:
+
+  SET  SCENARIO  METRIC  VALUE
+
+where METRIC is one of:
+
+  result              what boot_go() returned
+  flash.OP            flash operations, and the bytes they covered
+  ir                  instructions executed by the boot
+  ir.AREA             the same, for the code of one area: bootutil,
+                      crypto (ext/), or sim (the simulator and libc)
+  ir:FILE:FUNCTION    instructions executed in a bootutil or crypto function,
+                      excluding the functions it called
+
+Save the results of a baseline with -o, then compare them with those of a
+change with --compare.  Without valgrind, only flash operations are counted.
+
+Signatures and the RSA-OAEP encrypted keys of enc-rsa images are randomized,
+and so is the work of checking an ECDSA signature or decrypting such a key.
+The simulator keeps those of the images it boots in the build directory, and
+reuses them whenever it makes them from the same data again, so that
+unchanged images are checked with exactly the same instructions by every
+build.
+"""
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from footprint import BuildError, MCUBOOT_DIR, run, sim_features
+
+SIM_DIR = os.path.join(MCUBOOT_DIR, 'sim')
+
+SCENARIOS = ['none', 'test', 'resume', 'revert']
+
+FLASH_OPS = ['reads', 'read_bytes', 'writes', 'write_bytes', 'erases',
+             'erase_bytes', 'bank_swaps']
+
+BENCH_FN = 'bootsim_bench_boot'
+
+bootutil_re = re.compile(r'(^|/)boot/bootutil/')
+crypto_re = re.compile(r'(^|/)ext/')
+name_re = re.compile(r'^\((\d+)\)(?: (.*))?$')
+
+
+def set_label(features):
+    return ','.join(features) or '(base)'
+
+
+def build(args, features):
+    """Build the simulator, with symbols, returning the path of bootsim."""
+    target = os.path.join(args.build_dir, set_label(features))
+    env = dict(os.environ)
+    env['CARGO_TARGET_DIR'] = target
+    env['CARGO_PROFILE_RELEASE_DEBUG'] = 'true'
+    run(['cargo', 'build', '--release', '--features', ' '.join(features)],
+        cwd=SIM_DIR, env=env)
+    return os.path.join(target, 'release', 'bootsim')
+
+
+class Names(object):
+    """Callgrind's name compression: "(id) name" defines, "(id)" reuses."""
+
+    def __init__(self):
+        self.names = {}
+
+    def get(self, value):
+        m = name_re.match(value)
+        if m is None:
+            return value
+        if m.group(2) is not None:
+            self.names[m.group(1)] = m.group(2)
+        return self.names.get(m.group(1), value)
+
+
+def parse_callgrind(path):
+    """Return the Ir cost of each function, excluding its callees, keyed by
+    (object, file, function)."""
+    objs, files, fns = Names(), Names(), Names()
+    costs = {}
+    ob = fl = fn = None
+    npos, ir_index = 1, None
+    skip_next = False
+
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip('\n')
+            if not line:
+                continue
+            if line[0].isdigit() or line[0] in '+-*':
+                # The line following calls= is the inclusive cost of the
+                # call, which belongs to the callee.
+                if skip_next:
+                    skip_next = False
+                    continue
+                fields = line.split()
+                if ir_index is not None and len(fields) > ir_index:
+                    key = (ob, fl, fn)
+                    costs[key] = costs.get(key, 0) + int(fields[ir_index])
+                continue
+
+            key, _, value = line.partition('=')
+            if key in ('ob', 'cob'):
+                name = objs.get(value)
+                if key == 'ob':
+                    ob = name
+            elif key in ('fl', 'fi', 'fe', 'cfi', 'cfl'):
+                name = files.get(value)
+                if key == 'fl':
+                    fl = name
+            elif key in ('fn', 'cfn'):
+                name = fns.get(value)
+                if key == 'fn':
+                    fn = name
+            elif key == 'calls':
+                skip_next = True
+            elif line.startswith('positions:'):
+                npos = len(line.split()[1:])
+            elif line.startswith('events:'):
+                events = line.split()[1:]
+                if 'Ir' in events:
+                    ir_index = npos + events.index('Ir')
+
+    return costs
+
+
+def ir_metrics(costs):
+    """Group instruction costs by area and function."""
+    metrics = {'ir': 0, 'ir.bootutil': 0, 'ir.crypto': 0, 'ir.sim': 0}
+    for (ob, fl, fn), ir in costs.items():
+        metrics['ir'] += ir
+        if fl is not None and bootutil_re.search(fl):
+            area = 'bootutil'
+        elif fl is not None and crypto_re.search(fl):
+            area = 'crypto'
+        else:
+            metrics['ir.sim'] += ir
+            continue
+        metrics['ir.' + area] += ir
+        name = 'ir:{}:{}'.format(os.path.basename(fl), fn)
+        metrics[name] = metrics.get(name, 0) + ir
+    return metrics
+
+
+def bench(args, bootsim, scenario, out_dir):
+    """Boot once, returning the metrics of the boot, or None if the scenario
+    doesn't apply."""
+    cmd = [bootsim, 'bench', '--device', args.device, '--align',
+           str(args.align), '--keep-random',
+           os.path.join(args.build_dir, 'random-tlvs'), scenario]
+    out_file = os.path.join(out_dir, 'callgrind.out.' + scenario)
+    if args.valgrind:
+        cmd = [args.valgrind, '--tool=callgrind', '--collect-atstart=no',
+               '--toggle-collect=' + BENCH_FN,
+               '--callgrind-out-file=' + out_file] + cmd
+
+    # The bench command fails when the boot does, which is reported as its
+    # result.
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE,
+                          stderr=subprocess.PIPE, universal_newlines=True)
+    lines = [l for l in proc.stdout.splitlines() if not l.startswith('#')]
+    if not lines:
+        if proc.returncode == 0:
+            return None
+        raise BuildError(proc.stderr)
+
+    fields = lines[0].split('\t')
+    metrics = {'result': int(fields[1])}
+    for op, value in zip(FLASH_OPS, fields[2:]):
+        metrics['flash.' + op] = int(value)
+    if args.valgrind:
+        metrics.update(ir_metrics(parse_callgrind(out_file)))
+    return metrics
+
+
+def measure(args, sets):
+    results = {}
+    for features in sets:
+        label = set_label(features)
+        try:
+            bootsim = build(args, features)
+            out_dir = os.path.dirname(bootsim)
+            for scenario in args.scenario or SCENARIOS:
+                metrics = bench(args, bootsim, scenario, out_dir) or {}
+                for metric, value in metrics.items():
+                    results[(label, scenario, metric)] = value
+        except BuildError as e:
+            print('{}: failed'.format(label), file=sys.stderr)
+            if args.verbose:
+                print(e, file=sys.stderr)
+    return results
+
+
+def read_results(path):
+    results = {}
+    with open(path) as f:
+        for line in f:
+            label, scenario, metric, value = line.rstrip('\n').split('\t')
+            results[(label, scenario, metric)] = int(value)
+    return results
+
+
+def format_results(results):
+    return ''.join('{}\t{}\t{}\t{}\n'.format(*key, results[key])
+                   for key in sorted(results))
+
+
+def compare(old, new):
+    """Print the results which changed, with their difference, for the sets
+    and scenarios measured."""
+    measured = set(key[:2] for key in new)
+    for key in sorted(set(old) | set(new)):
+        if key[:2] not in measured:
+            continue
+        a, b = old.get(key), new.get(key)
+        if a == b:
+            continue
+        delta = '' if a is None or b is None else '{:+d}'.format(b - a)
+        print('{}\t{}\t{}\t{}\t{}\t{}'.format(
+            *key, '-' if a is None else a, '-' if b is None else b, delta))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-s', '--set', action='append',
+                        help='Features to build with, may be repeated '
+                             '(default: none, then each one separately)')
+    parser.add_argument('scenario', nargs='*',
+                        help='Scenarios to run: {} (default: all)'.format(
+                            ', '.join(SCENARIOS)))
+    parser.add_argument('--device', default='stm32f4',
+                        help='Simulated device')
+    parser.add_argument('--align', type=int, default=1,
+                        help='Flash write alignment')
+    parser.add_argument('-d', '--build-dir',
+                        default=os.path.join(tempfile.gettempdir(),
+                                             'mcuboot-bootbench'),
+                        help='Where to build')
+    parser.add_argument('-o', '--output',
+                        help='Write the results to a file')
+    parser.add_argument('--compare', metavar='OLD',
+                        help='Only print the results which differ from '
+                             'those in OLD')
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='Show the output of failed builds and boots')
+    args = parser.parse_args()
+    for s in args.scenario:
+        if s not in SCENARIOS:
+            parser.error('unknown scenario: {}'.format(s))
+
+    args.valgrind = shutil.which('valgrind')
+    if args.valgrind is None:
+        print('valgrind not found, only counting flash operations',
+              file=sys.stderr)
+
+    if args.set is not None:
+        sets = [s.replace(',', ' ').split() for s in args.set]
+    else:
+        sets = [[]] + [[f] for f in sim_features()]
+
+    results = measure(args, sets)
+    text = format_results(results)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text)
+    if args.compare:
+        compare(read_results(args.compare), results)
+    elif not args.output:
+        sys.stdout.write(text)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
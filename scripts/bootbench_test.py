@@ -0,0 +1,132 @@
+"""
+Tests for the callgrind output parser of bootbench
+"""
+
+import os.path
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.abspath(os.path.dirname(__file__)))
+
+from bootbench import parse_callgrind, ir_metrics
+
+# A small profile in the format callgrind 3.15 writes when collecting within
+# bootsim_bench_boot() only: its header, compressed names defined by fn= or
+# by cfn= before being used by fn=, calls whose inclusive cost belongs to the
+# callee, an inlined file, and relative positions.
+CALLGRIND_OUT = """\
+# callgrind format
+version: 1
+creator: callgrind-3.15.0
+pid: 4242
+cmd:  /tmp/mcuboot-bootbench/(base)/release/bootsim bench --device stm32f4 --align 1 none
+part: 1
+
+
+desc: I1 cache:
+desc: D1 cache:
+desc: LL cache:
+
+desc: Timerange: Basic block 1021 - 48310
+desc: Trigger: Program termination
+
+positions: line
+events: Ir
+summary: 1109
+
+
+ob=(1) /tmp/mcuboot-bootbench/(base)/release/bootsim
+fl=(1) /src/mcuboot/sim/src/bench.rs
+fn=(1) bootsim_bench_boot
+27 4
+cfl=(2) /src/mcuboot/boot/bootutil/src/loader.c
+cfn=(2) boot_go
+calls=1 1520
++1 1103
+* 2
+
+fl=(2)
+fn=(2)
+1520 12
++3 6
+cfl=(3) /src/mcuboot/boot/bootutil/src/image_validate.c
+cfn=(3) bootutil_img_validate
+calls=1 660
+-2 1080
+fi=(4) /src/mcuboot/boot/bootutil/src/bootutil_priv.h
+210 3
+fe=(2)
+1530 2
+
+fl=(3)
+fn=(3)
+660 30
+cob=(2) /lib/x86_64-linux-gnu/libc.so.6
+cfl=(5) ???
+cfn=(5) memcpy
+calls=2 0
++4 50
+cfl=(6) /src/mcuboot/ext/tinycrypt/lib/source/sha256.c
+cfn=(6) tc_sha256_update
+calls=3 98
++1 1000
+
+ob=(2)
+fl=(5)
+fn=(5)
+0 50
+
+ob=(1)
+fl=(6)
+fn=(6)
+98 640
++2 360
+
+totals: 1109
+"""
+
+
+class ParseCallgrind(unittest.TestCase):
+
+    def setUp(self):
+        self.test_dir = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.test_dir.name, 'callgrind.out')
+        with open(self.path, 'w') as f:
+            f.write(CALLGRIND_OUT)
+
+    def tearDown(self):
+        self.test_dir.cleanup()
+
+    def test_costs(self):
+        """Each function costs its own instructions, not its callees'."""
+        bootsim = '/tmp/mcuboot-bootbench/(base)/release/bootsim'
+        libc = '/lib/x86_64-linux-gnu/libc.so.6'
+        src = '/src/mcuboot/'
+        self.assertEqual(parse_callgrind(self.path), {
+            (bootsim, src + 'sim/src/bench.rs', 'bootsim_bench_boot'): 4 + 2,
+            (bootsim, src + 'boot/bootutil/src/loader.c', 'boot_go'):
+                12 + 6 + 3 + 2,
+            (bootsim, src + 'boot/bootutil/src/image_validate.c',
+             'bootutil_img_validate'): 30,
+            (libc, '???', 'memcpy'): 50,
+            (bootsim, src + 'ext/tinycrypt/lib/source/sha256.c',
+             'tc_sha256_update'): 640 + 360,
+        })
+
+    def test_metrics(self):
+        """The costs add up to the total of the collection."""
+        metrics = ir_metrics(parse_callgrind(self.path))
+        self.assertEqual(metrics, {
+            'ir': 1109,
+            'ir.bootutil': 23 + 30,
+            'ir.crypto': 1000,
+            'ir.sim': 6 + 50,
+            'ir:loader.c:boot_go': 23,
+            'ir:image_validate.c:bootutil_img_validate': 30,
+            'ir:sha256.c:tc_sha256_update': 1000,
+        })
+
+
+if __name__ == '__main__':
+    unittest.main()
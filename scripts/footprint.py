@@ -0,0 +1,284 @@
+#! /usr/bin/env python3
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""
+Report the flash footprint of the boot loader, per feature.
+
+The boot loader is built once with the base configuration, then once per
+variant, each adding some features to the base.  The size of each build is
+printed, along with what the variant's features cost: its difference with
+the base, or, for features which only make sense on top of others, with the
+build adding just those prerequisites.
+
+Two builds are supported:
+
+  sim     Builds bootutil and its crypto through the simulator's
+          mcuboot-sys crate, with the host compiler or the one given by CC
+          and CFLAGS, and links what boot_go() uses, stripping the rest.
+          A variant is a list of simulator features; the features they
+          enable are their prerequisites.
+
+  zephyr  Builds the Zephyr port for a board.  A variant is a list of
+          Kconfig settings: NAME, for NAME=y, or NAME=VALUE.  Settings
+          before a lone "+" are prerequisites.  The size of the boot
+          partition, and the room left in it, are also printed.
+"""
+
+import argparse
+import collections
+import glob
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+MCUBOOT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SIM_SYS_DIR = os.path.join(MCUBOOT_DIR, 'sim', 'mcuboot-sys')
+ZEPHYR_APP_DIR = os.path.join(MCUBOOT_DIR, 'boot', 'zephyr')
+
+# Size flags used when CFLAGS is not set.  Sections let the linker drop what
+# a variant doesn't use.
+SIM_CFLAGS = '-Os -ffunction-sections -fdata-sections'
+
+# Objects of the simulator harness, not part of the boot loader.
+SIM_HARNESS = ['run.o']
+
+# Zephyr settings applied to every build, so that sizes match a release
+# build rather than prj.conf's debug one.
+ZEPHYR_BASE_CONF = ['DEBUG=n', 'SIZE_OPTIMIZATIONS=y']
+
+ZEPHYR_ECDSA = ('BOOT_SIGNATURE_TYPE_ECDSA_P256 '
+                'BOOT_SIGNATURE_KEY_FILE="root-ec-p256.pem"')
+
+# The relocation RAM is board specific; this is the start of SRAM on most
+# Cortex-M parts.
+ZEPHYR_VARIANTS = [
+    'BOOT_VALIDATE_SLOT0=n',
+    'BOOT_DEFERRED_VALIDATION',
+    'BOOT_UPGRADE_ONLY',
+    'BOOT_BOOTSTRAP',
+    'BOOT_SPARSE_IMAGES',
+    'BOOT_FLASH_MULTI_PASS + BOOT_STATUS_BIT_CLEAR',
+    'BOOT_PIC_RAM_ADDR=0x20000000 BOOT_PIC_RAM_SIZE=1024 + BOOT_PIC_IMAGES',
+    'BOOT_VERIFY_WRITES',
+    'BOOT_HAVE_LOGGING=n',
+    ZEPHYR_ECDSA,
+    ZEPHYR_ECDSA + ' + BOOT_EC256_NO_ASN1',
+]
+
+partition_re = re.compile(
+    r"^#define FLASH_AREA_MCUBOOT_SIZE(_0)?\s+(0x[0-9a-fA-F]+|[0-9]+)$")
+
+
+class BuildError(Exception):
+    pass
+
+
+def run(cmd, cwd=None, env=None):
+    """Run a command, returning its output, or raising BuildError."""
+    proc = subprocess.run(cmd, cwd=cwd, env=env, stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True)
+    if proc.returncode != 0:
+        raise BuildError(proc.stdout)
+    return proc.stdout
+
+
+def elf_size(size_tool, path):
+    """Return the text, data and bss sizes of an object or executable."""
+    lines = run([size_tool, path]).splitlines()
+    text, data, bss = lines[1].split()[:3]
+    return int(text), int(data), int(bss)
+
+
+def sim_features():
+    """Return the features declared by mcuboot-sys, other than the default
+    set, in order, each mapped to the features it enables."""
+    features = collections.OrderedDict()
+    in_features = False
+    with open(os.path.join(SIM_SYS_DIR, 'Cargo.toml')) as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith('['):
+                in_features = line == '[features]'
+            elif in_features and '=' in line and not line.startswith('#'):
+                name, _, deps = line.partition('=')
+                name = name.strip()
+                if name != 'default':
+                    features[name] = re.findall(r'"([^"/]+)"', deps)
+    return features
+
+
+def sim_prerequisites(variant, declared):
+    """Return the features enabled by those of the variant, other than
+    themselves."""
+    prereqs = []
+    todo = list(variant)
+    while todo:
+        for dep in declared.get(todo.pop(), []):
+            if dep not in variant and dep not in prereqs:
+                prereqs.append(dep)
+                todo.append(dep)
+    return prereqs
+
+
+def split_variant(variant):
+    """Split the settings of a variant given as "PREREQS + SETTINGS"."""
+    words = variant.split()
+    if '+' not in words:
+        return [], words
+    i = words.index('+')
+    return words[:i], words[i + 1:]
+
+
+def sim_build(args, features):
+    env = dict(os.environ)
+    env.setdefault('CFLAGS', SIM_CFLAGS)
+    env['CARGO_TARGET_DIR'] = os.path.join(args.build_dir, 'sim')
+    out = run(['cargo', 'build', '--release', '--message-format=json',
+               '--features', ' '.join(features)], cwd=SIM_SYS_DIR, env=env)
+
+    out_dir = None
+    for line in out.splitlines():
+        try:
+            msg = json.loads(line)
+        except ValueError:
+            continue
+        if msg.get('reason') == 'build-script-executed' and \
+                'mcuboot-sys' in msg.get('package_id', ''):
+            out_dir = msg['out_dir']
+    if out_dir is None:
+        raise BuildError('mcuboot-sys build script output not found')
+
+    objs = [o for o in glob.glob(os.path.join(out_dir, '**', '*.o'),
+                                 recursive=True)
+            if not any(o.endswith(h) for h in SIM_HARNESS)]
+
+    # Everything the port would provide is left unresolved.
+    elf = os.path.join(out_dir, 'footprint.elf')
+    run([env.get('CC', 'cc'), '-nostdlib', '-static', '-o', elf,
+         '-Wl,--gc-sections', '-Wl,-e,boot_go',
+         '-Wl,--unresolved-symbols=ignore-all'] + objs)
+    return elf_size(args.size, elf), None
+
+
+def zephyr_build(args, settings):
+    name = re.sub(r'[^0-9A-Za-z]+', '_', ' '.join(settings)) or 'base'
+    build_dir = os.path.join(args.build_dir, 'zephyr', args.board, name)
+    os.makedirs(build_dir, exist_ok=True)
+
+    conf = os.path.join(build_dir, 'footprint.conf')
+    with open(conf, 'w') as f:
+        for s in settings:
+            if '=' not in s:
+                s += '=y'
+            f.write('CONFIG_{}\n'.format(s))
+
+    run(['cmake', '-GNinja', '-DBOARD={}'.format(args.board),
+         '-DOVERLAY_CONFIG={}'.format(conf), ZEPHYR_APP_DIR], cwd=build_dir)
+    run(['ninja'], cwd=build_dir)
+
+    partition = None
+    dts = os.path.join(build_dir, 'zephyr', 'include', 'generated',
+                       'generated_dts_board.h')
+    if os.path.exists(dts):
+        with open(dts) as f:
+            for line in f:
+                m = partition_re.match(line)
+                if m is not None:
+                    partition = int(m.group(2), 0)
+
+    elf = os.path.join(build_dir, 'zephyr', 'zephyr.elf')
+    return elf_size(args.size, elf), partition
+
+
+def report(args, build, base, variants):
+    """Print the size of each variant, given as (prerequisites, settings),
+    with the difference it makes to the build with its prerequisites."""
+    print('{:<48} {:>7} {:>6} {:>6} {:>7} {:>7}'.format(
+        'variant', 'text', 'data', 'bss', 'flash', 'delta'))
+
+    # Builds are shared by the variants with the same prerequisites.
+    builds = {}
+
+    def cached_build(settings):
+        key = tuple(settings)
+        if key not in builds:
+            try:
+                builds[key] = build(args, base + settings)
+            except BuildError as e:
+                builds[key] = e
+        return builds[key]
+
+    for prereqs, variant in [([], [])] + variants:
+        label = ' '.join(variant) or '(base)'
+        if prereqs:
+            label += ' (on {})'.format(' '.join(prereqs))
+        result = cached_build(prereqs + variant)
+        ref = cached_build(prereqs) if variant else None
+        if isinstance(result, BuildError):
+            print('{:<48} build failed'.format(label))
+            if args.verbose:
+                print(result)
+            continue
+        (text, data, bss), partition = result
+
+        flash = text + data
+        delta = ''
+        if ref is not None and not isinstance(ref, BuildError):
+            (ref_text, ref_data, _), _ = ref
+            delta = '{:+d}'.format(flash - ref_text - ref_data)
+        print('{:<48} {:>7} {:>6} {:>6} {:>7} {:>7}'.format(
+            label, text, data, bss, flash, delta))
+        if not variant and partition is not None:
+            print('{:<48} {:>7} bytes, {} left'.format(
+                'boot partition', partition, partition - flash))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('build', choices=['sim', 'zephyr'])
+    parser.add_argument('-b', '--board',
+                        help='Zephyr board to build for')
+    parser.add_argument('--base', default='',
+                        help='Features or settings added to every build')
+    parser.add_argument('-V', '--variant', action='append',
+                        help='Features or settings to measure, may be '
+                             'repeated (default: each one separately)')
+    parser.add_argument('-d', '--build-dir',
+                        default=os.path.join(tempfile.gettempdir(),
+                                             'mcuboot-footprint'),
+                        help='Where to build')
+    parser.add_argument('--size', default=os.environ.get('SIZE', 'size'),
+                        help='size tool matching the compiler')
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='Show the output of failed builds')
+    args = parser.parse_args()
+
+    base = args.base.split()
+    if args.build == 'sim':
+        build = sim_build
+        declared = sim_features()
+        variants = []
+        for v in args.variant or [f for f in declared if f not in base]:
+            v = v.split()
+            prereqs = [f for f in sim_prerequisites(v, declared)
+                       if f not in base]
+            variants.append((prereqs, v))
+    else:
+        if args.board is None:
+            parser.error('the zephyr build needs a board')
+        build = zephyr_build
+        base = ZEPHYR_BASE_CONF + base
+        variants = [split_variant(v)
+                    for v in args.variant or ZEPHYR_VARIANTS]
+
+    report(args, build, base, variants)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -20,26 +20,38 @@ Image signing and management.
 from . import version as versmod
 from intelhex import IntelHex
 import hashlib
+import io
+import re
 import struct
 import os.path
 from cryptography.hazmat.primitives.asymmetric import padding
 from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
 from cryptography.hazmat.backends import default_backend
 from cryptography.hazmat.primitives import hashes
+from cryptography.exceptions import InvalidSignature
 
 IMAGE_MAGIC = 0x96f3b83d
 IMAGE_HEADER_SIZE = 32
 BIN_EXT = "bin"
 INTEL_HEX_EXT = "hex"
 DEFAULT_MAX_SECTORS = 128
+DEFAULT_MAX_SPARSE_RANGES = 8
+VERIFY_BLOCK_SIZE = 4096
+BOOT_COPY_BUF_SIZE = 1024   # boot_copy_buf in loader.c
+BOOT_MAGIC_SIZE = 16
 
 # Image header flags.
 IMAGE_F = {
         'PIC':                   0x0000001,
         'NON_BOOTABLE':          0x0000010,
         'ENCRYPTED':             0x0000004,
+        'SPARSE':                0x0000040,
+        'HASH_PARTS':            0x0000080,
 }
 
+# Relocation flags.
+IMAGE_RELOC_F_REL = 0x0001
+
 TLV_VALUES = {
         'KEYHASH': 0x01,
         'SHA256': 0x10,
@@ -48,6 +60,9 @@ TLV_VALUES = {
         'ECDSA256': 0x22,
         'ENCRSA2048': 0x30,
         'ENCKW128': 0x31,
+        'SPARSE': 0x40,
+        'RELOC': 0x50,
+        'HASH_PARTS': 0x60,
 }
 
 TLV_INFO_SIZE = 4
@@ -87,7 +102,8 @@ class Image():
     def __init__(self, version=None, header_size=IMAGE_HEADER_SIZE,
                  pad_header=False, pad=False, align=1, slot_size=0,
                  max_sectors=DEFAULT_MAX_SECTORS, overwrite_only=False,
-                 endian="little"):
+                 endian="little", sparse=None, pic_base=None, relocs=None,
+                 prefix_size=None):
         self.version = version or versmod.decode_version("0")
         self.header_size = header_size
         self.pad_header = pad_header
@@ -97,6 +113,11 @@ class Image():
         self.max_sectors = max_sectors
         self.overwrite_only = overwrite_only
         self.endian = endian
+        self.sparse = sparse
+        self.sparse_ranges = []
+        self.pic_base = pic_base
+        self.relocs = relocs or []
+        self.prefix_size = prefix_size
         self.base_addr = None
         self.payload = []
 
@@ -168,15 +189,119 @@ class Image():
                         len(self.payload), tsize, self.slot_size)
                 raise Exception(msg)
 
+    def find_sparse_ranges(self):
+        """Find the fill ranges of a sparse image.
+
+        These are runs of at least `sparse` bytes of 0x00 or 0xff in the image
+        body, keeping only the longest DEFAULT_MAX_SPARSE_RANGES.  Offsets are
+        relative to the start of the header."""
+        if not self.sparse:
+            return []
+        pattern = re.compile(b'\\x00{%d,}|\\xff{%d,}' % (self.sparse, self.sparse))
+        body = bytes(self.payload[self.header_size:])
+        ranges = [(self.header_size + m.start(), m.end() - m.start(), body[m.start()])
+                  for m in pattern.finditer(body)]
+        ranges.sort(key=lambda r: r[1], reverse=True)
+        return sorted(ranges[:DEFAULT_MAX_SPARSE_RANGES])
+
+    def relocate(self):
+        """Make the tables listed in `relocs` position-independent.
+
+        Each reloc is an (address, count, dst) tuple, giving the link
+        address of a table of 32-bit words and the RAM address the boot
+        loader copies it to.  Words pointing into the image are replaced
+        with their offset from the start of the header; the others are left
+        alone.  Returns the reloc descriptors, one per run of words of either
+        kind."""
+        if not self.relocs:
+            return []
+        base = self.pic_base if self.pic_base is not None else self.base_addr
+        if base is None:
+            raise Exception("Relocations need --pic-base or a hex input")
+        if self.pic_base is not None and self.pad_header:
+            base -= self.header_size
+        end = base + len(self.payload)
+        e = STRUCT_ENDIAN_DICT[self.endian]
+        self.payload = bytearray(self.payload)
+        descs = []
+        for addr, count, dst in self.relocs:
+            off = addr - base
+            if off < self.header_size or off + 4 * count > len(self.payload):
+                raise Exception("Table at 0x{:x} is outside of the image".format(addr))
+            if dst % 4 != 0:
+                raise Exception("Table destination 0x{:x} is not word aligned".format(dst))
+            run = None
+            for i in range(count):
+                pos = off + 4 * i
+                word, = struct.unpack_from(e + 'I', self.payload, pos)
+                flags = 0
+                if base <= word < end:
+                    struct.pack_into(e + 'I', self.payload, pos, word - base)
+                    flags = IMAGE_RELOC_F_REL
+                if run is not None and run[3] == flags:
+                    run[2] += 1
+                else:
+                    run = [pos, dst + 4 * i, 1, flags]
+                    descs.append(run)
+        return descs
+
+    def hashed(self, start, end):
+        """Return the payload from start to end, minus the fill ranges."""
+        message = bytearray()
+        pos = start
+        for off, size, _ in self.sparse_ranges:
+            if off + size <= pos or off >= end:
+                continue
+            message += self.payload[pos:max(pos, off)]
+            pos = min(off + size, end)
+        message += self.payload[pos:end]
+        return message
+
     def create(self, key, enckey):
+        relocs = self.relocate()
+        self.sparse_ranges = self.find_sparse_ranges()
+        if self.prefix_size is not None and \
+                not 0 <= self.prefix_size <= len(self.payload) - self.header_size:
+            raise Exception("Prefix size 0x{:x} is larger than the image".format(
+                self.prefix_size))
         self.add_header(enckey)
 
         tlv = TLV(self.endian)
+        e = STRUCT_ENDIAN_DICT[self.endian]
+
+        # The hash of a sparse image leaves out the fill ranges, and covers
+        # their descriptor instead.
+        descs = b''
+        if self.sparse_ranges:
+            desc = b''.join(struct.pack(e + 'IIB3x', off, size, fill)
+                            for off, size, fill in self.sparse_ranges)
+            tlv.add('SPARSE', desc)
+            descs += desc
+
+        # The relocations of a PIC image are covered by the hash too.
+        if relocs:
+            desc = b''.join(struct.pack(e + 'IIHH', off, dst, count, flags)
+                            for off, dst, count, flags in relocs)
+            tlv.add('RELOC', desc)
+            descs += desc
+
+        # With a prefix size, the hash is over the hashes of the image up to
+        # the split and of the rest, which is recorded so that the boot
+        # loader can check the first part alone.  The descriptors go with the
+        # first part, as the boot loader uses them before the rest is checked.
+        if self.prefix_size is not None:
+            split = self.header_size + self.prefix_size
+            rest = hashlib.sha256(self.hashed(split, len(self.payload))).digest()
+            tlv.add('HASH_PARTS', struct.pack(e + 'I', split) + rest)
+            message = hashlib.sha256(self.hashed(0, split) +
+                                     descs).digest() + rest
+        else:
+            message = self.hashed(0, len(self.payload)) + descs
 
         # Note that ecdsa wants to do the hashing itself, which means
         # we get to hash it twice.
         sha = hashlib.sha256()
-        sha.update(self.payload)
+        sha.update(message)
         digest = sha.digest()
 
         tlv.add('SHA256', digest)
@@ -188,7 +313,7 @@ class Image():
             pubbytes = sha.digest()
             tlv.add('KEYHASH', pubbytes)
 
-            sig = key.sign(bytes(self.payload))
+            sig = key.sign(bytes(message))
             tlv.add(key.sig_tlv(), sig)
 
         if enckey is not None:
@@ -216,6 +341,12 @@ class Image():
         flags = 0
         if enckey is not None:
             flags |= IMAGE_F['ENCRYPTED']
+        if self.sparse_ranges:
+            flags |= IMAGE_F['SPARSE']
+        if self.relocs:
+            flags |= IMAGE_F['PIC']
+        if self.prefix_size is not None:
+            flags |= IMAGE_F['HASH_PARTS']
 
         e = STRUCT_ENDIAN_DICT[self.endian]
         fmt = (e +
@@ -264,3 +395,272 @@ class Image():
         pbytes += b'\xff' * (tsize - len(boot_magic))
         pbytes += boot_magic
         self.payload += pbytes
+
+
+class VerifyError(Exception):
+    pass
+
+
+def _read_at(f, off, size, what):
+    f.seek(off)
+    buf = f.read(size)
+    if len(buf) != size:
+        raise VerifyError("Image is truncated, {} at 0x{:x} is missing".format(
+            what, off))
+    return buf
+
+
+def _open_image(path):
+    ext = os.path.splitext(path)[1][1:].lower()
+    if ext == INTEL_HEX_EXT:
+        return io.BytesIO(bytes(IntelHex(path).tobinarray()))
+    return open(path, 'rb')
+
+
+def _tlv_descs(f, tlvs, kind, desc_size, what):
+    """Return the raw descriptors of the first TLV of the given kind, or None
+    if there is none."""
+    for t, off, size in tlvs:
+        if t != TLV_VALUES[kind]:
+            continue
+        if size == 0 or size % desc_size != 0:
+            raise VerifyError("Malformed {} TLV".format(what))
+        return _read_at(f, off, size, what + " TLV")
+    return None
+
+
+def _hash_range(f, sha, start, end, ranges):
+    """Hash the image from start to end, leaving out the fill ranges, which
+    must hold their fill value."""
+    off = start
+    for r_off, r_size, fill in ranges + [(end, 0, None)]:
+        r_start = min(r_off, end)
+        r_end = min(r_off + r_size, end)
+        if r_end <= off:
+            continue
+        while off < r_start:
+            blk = _read_at(f, off, min(VERIFY_BLOCK_SIZE, r_start - off),
+                           "image data")
+            sha.update(blk)
+            off += len(blk)
+        while off < r_end:
+            blk = _read_at(f, off, min(VERIFY_BLOCK_SIZE, r_end - off),
+                           "image data")
+            if blk.count(fill) != len(blk):
+                raise VerifyError(
+                    "Fill range at 0x{:x} does not hold 0x{:02x}".format(
+                        r_off, fill))
+            off += len(blk)
+
+
+def verify(path, key=None, endian='little',
+           max_sparse_ranges=DEFAULT_MAX_SPARSE_RANGES):
+    """Check a signed image the way bootutil_img_validate() does.
+
+    The image is read in blocks of VERIFY_BLOCK_SIZE bytes, and its header
+    and TLVs are held to the same bounds as in the bootloader.  If a key is
+    given, the image must carry a valid signature from it, preceded by its
+    KEYHASH.  Raises VerifyError if the image does not validate; otherwise
+    returns a dict describing it."""
+    e = STRUCT_ENDIAN_DICT[endian]
+    with _open_image(path) as f:
+        hdr = _read_at(f, 0, IMAGE_HEADER_SIZE, "header")
+        (magic, _, hdr_size, _, img_size, flags, major, minor, revision,
+         build, _) = struct.unpack(e + 'IIHHIIBBHII', hdr)
+        if magic != IMAGE_MAGIC:
+            raise VerifyError("Bad image magic 0x{:08x}".format(magic))
+        if flags & IMAGE_F['ENCRYPTED']:
+            raise VerifyError("Encrypted images can only be checked on the device")
+
+        # The TLVs come after the image.
+        img_end = hdr_size + img_size
+        tlv_magic, tlv_tot = struct.unpack(
+            e + 'HH', _read_at(f, img_end, TLV_INFO_SIZE, "TLV info"))
+        if tlv_magic != TLV_INFO_MAGIC:
+            raise VerifyError("Bad TLV info magic 0x{:04x}".format(tlv_magic))
+        tlvs = []
+        off = img_end + TLV_INFO_SIZE
+        while off < img_end + tlv_tot:
+            kind, _, size = struct.unpack(e + 'BBH', _read_at(f, off, 4, "TLV"))
+            tlvs.append((kind, off + 4, size))
+            off += 4 + size
+
+        ranges = []
+        sparse_desc = b''
+        if flags & IMAGE_F['SPARSE']:
+            sparse_desc = _tlv_descs(f, tlvs, 'SPARSE', 12, "SPARSE")
+            if sparse_desc is None:
+                raise VerifyError("Sparse image without a SPARSE TLV")
+            ranges = [struct.unpack_from(e + 'IIB3x', sparse_desc, i)
+                      for i in range(0, len(sparse_desc), 12)]
+            if len(ranges) > max_sparse_ranges:
+                raise VerifyError("Too many fill ranges")
+            prev_end = hdr_size
+            for r_off, r_size, _ in ranges:
+                if (r_off < prev_end or r_size == 0 or r_off > img_end or
+                        r_size > img_end - r_off):
+                    raise VerifyError("Bad fill range at 0x{:x}".format(r_off))
+                prev_end = r_off + r_size
+
+        reloc_desc = b''
+        if flags & IMAGE_F['PIC']:
+            reloc_desc = _tlv_descs(f, tlvs, 'RELOC', 12, "RELOC") or b''
+            for i in range(0, len(reloc_desc), 12):
+                r_off, dst, count, _ = struct.unpack_from(e + 'IIHH',
+                                                          reloc_desc, i)
+                if (r_off < hdr_size or count == 0 or r_off > img_end or
+                        count * 4 > img_end - r_off or dst % 4 != 0):
+                    raise VerifyError("Bad relocation at 0x{:x}".format(r_off))
+
+        # An image hashed in two parts records where it is split, and the
+        # hash of the second part.
+        split = 0
+        if flags & IMAGE_F['HASH_PARTS']:
+            parts = _tlv_descs(f, tlvs, 'HASH_PARTS', 36, "HASH_PARTS")
+            if parts is None or len(parts) != 36:
+                raise VerifyError("Two-part hash without a HASH_PARTS TLV")
+            split, = struct.unpack_from(e + 'I', parts)
+            if split < hdr_size or split > img_end:
+                raise VerifyError("Bad hash split at 0x{:x}".format(split))
+
+        # Hash the header and body, leaving out the fill ranges, then the
+        # descriptors.  In an image hashed in two parts, these go with the
+        # first part.
+        sha = hashlib.sha256()
+        _hash_range(f, sha, 0, split or img_end, ranges)
+        sha.update(sparse_desc)
+        sha.update(reloc_desc)
+        digest = sha.digest()
+        if split:
+            sha = hashlib.sha256()
+            _hash_range(f, sha, split, img_end, ranges)
+            if sha.digest() != parts[4:]:
+                raise VerifyError("Hash of the image past 0x{:x} does not "
+                                  "match".format(split))
+            digest = hashlib.sha256(digest + parts[4:]).digest()
+
+        sha_valid = False
+        sig_valid = False
+        key_match = False
+        if key is not None:
+            pub = key.get_public_bytes()
+            keyhash = hashlib.sha256(pub).digest()
+            sig_tlv = TLV_VALUES[key.sig_tlv()]
+        for kind, off, size in tlvs:
+            if kind == TLV_VALUES['SHA256']:
+                if size != len(digest):
+                    raise VerifyError("Malformed SHA256 TLV")
+                if _read_at(f, off, size, "SHA256 TLV") != digest:
+                    raise VerifyError("Image hash does not match")
+                sha_valid = True
+            elif key is not None and kind == TLV_VALUES['KEYHASH']:
+                if size > len(keyhash):
+                    raise VerifyError("Malformed KEYHASH TLV")
+                key_match = _read_at(f, off, size, "KEYHASH TLV") == \
+                            keyhash[:size]
+            elif key is not None and kind == sig_tlv:
+                # Signatures from other keys are ignored.
+                if not key_match:
+                    continue
+                key_match = False
+                if size < key.sig_len() or size > 256 or \
+                        (sig_tlv == TLV_VALUES['RSA2048'] and
+                         size != key.sig_len()):
+                    raise VerifyError("Malformed {} TLV".format(key.sig_tlv()))
+                try:
+                    key.verify_digest(_read_at(f, off, size, "signature"),
+                                      digest)
+                    sig_valid = True
+                except InvalidSignature:
+                    pass
+
+    if not sha_valid:
+        raise VerifyError("Image has no SHA256 TLV")
+    if key is not None and not sig_valid:
+        raise VerifyError("Image has no valid signature from the given key")
+
+    return {
+        'version': versmod.SemiSemVersion(major, minor, revision, build),
+        'flags': flags,
+        'header_size': hdr_size,
+        'image_size': img_size,
+        'size': img_end + tlv_tot,
+        'hash': digest,
+        'split': split or None,
+        'signed': sig_valid,
+    }
+
+
+def _sectors_for(size, sector_size):
+    return (size + sector_size - 1) // sector_size
+
+
+def estimate_install(size, slot_size, sector_size, scratch_size=None,
+                     align=1, max_sectors=DEFAULT_MAX_SECTORS):
+    """Estimate the flash operations the bootloader does to install an image
+    of the given total size from slot 1, with uniform sectors.
+
+    Returns a dict with an entry for swap and one for overwrite-only
+    upgrades, each giving whether the image and its trailer fit, the image
+    sectors touched, the sector erases, the bytes read, and an upper bound
+    on the bytes programmed; chunks that read back as erased are skipped by
+    the bootloader.  The swap estimate assumes the image in slot 0 is no
+    larger, and counts the status writes separately."""
+    if scratch_size is None:
+        scratch_size = sector_size
+    max_sectors = DEFAULT_MAX_SECTORS if max_sectors is None else max_sectors
+    num_sectors = slot_size // sector_size
+    sectors = _sectors_for(size, sector_size)
+    img = Image(align=align, max_sectors=max_sectors)
+    problems = []
+    if slot_size % sector_size != 0:
+        problems.append("slot size is not a multiple of the sector size")
+    if num_sectors > max_sectors:
+        problems.append("slot has more than {} sectors".format(max_sectors))
+
+    # Swap: groups of sectors going through scratch, from the last one,
+    # each erased and programmed once in all three areas.
+    trailer_sz = img._trailer_size(align, max_sectors, False)
+    swap_problems = list(problems)
+    if size + trailer_sz > slot_size:
+        swap_problems.append("image and trailer (0x{:x}) exceed the slot".format(
+            trailer_sz))
+    if scratch_size < sector_size:
+        swap_problems.append("scratch is smaller than a sector")
+    per_group = max(1, scratch_size // sector_size)
+    groups = _sectors_for(sectors, per_group)
+    swap = {
+        'fits': not swap_problems,
+        'problems': swap_problems,
+        'sectors': sectors,
+        'erases': 3 * sectors,
+        'program': 3 * sectors * sector_size,
+        'read': size + 3 * sectors * sector_size,
+        'status_writes': 3 * groups,
+    }
+    if sectors < num_sectors:
+        # The last sector is not swapped, so the trailer sectors are erased
+        # in both slots before the first status write.
+        swap['erases'] += 2 * _sectors_for(trailer_sz, sector_size)
+
+    # Overwrite: the whole of slot 0 is erased and copied, then the first
+    # and last sectors of slot 1.
+    trailer_sz = img._trailer_size(align, max_sectors, True)
+    ow_problems = list(problems)
+    if size + trailer_sz > slot_size:
+        ow_problems.append("image and trailer (0x{:x}) exceed the slot".format(
+            trailer_sz))
+    chunks = _sectors_for(size, BOOT_COPY_BUF_SIZE)
+    if chunks < _sectors_for(slot_size, BOOT_COPY_BUF_SIZE):
+        chunks += 1   # The one holding the slot 1 magic.
+    overwrite = {
+        'fits': not ow_problems,
+        'problems': ow_problems,
+        'sectors': num_sectors,
+        'erases': num_sectors + 2,
+        'program': min(chunks * BOOT_COPY_BUF_SIZE, slot_size),
+        'read': size + slot_size,
+        'status_writes': 0,
+    }
+
+    return {'swap': swap, 'overwrite': overwrite}
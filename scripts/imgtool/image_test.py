@@ -0,0 +1,225 @@
+"""
+Tests for image signing, verification and install estimates
+"""
+
+import hashlib
+import io
+import os.path
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.abspath(os.path.join(os.path.dirname(__file__), '..')))
+
+from imgtool import image
+from imgtool.image import Image, VerifyError, verify, estimate_install
+from imgtool.keys import load, ECDSA256P1
+
+HEADER_SIZE = 0x20
+
+def body():
+    """An image body with a run of 0x00 and a run of 0xff, long enough to
+    become fill ranges."""
+    data = bytearray(i * 7 % 251 + 1 for i in range(0x3000))
+    data[0x800:0x1000] = b'\x00' * 0x800
+    data[0x1800:0x2400] = b'\xff' * 0xc00
+    return bytes(data)
+
+class ImageSigning(unittest.TestCase):
+
+    def setUp(self):
+        self.test_dir = tempfile.TemporaryDirectory()
+        self.key = ECDSA256P1.generate()
+        pubname = self.tname('public.pem')
+        self.key.export_public(pubname)
+        self.pubkey = load(pubname)
+
+    def tname(self, base):
+        return os.path.join(self.test_dir.name, base)
+
+    def tearDown(self):
+        self.test_dir.cleanup()
+
+    def sign(self, name, **kwargs):
+        """Sign body() with the given Image options, returning the path of
+        the signed image and the Image."""
+        inname = self.tname(name + '-in.bin')
+        with open(inname, 'wb') as f:
+            f.write(body())
+        img = Image(header_size=HEADER_SIZE, pad_header=True, **kwargs)
+        img.load(inname)
+        img.create(self.key, None)
+        outname = self.tname(name + '.bin')
+        img.save(outname)
+        return outname, img
+
+    def modify(self, path, off, xor=0, value=None):
+        with open(path, 'r+b') as f:
+            f.seek(off)
+            byte = f.read(1)[0]
+            f.seek(off)
+            f.write(bytes([byte ^ xor if value is None else value]))
+
+    def test_plain(self):
+        path, img = self.sign('plain')
+        info = verify(path, self.pubkey)
+        self.assertTrue(info['signed'])
+        self.assertIsNone(info['split'])
+        self.assertEqual(info['header_size'], HEADER_SIZE)
+        self.assertEqual(info['image_size'], len(body()))
+        self.assertEqual(info['flags'], 0)
+
+        # Without a key, only the hash is checked.
+        self.assertFalse(verify(path)['signed'])
+
+    def test_sparse(self):
+        path, img = self.sign('sparse', sparse=0x100)
+        self.assertEqual(img.sparse_ranges,
+                         [(HEADER_SIZE + 0x800, 0x800, 0x00),
+                          (HEADER_SIZE + 0x1800, 0xc00, 0xff)])
+        info = verify(path, self.pubkey)
+        self.assertTrue(info['signed'])
+        self.assertEqual(info['flags'], image.IMAGE_F['SPARSE'])
+
+    def test_prefix(self):
+        for sparse in (None, 0x100):
+            path, img = self.sign('prefix', sparse=sparse, prefix_size=0x1000)
+            info = verify(path, self.pubkey)
+            self.assertTrue(info['signed'])
+            self.assertEqual(info['split'], HEADER_SIZE + 0x1000)
+            self.assertTrue(info['flags'] & image.IMAGE_F['HASH_PARTS'])
+
+    def test_prefix_descs(self):
+        """The fill range descriptors of an image hashed in two parts are
+        covered by the first part, which the boot loader checks."""
+        split = HEADER_SIZE + 0x1000
+        end = HEADER_SIZE + len(body())
+        path, img = self.sign('prefix', sparse=0x100, prefix_size=0x1000)
+        rest = hashlib.sha256(img.hashed(split, end)).digest()
+        with open(path, 'rb') as f:
+            self.assertIn(rest, f.read())
+
+        # Shorten the last fill range.
+        last = len(img.sparse_ranges) - 1
+        self.modify(path, end + 4 + 4 + 12 * last + 4, xor=0x01)
+        self.assertRaises(VerifyError, verify, path, self.pubkey)
+
+    def test_bit_flip(self):
+        """Flipping a single bit of the header or body fails the check,
+        whatever part of the hash covers it."""
+        for name, kwargs in (('plain', {}),
+                             ('sparse', {'sparse': 0x100}),
+                             ('prefix', {'prefix_size': 0x1000})):
+            for off in (24, HEADER_SIZE + 0x10, HEADER_SIZE + 0x2800):
+                path, img = self.sign(name, **kwargs)
+                self.modify(path, off, xor=0x04)
+                self.assertRaises(VerifyError, verify, path, self.pubkey)
+
+    def test_bad_fill(self):
+        """A fill range that no longer holds its fill value fails the
+        check, even though it is left out of the hash."""
+        for kwargs in ({}, {'prefix_size': 0x1000}):
+            path, img = self.sign('fill', sparse=0x100, **kwargs)
+            for off, size, fill in img.sparse_ranges:
+                self.modify(path, off + size - 1, value=fill ^ 0x10)
+                with self.assertRaisesRegex(VerifyError, 'Fill range'):
+                    verify(path, self.pubkey)
+                self.modify(path, off + size - 1, value=fill)
+            verify(path, self.pubkey)
+
+    def test_wrong_key(self):
+        path, img = self.sign('plain')
+        other = ECDSA256P1.generate()
+        self.assertRaises(VerifyError, verify, path, other)
+
+class HashRange(unittest.TestCase):
+
+    def test_plain(self):
+        data = bytes(range(256)) * 40
+        sha = hashlib.sha256()
+        image._hash_range(io.BytesIO(data), sha, 16, len(data) - 16, [])
+        self.assertEqual(sha.digest(), hashlib.sha256(data[16:-16]).digest())
+
+    def test_ranges(self):
+        """Fill ranges are left out, including those crossing a block
+        boundary or the end of the range hashed."""
+        data = bytearray(i & 0x7f for i in range(3 * image.VERIFY_BLOCK_SIZE))
+        ranges = [(100, 50, 0x00),
+                  (image.VERIFY_BLOCK_SIZE - 10, 20, 0xff),
+                  (len(data) - 30, 30, 0x00)]
+        for off, size, fill in ranges:
+            data[off:off + size] = bytes([fill]) * size
+        end = len(data) - 10
+        expected = (data[0:100] + data[150:image.VERIFY_BLOCK_SIZE - 10] +
+                    data[image.VERIFY_BLOCK_SIZE + 10:len(data) - 30])
+        sha = hashlib.sha256()
+        image._hash_range(io.BytesIO(bytes(data)), sha, 0, end, ranges)
+        self.assertEqual(sha.digest(), hashlib.sha256(expected).digest())
+
+        # Ranges before the start are skipped.
+        sha = hashlib.sha256()
+        image._hash_range(io.BytesIO(bytes(data)), sha, 200, 300, ranges)
+        self.assertEqual(sha.digest(), hashlib.sha256(data[200:300]).digest())
+
+    def test_bad_fill(self):
+        data = bytearray(64)
+        data[40] = 1
+        sha = hashlib.sha256()
+        self.assertRaises(VerifyError, image._hash_range, io.BytesIO(bytes(data)),
+                          sha, 0, 64, [(32, 16, 0x00)])
+
+    def test_truncated(self):
+        sha = hashlib.sha256()
+        self.assertRaises(VerifyError, image._hash_range, io.BytesIO(bytes(64)),
+                          sha, 0, 128, [])
+
+class EstimateInstall(unittest.TestCase):
+
+    def test_layout(self):
+        """20 KiB into 128 KiB slots of 4 KiB sectors, with a write size of
+        1, for which the swap trailer takes 416 bytes."""
+        est = estimate_install(0x5000, 0x20000, 0x1000)
+        self.assertEqual(est['swap'], {
+            'fits': True,
+            'problems': [],
+            'sectors': 5,
+            'erases': 5 * 3 + 2,
+            'program': 5 * 3 * 0x1000,
+            'read': 0x5000 + 5 * 3 * 0x1000,
+            'status_writes': 5 * 3,
+        })
+        self.assertEqual(est['overwrite'], {
+            'fits': True,
+            'problems': [],
+            'sectors': 32,
+            'erases': 32 + 2,
+            'program': 21 * image.BOOT_COPY_BUF_SIZE,
+            'read': 0x5000 + 0x20000,
+            'status_writes': 0,
+        })
+
+    def test_scratch(self):
+        """A scratch area of two sectors halves the status writes."""
+        est = estimate_install(0x5000, 0x20000, 0x1000, scratch_size=0x2000)
+        self.assertEqual(est['swap']['status_writes'], 3 * 3)
+        est = estimate_install(0x5000, 0x20000, 0x1000, scratch_size=0x800)
+        self.assertFalse(est['swap']['fits'])
+
+    def test_too_large(self):
+        """An image leaving no room for the trailer does not fit."""
+        est = estimate_install(0x20000 - 0x100, 0x20000, 0x1000)
+        self.assertFalse(est['swap']['fits'])
+        self.assertTrue(est['overwrite']['fits'])
+        est = estimate_install(0x20000, 0x20000, 0x1000)
+        self.assertFalse(est['overwrite']['fits'])
+
+    def test_sectors(self):
+        est = estimate_install(0x5000, 0x20000, 0x1000, max_sectors=16)
+        self.assertFalse(est['swap']['fits'])
+        self.assertFalse(est['overwrite']['fits'])
+        est = estimate_install(0x5000, 0x20800, 0x1000)
+        self.assertIn("slot size is not a multiple of the sector size",
+                      est['swap']['problems'])
+
+if __name__ == '__main__':
+    unittest.main()
@@ -5,6 +5,7 @@ ECDSA key management
 from cryptography.hazmat.backends import default_backend
 from cryptography.hazmat.primitives import serialization
 from cryptography.hazmat.primitives.asymmetric import ec
+from cryptography.hazmat.primitives.asymmetric.utils import Prehashed
 from cryptography.hazmat.primitives.hashes import SHA256
 
 from .general import KeyClass
@@ -57,6 +58,19 @@ class ECDSA256P1Public(KeyClass):
         # signature.
         return 72
 
+    def verify_digest(self, signature, digest):
+        """Check a signature made by sign(), given the SHA256 digest of the
+        payload, as the bootloader does.  Raises InvalidSignature from
+        cryptography if it does not match."""
+        # Leave out the zero padding added by sign(), using the length of
+        # the DER sequence.
+        if len(signature) >= 2:
+            signature = signature[:2 + signature[1]]
+        self._get_public().verify(
+                signature=signature,
+                data=digest,
+                signature_algorithm=ec.ECDSA(Prehashed(SHA256())))
+
 class ECDSA256P1(ECDSA256P1Public):
     """
     Wrapper around an ECDSA private key.
@@ -2,6 +2,7 @@
 Tests for ECDSA keys
 """
 
+import hashlib
 import io
 import os.path
 import sys
@@ -95,5 +96,21 @@ class EcKeyGeneration(unittest.TestCase):
                 data=b'This is thE message',
                 signature_algorithm=ec.ECDSA(SHA256()))
 
+    def test_verify_digest(self):
+        k = ECDSA256P1.generate()
+        buf = b'This is the message'
+        sig = k.sign(buf)
+
+        # The public key checks the signature against the hash, as the
+        # bootloader does.
+        pubname = self.tname("public.pem")
+        k.export_public(pubname)
+        pk = load(pubname)
+        pk.verify_digest(sig, hashlib.sha256(buf).digest())
+
+        self.assertRaises(InvalidSignature,
+                pk.verify_digest, sig,
+                hashlib.sha256(b'This is thE message').digest())
+
 if __name__ == '__main__':
     unittest.main()
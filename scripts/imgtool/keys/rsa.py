@@ -5,6 +5,7 @@ RSA Key management
 from cryptography.hazmat.backends import default_backend
 from cryptography.hazmat.primitives import serialization
 from cryptography.hazmat.primitives.asymmetric import rsa
+from cryptography.hazmat.primitives.asymmetric.utils import Prehashed
 from cryptography.hazmat.primitives.asymmetric.padding import PSS, MGF1
 from cryptography.hazmat.primitives.hashes import SHA256
 
@@ -53,6 +54,16 @@ class RSA2048Public(KeyClass):
     def sig_len(self):
         return 256
 
+    def verify_digest(self, signature, digest):
+        """Check a signature made by sign(), given the SHA256 digest of the
+        payload, as the bootloader does.  Raises InvalidSignature from
+        cryptography if it does not match."""
+        self._get_public().verify(
+                signature=signature,
+                data=digest,
+                padding=PSS(mgf=MGF1(SHA256()), salt_length=32),
+                algorithm=Prehashed(SHA256()))
+
 class RSA2048(RSA2048Public):
     """
     Wrapper around an 2048-bit RSA key, with imgtool support.
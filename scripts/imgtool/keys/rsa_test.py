@@ -2,6 +2,7 @@
 Tests for RSA keys
 """
 
+import hashlib
 import io
 import os
 import sys
@@ -98,5 +99,21 @@ class KeyGeneration(unittest.TestCase):
                 padding=PSS(mgf=MGF1(SHA256()), salt_length=32),
                 algorithm=SHA256())
 
+    def test_verify_digest(self):
+        k = RSA2048.generate()
+        buf = b'This is the message'
+        sig = k.sign(buf)
+
+        # The public key checks the signature against the hash, as the
+        # bootloader does.
+        pubname = self.tname("public.pem")
+        k.export_public(pubname)
+        pk = load(pubname)
+        pk.verify_digest(sig, hashlib.sha256(buf).digest())
+
+        self.assertRaises(InvalidSignature,
+                pk.verify_digest, sig,
+                hashlib.sha256(b'This is thE message').digest())
+
 if __name__ == '__main__':
     unittest.main()
@@ -120,8 +120,38 @@ class BasedIntParamType(click.ParamType):
             self.fail('%s is not a valid integer' % value, param, ctx)
 
 
+def validate_reloc(ctx, param, value):
+    relocs = []
+    for v in value:
+        try:
+            addr, count, dst = (int(f, 0) for f in v.split(':'))
+        except ValueError:
+            raise click.BadParameter(
+                "{} is not of the form addr:count:dst".format(v))
+        if count <= 0 or count > 0xffff:
+            raise click.BadParameter("Invalid word count in {}".format(v))
+        relocs.append((addr, count, dst))
+    return relocs
+
+
 @click.argument('outfile')
 @click.argument('infile')
+@click.option('--reloc', multiple=True, callback=validate_reloc,
+              metavar='addr:count:dst',
+              help='Make the image position-independent, with a table of '
+                   'count words at link address addr copied to RAM at dst '
+                   'by the boot loader and fixed up for the slot it runs '
+                   'from.  May be repeated')
+@click.option('--pic-base', type=BasedIntParamType(), metavar='addr',
+              help='Link address of the input file, for --reloc; defaults '
+                   'to the base address of a hex input')
+@click.option('--prefix-size', type=BasedIntParamType(), metavar='size',
+              help='Hash the first size bytes of the image body separately '
+                   'from the rest, so that a boot loader with deferred '
+                   'validation only checks them on every boot')
+@click.option('--sparse', type=BasedIntParamType(), metavar='size',
+              help='Declare runs of at least this many 0x00 or 0xff bytes as '
+                   'fill ranges, left out of the image hash')
 @click.option('-E', '--encrypt', metavar='filename',
               help='Encrypt image using the provided public key')
 @click.option('-e', '--endian', type=click.Choice(['little', 'big']),
@@ -146,11 +176,14 @@ class BasedIntParamType(click.ParamType):
                INFILE and OUTFILE are parsed as Intel HEX if the params have
                .hex extension, othewise binary format is used''')
 def sign(key, align, version, header_size, pad_header, slot_size, pad,
-         max_sectors, overwrite_only, endian, encrypt, infile, outfile):
+         max_sectors, overwrite_only, endian, encrypt, sparse, prefix_size,
+         pic_base, reloc, infile, outfile):
     img = image.Image(version=decode_version(version), header_size=header_size,
                       pad_header=pad_header, pad=pad, align=int(align),
                       slot_size=slot_size, max_sectors=max_sectors,
-                      overwrite_only=overwrite_only, endian=endian)
+                      overwrite_only=overwrite_only, endian=endian,
+                      sparse=sparse, pic_base=pic_base, relocs=reloc,
+                      prefix_size=prefix_size)
     img.load(infile)
     key = load_key(key) if key else None
     enckey = load_key(encrypt) if encrypt else None
@@ -163,6 +196,63 @@ def sign(key, align, version, header_size, pad_header, slot_size, pad,
     img.save(outfile)
 
 
+def print_estimate(name, est):
+    print("{}: {}".format(name, "fits" if est['fits'] else
+                          "does not fit, " + "; ".join(est['problems'])))
+    print("    sectors touched:  {}".format(est['sectors']))
+    print("    sector erases:    {}".format(est['erases']))
+    print("    bytes programmed: at most 0x{:x}".format(est['program']))
+    if est['status_writes']:
+        print("    status writes:    {}".format(est['status_writes']))
+    print("    bytes read:       0x{:x}".format(est['read']))
+
+
+@click.argument('imgfile')
+@click.option('--scratch-size', type=BasedIntParamType(),
+              help='Size of the scratch area (defaults to --sector-size)')
+@click.option('--sector-size', type=BasedIntParamType(),
+              help='Size of the sectors of both slots; with --slot-size, '
+                   'estimates the cost of installing the image')
+@click.option('-M', '--max-sectors', type=int,
+              help='Number of sectors the trailer allows for (defaults to 128)')
+@click.option('-S', '--slot-size', type=BasedIntParamType(),
+              help='Size of the slot where the image will be written')
+@click.option('--align', type=click.Choice(['1', '2', '4', '8']), default='1',
+              help='Flash alignment, for the trailer size')
+@click.option('-e', '--endian', type=click.Choice(['little', 'big']),
+              default='little', help="Select little or big endian")
+@click.option('-k', '--key', metavar='filename',
+              help='Public or private key the image must be signed with')
+@click.command(help='''Check a signed image as the bootloader would\n
+               IMGFILE is parsed as Intel HEX if it has a .hex extension,
+               otherwise binary format is used''')
+def verify(key, endian, align, slot_size, max_sectors, sector_size,
+           scratch_size, imgfile):
+    key = load_key(key) if key else None
+    try:
+        info = image.verify(imgfile, key, endian=endian)
+    except image.VerifyError as e:
+        raise click.ClickException(str(e))
+    print("Image version {}.{}.{}+{}, header 0x{:x}, body 0x{:x}, "
+          "total 0x{:x} bytes".format(*info['version'], info['header_size'],
+                                      info['image_size'], info['size']))
+    print("Hash OK: {}".format(info['hash'].hex()))
+    if info['split'] is not None:
+        print("Hash split at 0x{:x}".format(info['split']))
+    if key is not None:
+        print("Signature OK")
+    else:
+        print("Signature not checked, no key given")
+
+    if slot_size is None or sector_size is None:
+        return
+    est = image.estimate_install(info['size'], slot_size, sector_size,
+                                 scratch_size=scratch_size, align=int(align),
+                                 max_sectors=max_sectors)
+    print_estimate("Swap upgrade", est['swap'])
+    print_estimate("Overwrite upgrade", est['overwrite'])
+
+
 class AliasesGroup(click.Group):
 
     _aliases = {
@@ -192,6 +282,7 @@ def imgtool():
 imgtool.add_command(keygen)
 imgtool.add_command(getpub)
 imgtool.add_command(sign)
+imgtool.add_command(verify)
 
 
 if __name__ == '__main__':
@@ -17,7 +17,7 @@ pushd sim
 EXIT_CODE=0
 
 if [[ ! -z $SINGLE_FEATURES ]]; then
-  all_features="sig-rsa sig-ecdsa overwrite-only validate-slot0 enc-rsa enc-kw boostrap"
+  all_features="sig-rsa sig-ecdsa overwrite-only validate-slot0 enc-rsa enc-kw boostrap sparse-images bank-swap boot-token status-bit-clear pic-images verify-writes overlap-copy ec256-no-asn1 deferred-validation"
 
   if [[ $SINGLE_FEATURES =~ "none" ]]; then
     echo "Running cargo with no features"
@@ -16,6 +16,15 @@ fn main() {
     let enc_rsa = env::var("CARGO_FEATURE_ENC_RSA").is_ok();
     let enc_kw = env::var("CARGO_FEATURE_ENC_KW").is_ok();
     let bootstrap = env::var("CARGO_FEATURE_BOOTSTRAP").is_ok();
+    let sparse_images = env::var("CARGO_FEATURE_SPARSE_IMAGES").is_ok();
+    let bank_swap = env::var("CARGO_FEATURE_BANK_SWAP").is_ok();
+    let boot_token = env::var("CARGO_FEATURE_BOOT_TOKEN").is_ok();
+    let status_bit_clear = env::var("CARGO_FEATURE_STATUS_BIT_CLEAR").is_ok();
+    let pic_images = env::var("CARGO_FEATURE_PIC_IMAGES").is_ok();
+    let verify_writes = env::var("CARGO_FEATURE_VERIFY_WRITES").is_ok();
+    let overlap_copy = env::var("CARGO_FEATURE_OVERLAP_COPY").is_ok();
+    let ec256_no_asn1 = env::var("CARGO_FEATURE_EC256_NO_ASN1").is_ok();
+    let deferred_validation = env::var("CARGO_FEATURE_DEFERRED_VALIDATION").is_ok();
 
     let mut conf = cc::Build::new();
     conf.define("__BOOTSIM__", None);
@@ -32,6 +41,38 @@ fn main() {
         conf.define("MCUBOOT_VALIDATE_SLOT0", None);
     }
 
+    if sparse_images {
+        conf.define("MCUBOOT_SPARSE_IMAGES", None);
+    }
+
+    if bank_swap {
+        conf.define("MCUBOOT_BANK_SWAP", None);
+    }
+
+    if boot_token {
+        conf.define("MCUBOOT_BOOT_TOKEN", None);
+    }
+
+    if status_bit_clear {
+        conf.define("MCUBOOT_STATUS_BIT_CLEAR", None);
+    }
+
+    if pic_images {
+        conf.define("MCUBOOT_PIC_IMAGES", None);
+    }
+
+    if verify_writes {
+        conf.define("MCUBOOT_VERIFY_WRITES", None);
+    }
+
+    if overlap_copy {
+        conf.define("MCUBOOT_OVERLAP_COPY", None);
+    }
+
+    if deferred_validation {
+        conf.define("MCUBOOT_DEFERRED_VALIDATION", None);
+    }
+
     // Currently, mbed TLS cannot build with both RSA and ECDSA.
     if sig_rsa && sig_ecdsa {
         panic!("mcuboot does not support RSA and ECDSA at the same time");
@@ -67,8 +108,12 @@ fn main() {
         conf.file("../../ext/tinycrypt/lib/source/ecc_dsa.c");
         conf.file("../../ext/tinycrypt/lib/source/ecc_platform_specific.c");
 
-        conf.file("../../ext/mbedtls/src/platform_util.c");
-        conf.file("../../ext/mbedtls/src/asn1parse.c");
+        if ec256_no_asn1 {
+            conf.define("MCUBOOT_EC256_NO_ASN1", None);
+        } else {
+            conf.file("../../ext/mbedtls/src/platform_util.c");
+            conf.file("../../ext/mbedtls/src/asn1parse.c");
+        }
     } else {
         // Neither signature type, only verify sha256. The default
         // configuration file bundled with mbedTLS is sufficient.
@@ -154,6 +199,8 @@ fn main() {
     }
     conf.file("../../boot/bootutil/src/loader.c");
     conf.file("../../boot/bootutil/src/caps.c");
+    conf.file("../../boot/bootutil/src/boot_token.c");
+    conf.file("../../boot/bootutil/src/image_reloc.c");
     conf.file("../../boot/bootutil/src/bootutil_misc.c");
     conf.file("csupport/run.c");
     conf.include("../../boot/bootutil/include");
@@ -138,6 +138,55 @@ uint8_t flash_area_erased_val(const struct flash_area *);
 int flash_area_read_is_empty(const struct flash_area *fa, uint32_t off,
         void *dst, uint32_t len);
 
+/*
+ * Dual-bank flash support, only used when MCUBOOT_BANK_SWAP is defined.
+ *
+ * Some devices place the two image slots in separate flash banks, and can
+ * exchange which bank is seen at each slot's address (e.g. through an option
+ * bit), so that an upgrade needs no copy.
+ *
+ * flash_area_can_bank_swap() returns 1 if the banks backing the two areas
+ * can be exchanged, and 0 otherwise.
+ *
+ * flash_area_bank_swap() exchanges them, so that each area then reads what
+ * the other one held.  This must be atomic, and must persist across resets.
+ * Returns 0 on success, or an error code on failure.
+ */
+int flash_area_can_bank_swap(const struct flash_area *fa0,
+        const struct flash_area *fa1);
+int flash_area_bank_swap(const struct flash_area *fa0,
+        const struct flash_area *fa1);
+
+/*
+ * Multi-pass programming, only used when MCUBOOT_STATUS_BIT_CLEAR is defined.
+ *
+ * flash_area_can_reprogram() returns 1 if a word already programmed in the
+ * area may be programmed again, as long as bits only move further away from
+ * the erased value (e.g. from 1 to 0 on NOR flash), and 0 otherwise.
+ */
+int flash_area_can_reprogram(const struct flash_area *fap);
+
+/*
+ * Non-blocking programming, only used when MCUBOOT_OVERLAP_COPY is defined.
+ *
+ * flash_area_erase_start() and flash_area_write_start() do what
+ * flash_area_erase() and flash_area_write() do, but may return while the
+ * device is still busy with the operation.  The data passed to
+ * flash_area_write_start() must be left unchanged until it completes.  Any
+ * erase or write started on a busy device first waits for the operation in
+ * progress; reads may be done meanwhile, although they may stall on devices
+ * which cannot read while busy.
+ *
+ * flash_area_poll() returns 1 while an operation started on the device
+ * holding the area is in progress, 0 once it completed, and a negative value
+ * if it failed.  Backends with blocking operations only may always return 0.
+ */
+int flash_area_erase_start(const struct flash_area *fap, uint32_t off,
+        uint32_t len);
+int flash_area_write_start(const struct flash_area *fap, uint32_t off,
+        const void *src, uint32_t len);
+int flash_area_poll(const struct flash_area *fap);
+
 /*
  * Given flash area ID, return info about sectors within the area.
  */
@@ -24,6 +24,9 @@
 
 #define BOOT_LOG_LEVEL BOOT_LOG_LEVEL_ERROR
 #include <bootutil/bootutil_log.h>
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+#include <bootutil/deferred.h>
+#endif
 
 extern int sim_flash_erase(uint8_t flash_id, uint32_t offset, uint32_t size);
 extern int sim_flash_read(uint8_t flash_id, uint32_t offset, uint8_t *dest,
@@ -32,6 +35,15 @@ extern int sim_flash_write(uint8_t flash_id, uint32_t offset, const uint8_t *src
         uint32_t size);
 extern uint8_t sim_flash_align(uint8_t flash_id);
 extern uint8_t sim_flash_erased_val(uint8_t flash_id);
+extern int sim_flash_has_banks(uint8_t flash_id, uint32_t bank0, uint32_t bank1,
+        uint32_t size);
+extern int sim_flash_swap_banks(uint8_t flash_id);
+extern int sim_flash_multi_pass(uint8_t flash_id, uint32_t off, uint32_t len);
+extern int sim_flash_erase_start(uint8_t flash_id, uint32_t offset,
+        uint32_t size);
+extern int sim_flash_write_start(uint8_t flash_id, uint32_t offset,
+        const uint8_t *src, uint32_t size);
+extern int sim_flash_poll(uint8_t flash_id);
 
 static jmp_buf boot_jmpbuf;
 int flash_counter;
@@ -40,6 +52,18 @@ int jumped = 0;
 uint8_t c_asserts = 0;
 uint8_t c_catch_asserts = 0;
 
+uint32_t c_retained_ram[BOOT_TOKEN_RAM_SZ / sizeof(uint32_t)];
+
+void *boot_token_ram(void)
+{
+    return c_retained_ram;
+}
+
+/* The slot the last boot ran from, and the RAM PIC images are fixed up in. */
+#define PIC_RAM_ADDR 0x20000000
+uint8_t c_boot_slot;
+uint32_t c_pic_ram[256 / sizeof(uint32_t)];
+
 #ifdef MCUBOOT_ENCRYPT_RSA
 static int
 parse_pubkey(mbedtls_rsa_context *ctx, uint8_t **p, uint8_t *end)
@@ -225,6 +249,13 @@ int invoke_boot_go(struct area_desc *adesc)
     flash_areas = adesc;
     if (setjmp(boot_jmpbuf) == 0) {
         res = boot_go(&rsp);
+        if (res == 0) {
+            c_boot_slot = rsp.br_slot;
+#ifdef MCUBOOT_PIC_IMAGES
+            res = boot_pic_relocate(&rsp, rsp.br_image_off, c_pic_ram,
+                                    PIC_RAM_ADDR, sizeof(c_pic_ram));
+#endif
+        }
         flash_areas = NULL;
         /* printf("boot_go off: %d (0x%08x)\n", res, rsp.br_image_off); */
         return res;
@@ -234,6 +265,88 @@ int invoke_boot_go(struct area_desc *adesc)
     }
 }
 
+int invoke_boot_set_pending(struct area_desc *adesc, int permanent)
+{
+    int res;
+
+    flash_areas = adesc;
+    res = boot_set_pending(permanent);
+    flash_areas = NULL;
+    return res;
+}
+
+int invoke_boot_set_pending_slot(struct area_desc *adesc, int slot,
+                                 int permanent)
+{
+    int res;
+
+    flash_areas = adesc;
+#ifdef MCUBOOT_PIC_IMAGES
+    res = boot_set_pending_slot(slot, permanent);
+#else
+    res = -1;
+    (void)slot;
+    (void)permanent;
+#endif
+    flash_areas = NULL;
+    return res;
+}
+
+int invoke_boot_set_confirmed_slot(struct area_desc *adesc, int slot)
+{
+    int res;
+
+    flash_areas = adesc;
+#ifdef MCUBOOT_PIC_IMAGES
+    res = boot_set_confirmed_slot(slot);
+#else
+    res = -1;
+    (void)slot;
+#endif
+    flash_areas = NULL;
+    return res;
+}
+
+int invoke_boot_deferred_check(struct area_desc *adesc, uint32_t max_bytes,
+                               int *steps)
+{
+    int res;
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+    struct boot_deferred_check chk;
+#endif
+
+    flash_areas = adesc;
+    *steps = 0;
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+    res = boot_deferred_check_start(&chk);
+    if (res == BOOT_DEFERRED_OK) {
+        do {
+            res = boot_deferred_check(&chk, max_bytes);
+            (*steps)++;
+        } while (res == BOOT_DEFERRED_MORE);
+    }
+#else
+    res = -1;
+    (void)max_bytes;
+#endif
+    flash_areas = NULL;
+    return res;
+}
+
+int invoke_boot_deferred_revert(struct area_desc *adesc)
+{
+    int res;
+
+    flash_areas = adesc;
+#ifdef MCUBOOT_DEFERRED_VALIDATION
+    res = boot_deferred_revert();
+#else
+    res = -1;
+#endif
+    flash_areas = NULL;
+    return res;
+}
+
 void *os_malloc(size_t size)
 {
     // printf("os_malloc 0x%x bytes\n", size);
@@ -302,6 +415,36 @@ int flash_area_erase(const struct flash_area *area, uint32_t off, uint32_t len)
     return sim_flash_erase(area->fa_device_id, area->fa_off + off, len);
 }
 
+int flash_area_write_start(const struct flash_area *area, uint32_t off,
+                           const void *src, uint32_t len)
+{
+    BOOT_LOG_DBG("%s: area=%d, off=%x, len=%x", __func__,
+                 area->fa_id, off, len);
+    if (--flash_counter == 0) {
+        jumped++;
+        longjmp(boot_jmpbuf, 1);
+    }
+    return sim_flash_write_start(area->fa_device_id, area->fa_off + off, src,
+                                 len);
+}
+
+int flash_area_erase_start(const struct flash_area *area, uint32_t off,
+                           uint32_t len)
+{
+    BOOT_LOG_DBG("%s: area=%d, off=%x, len=%x", __func__,
+                 area->fa_id, off, len);
+    if (--flash_counter == 0) {
+        jumped++;
+        longjmp(boot_jmpbuf, 1);
+    }
+    return sim_flash_erase_start(area->fa_device_id, area->fa_off + off, len);
+}
+
+int flash_area_poll(const struct flash_area *area)
+{
+    return sim_flash_poll(area->fa_device_id);
+}
+
 int flash_area_read_is_empty(const struct flash_area *area, uint32_t off,
         void *dst, uint32_t len)
 {
@@ -325,6 +468,36 @@ int flash_area_read_is_empty(const struct flash_area *area, uint32_t off,
     return 1;
 }
 
+int flash_area_can_reprogram(const struct flash_area *fap)
+{
+    return sim_flash_multi_pass(fap->fa_device_id, fap->fa_off, fap->fa_size);
+}
+
+int flash_area_can_bank_swap(const struct flash_area *fa0,
+        const struct flash_area *fa1)
+{
+    if (fa0->fa_device_id != fa1->fa_device_id ||
+            fa0->fa_size != fa1->fa_size) {
+        return 0;
+    }
+    return sim_flash_has_banks(fa0->fa_device_id, fa0->fa_off, fa1->fa_off,
+            fa0->fa_size);
+}
+
+int flash_area_bank_swap(const struct flash_area *fa0,
+        const struct flash_area *fa1)
+{
+    BOOT_LOG_DBG("%s: areas=%d,%d", __func__, fa0->fa_id, fa1->fa_id);
+    if (!flash_area_can_bank_swap(fa0, fa1)) {
+        return -1;
+    }
+    if (--flash_counter == 0) {
+        jumped++;
+        longjmp(boot_jmpbuf, 1);
+    }
+    return sim_flash_swap_banks(fa0->fa_device_id);
+}
+
 int flash_area_to_sectors(int idx, int *cnt, struct flash_area *ret)
 {
     uint32_t i;
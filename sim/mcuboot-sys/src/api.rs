@@ -1,6 +1,6 @@
 //! HAL api for MyNewt applications
 
-use simflash::{Result, Flash, FlashPtr};
+use simflash::{Delta, Result, Flash, FlashPtr};
 use lazy_static::lazy_static;
 use libc;
 use log::{Level, log_enabled, warn};
@@ -32,6 +32,84 @@ lazy_static! {
     };
 }
 
+/// The changes made by each flash operation, in order, along with the device they were made to.
+pub type Journal = Vec<(u8, Delta)>;
+
+lazy_static! {
+    static ref JOURNAL: Mutex<Option<Journal>> = Mutex::new(None);
+}
+
+/// Start recording the changes made by every erase, write and bank swap.
+pub fn start_journal() {
+    *JOURNAL.lock().unwrap() = Some(Vec::new());
+}
+
+/// Stop recording, and return what was recorded.
+pub fn take_journal() -> Journal {
+    JOURNAL.lock().unwrap().take().unwrap_or_default()
+}
+
+/// The flash operations issued by the C code, with the bytes they cover.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct FlashOps {
+    pub reads: u64,
+    pub read_bytes: u64,
+    pub writes: u64,
+    pub write_bytes: u64,
+    pub erases: u64,
+    pub erase_bytes: u64,
+    pub bank_swaps: u64,
+}
+
+lazy_static! {
+    static ref FLASH_OPS: Mutex<FlashOps> = Mutex::new(FlashOps::default());
+}
+
+/// Return the operations counted so far, and start counting from zero.
+pub fn take_flash_ops() -> FlashOps {
+    mem::replace(&mut *FLASH_OPS.lock().unwrap(), FlashOps::default())
+}
+
+fn count<F: FnOnce(&mut FlashOps)>(f: F) {
+    f(&mut *FLASH_OPS.lock().unwrap());
+}
+
+fn record(dev_id: u8, dev: &dyn Flash, offset: u32, size: u32) {
+    if let Some(ref mut journal) = *JOURNAL.lock().unwrap() {
+        journal.push((dev_id, dev.delta(offset as usize, size as usize)));
+    }
+}
+
+/// A write started on a device, with the source buffer the C code passed, and a copy of what it
+/// held then.  The device may keep reading the buffer until the write completes.
+struct PendingWrite {
+    src: usize,
+    offset: u32,
+    payload: Vec<u8>,
+}
+
+lazy_static! {
+    static ref PENDING: Mutex<HashMap<u8, PendingWrite>> = Mutex::new(HashMap::new());
+}
+
+// Complete the write in progress on the device, if any, checking that its source buffer was left
+// alone until then.  With `check` unset, the buffer may be gone, as after a simulated power
+// failure.
+fn finish_write(dev_id: u8, dev: &mut dyn Flash, check: bool) {
+    let write = match PENDING.lock().unwrap().remove(&dev_id) {
+        Some(write) => write,
+        None => return,
+    };
+    if check {
+        let src = unsafe { slice::from_raw_parts(write.src as *const u8, write.payload.len()) };
+        if src != &write.payload[..] {
+            panic!("Source of the write to 0x{:x} changed before it completed", write.offset);
+        }
+    }
+    dev.poll();
+    record(dev_id, dev, write.offset, write.payload.len() as u32);
+}
+
 // Set the flash device to be used by the simulation.  The pointer is unsafely stashed away.
 pub unsafe fn set_flash(dev_id: u8, dev: &mut dyn Flash) {
     let mut flash_params = FLASH_PARAMS.lock().unwrap();
@@ -47,7 +125,9 @@ pub unsafe fn set_flash(dev_id: u8, dev: &mut dyn Flash) {
 
 pub unsafe fn clear_flash(dev_id: u8) {
     let mut flash = FLASH.lock().unwrap();
-    flash.remove(&dev_id);
+    if let Some(flash) = flash.remove(&dev_id) {
+        finish_write(dev_id, &mut *flash.ptr, false);
+    }
 }
 
 // This isn't meant to call directly, but by a wrapper.
@@ -57,7 +137,11 @@ pub extern fn sim_flash_erase(dev_id: u8, offset: u32, size: u32) -> libc::c_int
     if let Ok(guard) = FLASH.lock() {
         if let Some(flash) = guard.deref().get(&dev_id) {
             let dev = unsafe { &mut *(flash.ptr) };
-            return map_err(dev.erase(offset as usize, size as usize));
+            finish_write(dev_id, dev, true);
+            let rc = map_err(dev.erase(offset as usize, size as usize));
+            count(|ops| { ops.erases += 1; ops.erase_bytes += size as u64; });
+            record(dev_id, dev, offset, size);
+            return rc;
         }
     }
     -19
@@ -69,6 +153,7 @@ pub extern fn sim_flash_read(dev_id: u8, offset: u32, dest: *mut u8, size: u32)
         if let Some(flash) = guard.deref().get(&dev_id) {
             let mut buf: &mut[u8] = unsafe { slice::from_raw_parts_mut(dest, size as usize) };
             let dev = unsafe { &mut *(flash.ptr) };
+            count(|ops| { ops.reads += 1; ops.read_bytes += size as u64; });
             return map_err(dev.read(offset as usize, &mut buf));
         }
     }
@@ -81,7 +166,64 @@ pub extern fn sim_flash_write(dev_id: u8, offset: u32, src: *const u8, size: u32
         if let Some(flash) = guard.deref().get(&dev_id) {
             let buf: &[u8] = unsafe { slice::from_raw_parts(src, size as usize) };
             let dev = unsafe { &mut *(flash.ptr) };
-            return map_err(dev.write(offset as usize, &buf));
+            finish_write(dev_id, dev, true);
+            let rc = map_err(dev.write(offset as usize, &buf));
+            count(|ops| { ops.writes += 1; ops.write_bytes += size as u64; });
+            record(dev_id, dev, offset, size);
+            return rc;
+        }
+    }
+    -19
+}
+
+#[no_mangle]
+pub extern fn sim_flash_erase_start(dev_id: u8, offset: u32, size: u32) -> libc::c_int {
+    if let Ok(guard) = FLASH.lock() {
+        if let Some(flash) = guard.deref().get(&dev_id) {
+            let dev = unsafe { &mut *(flash.ptr) };
+            finish_write(dev_id, dev, true);
+            let rc = map_err(dev.start_erase(offset as usize, size as usize));
+            count(|ops| { ops.erases += 1; ops.erase_bytes += size as u64; });
+            record(dev_id, dev, offset, size);
+            return rc;
+        }
+    }
+    -19
+}
+
+#[no_mangle]
+pub extern fn sim_flash_write_start(dev_id: u8, offset: u32, src: *const u8,
+                                    size: u32) -> libc::c_int {
+    if let Ok(guard) = FLASH.lock() {
+        if let Some(flash) = guard.deref().get(&dev_id) {
+            let buf: &[u8] = unsafe { slice::from_raw_parts(src, size as usize) };
+            let dev = unsafe { &mut *(flash.ptr) };
+            finish_write(dev_id, dev, true);
+            let rc = map_err(dev.start_write(offset as usize, &buf));
+            count(|ops| { ops.writes += 1; ops.write_bytes += size as u64; });
+            if rc == 0 {
+                PENDING.lock().unwrap().insert(dev_id, PendingWrite {
+                    src: src as usize,
+                    offset: offset,
+                    payload: buf.to_vec(),
+                });
+            } else {
+                record(dev_id, dev, offset, size);
+            }
+            return rc;
+        }
+    }
+    -19
+}
+
+#[no_mangle]
+pub extern fn sim_flash_poll(dev_id: u8) -> libc::c_int {
+    if let Ok(guard) = FLASH.lock() {
+        if let Some(flash) = guard.deref().get(&dev_id) {
+            let dev = unsafe { &mut *(flash.ptr) };
+            let busy = dev.poll();
+            finish_write(dev_id, dev, true);
+            return if busy { 1 } else { 0 };
         }
     }
     -19
@@ -101,6 +243,44 @@ pub extern fn sim_flash_erased_val(id: u8) -> u8 {
     params.erased_val
 }
 
+#[no_mangle]
+pub extern fn sim_flash_has_banks(dev_id: u8, bank0: u32, bank1: u32, size: u32) -> libc::c_int {
+    if let Ok(guard) = FLASH.lock() {
+        if let Some(flash) = guard.deref().get(&dev_id) {
+            let dev = unsafe { &*(flash.ptr) };
+            let banks = Some((bank0 as usize, bank1 as usize, size as usize));
+            return if dev.banks() == banks { 1 } else { 0 };
+        }
+    }
+    0
+}
+
+#[no_mangle]
+pub extern fn sim_flash_multi_pass(dev_id: u8, off: u32, len: u32) -> libc::c_int {
+    if let Ok(guard) = FLASH.lock() {
+        if let Some(flash) = guard.deref().get(&dev_id) {
+            let dev = unsafe { &*(flash.ptr) };
+            return if dev.multi_pass(off as usize, len as usize) { 1 } else { 0 };
+        }
+    }
+    0
+}
+
+#[no_mangle]
+pub extern fn sim_flash_swap_banks(dev_id: u8) -> libc::c_int {
+    if let Ok(guard) = FLASH.lock() {
+        if let Some(flash) = guard.deref().get(&dev_id) {
+            let dev = unsafe { &mut *(flash.ptr) };
+            finish_write(dev_id, dev, true);
+            let rc = map_err(dev.swap_banks());
+            count(|ops| ops.bank_swaps += 1);
+            record(dev_id, dev, 0, 0);
+            return rc;
+        }
+    }
+    -19
+}
+
 fn map_err(err: Result<()>) -> libc::c_int {
     match err {
         Ok(()) => 0,
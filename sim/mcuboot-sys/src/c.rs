@@ -1,10 +1,10 @@
 /// Interface wrappers to C API entering to the bootloader
 
-use crate::area::AreaDesc;
+use crate::area::{AreaDesc, CAreaDesc};
 use simflash::SimFlashMap;
 use lazy_static::lazy_static;
 use libc;
-use crate::api;
+use crate::api::{self, FlashOps, Journal};
 use std::sync::Mutex;
 
 lazy_static! {
@@ -13,12 +13,78 @@ lazy_static! {
     static ref BOOT_LOCK: Mutex<()> = Mutex::new(());
 }
 
-/// Invoke the bootloader on this flash device.
+/// Size of the RAM the bootloader may keep across warm resets.
+pub const RETAINED_RAM_SZ: usize = 128;
+
+/// Address and size of the RAM the tables of PIC images are relocated into.
+pub const PIC_RAM_ADDR: u32 = 0x20000000;
+pub const PIC_RAM_SZ: usize = 256;
+
+/// Invoke the bootloader on this flash device, after a cold reset.
 pub fn boot_go(flashmap: &mut SimFlashMap, areadesc: &AreaDesc,
                counter: Option<&mut i32>, catch_asserts: bool) -> (i32, u8) {
+    let mut ram = [0u8; RETAINED_RAM_SZ];
+    boot_go_retained(flashmap, areadesc, counter, catch_asserts, &mut ram)
+}
+
+/// Invoke the bootloader on this flash device, with `ram` holding the RAM retained across resets.
+/// Passing what a previous boot left there simulates a warm reset.
+pub fn boot_go_retained(flashmap: &mut SimFlashMap, areadesc: &AreaDesc,
+                        counter: Option<&mut i32>, catch_asserts: bool,
+                        ram: &mut [u8; RETAINED_RAM_SZ]) -> (i32, u8) {
+    let boot = boot_go_full(flashmap, areadesc, counter, catch_asserts, ram, false);
+    (boot.result, boot.asserts)
+}
+
+/// Invoke the bootloader after a cold reset, recording the state each flash operation leaves
+/// behind.  Applying the first `n` changes of the journal to a copy of the flash taken before the
+/// boot gives what the boot leaves when interrupted at operation `n + 1`.
+pub fn boot_go_journal(flashmap: &mut SimFlashMap, areadesc: &AreaDesc) -> (i32, Journal) {
+    let mut ram = [0u8; RETAINED_RAM_SZ];
+    let boot = boot_go_full(flashmap, areadesc, None, false, &mut ram, true);
+    (boot.result, boot.journal)
+}
+
+/// Invoke the bootloader after a cold reset, also returning the flash operations it issued.
+pub fn boot_go_counted(flashmap: &mut SimFlashMap, areadesc: &AreaDesc) -> (i32, FlashOps) {
+    let mut ram = [0u8; RETAINED_RAM_SZ];
+    let boot = boot_go_full(flashmap, areadesc, None, false, &mut ram, false);
+    (boot.result, boot.flash_ops)
+}
+
+/// Invoke the bootloader after a cold reset, returning the result, the slot the image runs from,
+/// and the contents of the RAM window PIC images are fixed up in.
+pub fn boot_go_pic(flashmap: &mut SimFlashMap, areadesc: &AreaDesc)
+                   -> (i32, u8, [u8; PIC_RAM_SZ]) {
+    let mut ram = [0u8; RETAINED_RAM_SZ];
+    let boot = boot_go_full(flashmap, areadesc, None, false, &mut ram, false);
+    (boot.result, boot.slot, boot.pic_ram)
+}
+
+/// Everything a boot leaves behind.
+struct BootOutcome {
+    result: i32,
+    asserts: u8,
+    slot: u8,
+    pic_ram: [u8; PIC_RAM_SZ],
+    journal: Journal,
+    flash_ops: FlashOps,
+}
+
+fn boot_go_full(flashmap: &mut SimFlashMap, areadesc: &AreaDesc,
+                counter: Option<&mut i32>, catch_asserts: bool,
+                ram: &mut [u8; RETAINED_RAM_SZ], journal: bool) -> BootOutcome {
     let _lock = BOOT_LOCK.lock().unwrap();
 
+    if journal {
+        api::start_journal();
+    }
+    api::take_flash_ops();
+
     unsafe {
+        raw::c_retained_ram = *ram;
+        raw::c_pic_ram = [0u8; PIC_RAM_SZ];
+        raw::c_boot_slot = 0;
         for (&dev_id, flash) in flashmap.iter_mut() {
             api::set_flash(dev_id, flash);
         }
@@ -30,14 +96,97 @@ pub fn boot_go(flashmap: &mut SimFlashMap, areadesc: &AreaDesc,
         };
     }
     let result = unsafe { raw::invoke_boot_go(&areadesc.get_c() as *const _) as i32 };
-    let asserts = unsafe { raw::c_asserts };
+    // A write still in progress completes before it shows up in the journal.
+    unsafe {
+        for (&dev_id, _) in flashmap.iter() {
+            api::clear_flash(dev_id);
+        }
+    }
+    let outcome = unsafe {
+        BootOutcome {
+            result: result,
+            asserts: raw::c_asserts,
+            slot: raw::c_boot_slot,
+            pic_ram: raw::c_pic_ram,
+            journal: api::take_journal(),
+            flash_ops: api::take_flash_ops(),
+        }
+    };
     unsafe {
         counter.map(|c| *c = raw::flash_counter as i32);
+        *ram = raw::c_retained_ram;
+    };
+    outcome
+}
+
+/// Run `call` the way an application would, with `ram` holding the RAM retained across resets.
+fn app_call<F: FnOnce(&CAreaDesc) -> libc::c_int>(flashmap: &mut SimFlashMap, areadesc: &AreaDesc,
+                                                ram: &mut [u8; RETAINED_RAM_SZ], call: F) -> i32 {
+    let _lock = BOOT_LOCK.lock().unwrap();
+
+    unsafe {
+        for (&dev_id, flash) in flashmap.iter_mut() {
+            api::set_flash(dev_id, flash);
+        }
+        raw::c_retained_ram = *ram;
+        raw::flash_counter = 0;
+    }
+    let result = call(&areadesc.get_c()) as i32;
+    unsafe {
+        *ram = raw::c_retained_ram;
         for (&dev_id, _) in flashmap {
             api::clear_flash(dev_id);
         }
     };
-    (result, asserts)
+    result
+}
+
+/// Request an upgrade to slot 1 the way an application would, with `ram` holding the RAM retained
+/// across resets.
+pub fn boot_set_pending(flashmap: &mut SimFlashMap, areadesc: &AreaDesc, permanent: bool,
+                        ram: &mut [u8; RETAINED_RAM_SZ]) -> i32 {
+    app_call(flashmap, areadesc, ram, |c| unsafe {
+        raw::invoke_boot_set_pending(c as *const _, if permanent { 1 } else { 0 })
+    })
+}
+
+/// Set the PIC image in `slot` pending, as an application running in place would.
+pub fn boot_set_pending_slot(flashmap: &mut SimFlashMap, areadesc: &AreaDesc, slot: usize,
+                             permanent: bool) -> i32 {
+    let mut ram = [0u8; RETAINED_RAM_SZ];
+    app_call(flashmap, areadesc, &mut ram, |c| unsafe {
+        raw::invoke_boot_set_pending_slot(c as *const _, slot as libc::c_int,
+                                          if permanent { 1 } else { 0 })
+    })
+}
+
+/// Confirm the PIC image running in place from `slot`.
+pub fn boot_set_confirmed_slot(flashmap: &mut SimFlashMap, areadesc: &AreaDesc,
+                               slot: usize) -> i32 {
+    let mut ram = [0u8; RETAINED_RAM_SZ];
+    app_call(flashmap, areadesc, &mut ram, |c| unsafe {
+        raw::invoke_boot_set_confirmed_slot(c as *const _, slot as libc::c_int)
+    })
+}
+
+/// Check the part of the image in slot 0 that the bootloader left out, as an application would,
+/// reading at most `max_bytes` per call.  Returns the result and the number of calls made.
+pub fn boot_deferred_check(flashmap: &mut SimFlashMap, areadesc: &AreaDesc,
+                           max_bytes: u32) -> (i32, u32) {
+    let mut ram = [0u8; RETAINED_RAM_SZ];
+    let mut steps: libc::c_int = 0;
+    let result = app_call(flashmap, areadesc, &mut ram, |c| unsafe {
+        raw::invoke_boot_deferred_check(c as *const _, max_bytes, &mut steps)
+    });
+    (result, steps as u32)
+}
+
+/// Make the next boot go back to the previous image, after the deferred check failed.
+pub fn boot_deferred_revert(flashmap: &mut SimFlashMap, areadesc: &AreaDesc) -> i32 {
+    let mut ram = [0u8; RETAINED_RAM_SZ];
+    app_call(flashmap, areadesc, &mut ram, |c| unsafe {
+        raw::invoke_boot_deferred_revert(c as *const _)
+    })
 }
 
 pub fn boot_trailer_sz(align: u8) -> u32 {
@@ -83,9 +232,21 @@ mod raw {
         // be any way to get rid of this warning.  See https://github.com/rust-lang/rust/issues/34798
         // for information and tracking.
         pub fn invoke_boot_go(areadesc: *const CAreaDesc) -> libc::c_int;
+        pub fn invoke_boot_set_pending(areadesc: *const CAreaDesc,
+                                       permanent: libc::c_int) -> libc::c_int;
+        pub fn invoke_boot_set_pending_slot(areadesc: *const CAreaDesc, slot: libc::c_int,
+                                            permanent: libc::c_int) -> libc::c_int;
+        pub fn invoke_boot_set_confirmed_slot(areadesc: *const CAreaDesc,
+                                              slot: libc::c_int) -> libc::c_int;
+        pub fn invoke_boot_deferred_check(areadesc: *const CAreaDesc, max_bytes: u32,
+                                          steps: *mut libc::c_int) -> libc::c_int;
+        pub fn invoke_boot_deferred_revert(areadesc: *const CAreaDesc) -> libc::c_int;
         pub static mut flash_counter: libc::c_int;
         pub static mut c_asserts: u8;
         pub static mut c_catch_asserts: u8;
+        pub static mut c_retained_ram: [u8; super::RETAINED_RAM_SZ];
+        pub static mut c_boot_slot: u8;
+        pub static mut c_pic_ram: [u8; super::PIC_RAM_SZ];
 
         pub fn boot_slots_trailer_sz(min_write_sz: u8) -> u32;
 
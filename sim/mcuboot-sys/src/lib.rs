@@ -6,3 +6,4 @@ pub mod c;
 pub mod api;
 
 pub use crate::area::{AreaDesc, FlashId};
+pub use crate::api::{FlashOps, Journal};
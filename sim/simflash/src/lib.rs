@@ -13,6 +13,7 @@ use rand::{
     distributions::{IndependentSample, Range},
 };
 use std::{
+    cell::Cell,
     collections::HashMap,
     fs::File,
     io::Write,
@@ -48,7 +49,15 @@ pub trait Flash {
     fn write(&mut self, offset: usize, payload: &[u8]) -> Result<()>;
     fn read(&self, offset: usize, data: &mut [u8]) -> Result<()>;
 
+    // Like erase and write, but the device stays busy with the operation for a while.  A write is
+    // only programmed once it completes, when the device is next polled or given an operation.
+    fn start_erase(&mut self, offset: usize, len: usize) -> Result<()>;
+    fn start_write(&mut self, offset: usize, payload: &[u8]) -> Result<()>;
+    fn poll(&mut self) -> bool;
+    fn elapsed(&self) -> Elapsed;
+
     fn add_bad_region(&mut self, offset: usize, len: usize, rate: f32) -> Result<()>;
+    fn add_corrupt_region(&mut self, offset: usize, len: usize, count: usize);
     fn reset_bad_regions(&mut self);
 
     fn set_verify_writes(&mut self, enable: bool);
@@ -58,6 +67,15 @@ pub trait Flash {
 
     fn align(&self) -> usize;
     fn erased_val(&self) -> u8;
+
+    fn multi_pass(&self, offset: usize, len: usize) -> bool;
+    fn banks(&self) -> Option<(usize, usize, usize)>;
+    fn banks_swapped(&self) -> bool;
+    fn swap_banks(&mut self) -> Result<()>;
+
+    // Capture what the range at `offset` holds, after an operation on it, and put it back.
+    fn delta(&self, offset: usize, len: usize) -> Delta;
+    fn apply(&mut self, delta: &Delta);
 }
 
 fn ebounds<T: AsRef<str>>(message: T) -> ErrorKind {
@@ -74,6 +92,36 @@ fn esimulatedwrite<T: AsRef<str>>(message: T) -> ErrorKind {
     ErrorKind::SimulatedFail(message.as_ref().to_owned())
 }
 
+/// Time taken by the operations on a device, in nanoseconds per byte.  Reading also accounts for
+/// the CPU time spent on the data read, such as hashing or decrypting it.
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Timing {
+    pub read: u64,
+    pub program: u64,
+    pub erase: u64,
+}
+
+/// The virtual clock of a device, in nanoseconds.  `now` is the time elapsed, `cpu` the part of
+/// it spent reading, and `busy` the total time the device spent erasing and programming.  When
+/// nothing overlaps, `now` is the sum of the two.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct Elapsed {
+    pub now: u64,
+    pub cpu: u64,
+    pub busy: u64,
+}
+
+/// The state an erase, write or bank swap leaves behind: the contents of the range it touched,
+/// along with which locations are erased, and the bank mapping.  Applying, in order, the deltas
+/// recorded after each operation of a run to a copy of the device taken before the run gives the
+/// device as it was after any operation, without running the operations again.
+#[derive(Clone, Debug, PartialEq)]
+pub struct Delta {
+    // Physical offset, data and write_safe of each contiguous part of the range.
+    segments: Vec<(usize, Vec<u8>, Vec<bool>)>,
+    banks_swapped: bool,
+}
+
 /// An emulated flash device.  It is represented as a block of bytes, and a list of the sector
 /// mapings.
 #[derive(Clone)]
@@ -82,10 +130,24 @@ pub struct SimFlash {
     write_safe: Vec<bool>,
     sectors: Vec<usize>,
     bad_region: Vec<(usize, usize, f32)>,
+    // Regions where the given number of writes still to come store a flipped bit.
+    corrupt_region: Vec<(usize, usize, usize)>,
     // Alignment required for writes.
     align: usize,
     verify_writes: bool,
+    // Regions where written locations may be programmed again, moving bits away from the erased
+    // value.
+    multi_pass: Vec<(usize, usize)>,
     erased_val: u8,
+    // Offsets of two banks, and their size, whose mapping can be exchanged.
+    banks: Option<(usize, usize, usize)>,
+    banks_swapped: bool,
+    timing: Timing,
+    elapsed: Cell<Elapsed>,
+    // Time at which the operation in progress completes.
+    busy_until: u64,
+    // The offset and a copy of the payload of a write started but not programmed yet.
+    pending: Option<(usize, Vec<u8>)>,
 }
 
 impl SimFlash {
@@ -101,9 +163,130 @@ impl SimFlash {
             write_safe: vec![true; total],
             sectors: sectors,
             bad_region: Vec::new(),
+            corrupt_region: Vec::new(),
             align: align,
             verify_writes: true,
+            multi_pass: Vec::new(),
             erased_val: erased_val,
+            banks: None,
+            banks_swapped: false,
+            timing: Timing::default(),
+            elapsed: Cell::new(Elapsed::default()),
+            busy_until: 0,
+            pending: None,
+        }
+    }
+
+    /// Set how long operations take, and restart the virtual clock.  Time doesn't advance with the
+    /// default timing of zero.
+    pub fn set_timing(&mut self, timing: Timing) {
+        self.timing = timing;
+        self.elapsed.set(Elapsed::default());
+        self.busy_until = 0;
+    }
+
+    // Wait for the operation in progress, and start one taking `time`.
+    fn start_op(&mut self, time: u64) {
+        self.wait();
+        let mut elapsed = self.elapsed.get();
+        elapsed.busy += time;
+        self.busy_until = elapsed.now + time;
+        self.elapsed.set(elapsed);
+    }
+
+    // Wait for the operation in progress, programming the data of a write.
+    fn wait(&mut self) {
+        let mut elapsed = self.elapsed.get();
+        elapsed.now = elapsed.now.max(self.busy_until);
+        self.elapsed.set(elapsed);
+
+        if let Some((offset, payload)) = self.pending.take() {
+            self.program(offset, &payload);
+        }
+    }
+
+    // Store the data of a write, checked by `start_write` already.
+    fn program(&mut self, offset: usize, payload: &[u8]) {
+        let mut done = 0;
+        while done < payload.len() {
+            let (phys, plen) = self.bank_map(offset + done, payload.len() - done);
+
+            for i in 0 .. plen {
+                if self.verify_writes && !self.write_safe[phys + i] {
+                    let old = self.data[phys + i] ^ self.erased_val;
+                    let new = payload[done + i] ^ self.erased_val;
+                    if !self.is_multi_pass(offset + done + i) {
+                        panic!("Write to unerased location at 0x{:x}", offset + done + i);
+                    }
+                    if old & !new != 0 {
+                        panic!("Write restoring erased bits at 0x{:x}", offset + done + i);
+                    }
+                }
+                self.write_safe[phys + i] = false;
+            }
+
+            let sub = &mut self.data[phys .. phys + plen];
+            sub.copy_from_slice(&payload[done .. done + plen]);
+            done += plen;
+        }
+
+        let end = offset + payload.len();
+        let hit = self.corrupt_region.iter().position(|&(off, len, count)| {
+            count > 0 && offset.max(off) < end.min(off + len)
+        });
+        if let Some(i) = hit {
+            self.corrupt_region[i].2 -= 1;
+            let (phys, _) = self.bank_map(offset.max(self.corrupt_region[i].0), 1);
+            self.data[phys] ^= 1;
+        }
+    }
+
+    /// Allow written locations within the given region to be programmed again, as long as no bit
+    /// goes back to its erased value (e.g. only from 1 to 0 when erased to 0xff), as most NOR
+    /// flash does.  Writing again anywhere else still panics, so that only the data meant to be
+    /// programmed more than once is.
+    pub fn add_multi_pass_region(&mut self, offset: usize, len: usize) {
+        self.multi_pass.push((offset, len));
+    }
+
+    fn is_multi_pass(&self, offset: usize) -> bool {
+        self.multi_pass.iter().any(|&(off, len)| offset >= off && offset < off + len)
+    }
+
+    /// Make this a dual-bank device: the `size` bytes at `bank0` and at `bank1` are separate
+    /// banks, and `swap_banks` exchanges which one is seen at each of these addresses.  Both banks
+    /// must have the same sector layout.
+    pub fn set_banks(&mut self, bank0: usize, bank1: usize, size: usize) {
+        let layout = |base: usize| -> Vec<usize> {
+            self.sector_iter()
+                .filter(|s| s.base >= base && s.base < base + size)
+                .map(|s| s.size)
+                .collect()
+        };
+        assert!(bank0 + size <= bank1 || bank1 + size <= bank0);
+        assert_eq!(layout(bank0), layout(bank1));
+        self.banks = Some((bank0, bank1, size));
+        self.banks_swapped = false;
+    }
+
+    // Translate an address through the bank mapping.  Returns the physical address, and how many
+    // of the `len` bytes starting there are contiguous.
+    fn bank_map(&self, offset: usize, len: usize) -> (usize, usize) {
+        match self.banks {
+            Some((bank0, bank1, size)) if self.banks_swapped => {
+                for &(from, to) in &[(bank0, bank1), (bank1, bank0)] {
+                    if offset >= from && offset < from + size {
+                        return (offset - from + to, len.min(from + size - offset));
+                    }
+                }
+                for &base in &[bank0, bank1] {
+                    if offset < base && offset + len > base {
+                        return (offset, base - offset);
+                    }
+                }
+                (offset, len)
+            }
+            _ => (offset, len),
         }
     }
 
@@ -138,10 +321,22 @@ impl SimFlash {
 pub type SimFlashMap = HashMap<u8, SimFlash>;
 
 impl Flash for SimFlash {
+    fn erase(&mut self, offset: usize, len: usize) -> Result<()> {
+        self.start_erase(offset, len)?;
+        self.wait();
+        Ok(())
+    }
+
+    fn write(&mut self, offset: usize, payload: &[u8]) -> Result<()> {
+        self.start_write(offset, payload)?;
+        self.wait();
+        Ok(())
+    }
+
     /// The flash drivers tend to erase beyond the bounds of the given range.  Instead, we'll be
     /// strict, and make sure that the passed arguments are exactly at a sector boundary, otherwise
     /// return an error.
-    fn erase(&mut self, offset: usize, len: usize) -> Result<()> {
+    fn start_erase(&mut self, offset: usize, len: usize) -> Result<()> {
         let (_start, slen) = self.get_sector(offset).ok_or_else(|| ebounds("start"))?;
         let (end, elen) = self.get_sector(offset + len - 1).ok_or_else(|| ebounds("end"))?;
 
@@ -152,12 +347,22 @@ impl Flash for SimFlash {
             bail!(ebounds("end not at start of sector"));
         }
 
-        for x in &mut self.data[offset .. offset + len] {
-            *x = self.erased_val;
-        }
+        // A rejected erase never reaches the device, so it takes no time.
+        self.start_op(len as u64 * self.timing.erase);
+
+        let mut done = 0;
+        while done < len {
+            let (phys, plen) = self.bank_map(offset + done, len - done);
+
+            for x in &mut self.data[phys .. phys + plen] {
+                *x = self.erased_val;
+            }
+
+            for x in &mut self.write_safe[phys .. phys + plen] {
+                *x = true;
+            }
 
-        for x in &mut self.write_safe[offset .. offset + len] {
-            *x = true;
+            done += plen;
         }
 
         Ok(())
@@ -170,19 +375,13 @@ impl Flash for SimFlash {
     ///
     /// This emulates a flash device which starts out erased, with the
     /// added restriction that repeated writes to the same location
-    /// are disallowed, even if they would be safe to do.
-    fn write(&mut self, offset: usize, payload: &[u8]) -> Result<()> {
-        for &(off, len, rate) in &self.bad_region {
-            if offset >= off && (offset + payload.len()) <= (off + len) {
-                let mut rng = rand::thread_rng();
-                let between = Range::new(0., 1.);
-                if between.ind_sample(&mut rng) < rate {
-                    bail!(esimulatedwrite(
-                        format!("Ignoring write to {:#x}-{:#x}", off, off + len)));
-                }
-            }
-        }
-
+    /// are disallowed, even if they would be safe to do.  In multi-pass mode,
+    /// repeated writes are allowed as long as they don't move any bit back
+    /// to its erased value.
+    ///
+    /// The payload is copied, and only programmed once the write completes,
+    /// so reads in the meantime still return the old data.
+    fn start_write(&mut self, offset: usize, payload: &[u8]) -> Result<()> {
         if offset + payload.len() > self.data.len() {
             panic!("Write outside of device");
         }
@@ -196,15 +395,21 @@ impl Flash for SimFlash {
             panic!("Write length not multiple of alignment");
         }
 
-        for (i, x) in &mut self.write_safe[offset .. offset + payload.len()].iter_mut().enumerate() {
-            if self.verify_writes && !(*x) {
-                panic!("Write to unerased location at 0x{:x}", offset + i);
+        // A write to a bad region is still attempted, and takes its time.
+        self.start_op(payload.len() as u64 * self.timing.program);
+
+        for &(off, len, rate) in &self.bad_region {
+            if offset >= off && (offset + payload.len()) <= (off + len) {
+                let mut rng = rand::thread_rng();
+                let between = Range::new(0., 1.);
+                if between.ind_sample(&mut rng) < rate {
+                    bail!(esimulatedwrite(
+                        format!("Ignoring write to {:#x}-{:#x}", off, off + len)));
+                }
             }
-            *x = false;
         }
 
-        let sub = &mut self.data[offset .. offset + payload.len()];
-        sub.copy_from_slice(payload);
+        self.pending = Some((offset, payload.to_vec()));
         Ok(())
     }
 
@@ -214,11 +419,33 @@ impl Flash for SimFlash {
             bail!(ebounds("Read outside of device"));
         }
 
-        let sub = &self.data[offset .. offset + data.len()];
-        data.copy_from_slice(sub);
+        // Reading while the device is busy is allowed.
+        let mut elapsed = self.elapsed.get();
+        elapsed.now += data.len() as u64 * self.timing.read;
+        elapsed.cpu += data.len() as u64 * self.timing.read;
+        self.elapsed.set(elapsed);
+
+        let mut done = 0;
+        while done < data.len() {
+            let (phys, plen) = self.bank_map(offset + done, data.len() - done);
+            data[done .. done + plen].copy_from_slice(&self.data[phys .. phys + plen]);
+            done += plen;
+        }
         Ok(())
     }
 
+    /// Returns whether the last operation started is still in progress.  A poll finding the device
+    /// busy waits until it is done, as the caller spins in the meantime.
+    fn poll(&mut self) -> bool {
+        let busy = self.elapsed.get().now < self.busy_until;
+        self.wait();
+        busy
+    }
+
+    fn elapsed(&self) -> Elapsed {
+        self.elapsed.get()
+    }
+
     /// Adds a new flash bad region. Writes to this area fail with a chance
     /// given by `rate`.
     fn add_bad_region(&mut self, offset: usize, len: usize, rate: f32) -> Result<()> {
@@ -232,8 +459,16 @@ impl Flash for SimFlash {
         Ok(())
     }
 
+    /// Adds a region where the next `count` writes seem to succeed, but store the first byte
+    /// they program within the region with a bit flipped.
+    fn add_corrupt_region(&mut self, offset: usize, len: usize, count: usize) {
+        info!("Adding corrupt region {:#x}-{:#x}", offset, offset + len);
+        self.corrupt_region.push((offset, len, count));
+    }
+
     fn reset_bad_regions(&mut self) {
         self.bad_region.clear();
+        self.corrupt_region.clear();
     }
 
     fn set_verify_writes(&mut self, enable: bool) {
@@ -259,6 +494,55 @@ impl Flash for SimFlash {
     fn erased_val(&self) -> u8 {
         self.erased_val
     }
+
+    fn multi_pass(&self, offset: usize, len: usize) -> bool {
+        self.multi_pass.iter().any(|&(off, rlen)| offset < off + rlen && off < offset + len)
+    }
+
+    fn banks(&self) -> Option<(usize, usize, usize)> {
+        self.banks
+    }
+
+    fn banks_swapped(&self) -> bool {
+        self.banks_swapped
+    }
+
+    /// Exchange the banks, as an option bit selecting the bank mapped at the boot address would.
+    fn swap_banks(&mut self) -> Result<()> {
+        if self.banks.is_none() {
+            bail!(ewrite("Device has no banks to swap"));
+        }
+        self.wait();
+        self.banks_swapped = !self.banks_swapped;
+        Ok(())
+    }
+
+    /// A failed operation may have been given a range that is out of the device, only the part
+    /// inside is captured.
+    fn delta(&self, offset: usize, len: usize) -> Delta {
+        let len = len.min(self.data.len().saturating_sub(offset));
+        let mut segments = Vec::new();
+        let mut done = 0;
+        while done < len {
+            let (phys, plen) = self.bank_map(offset + done, len - done);
+            segments.push((phys,
+                           self.data[phys .. phys + plen].to_vec(),
+                           self.write_safe[phys .. phys + plen].to_vec()));
+            done += plen;
+        }
+        Delta {
+            segments: segments,
+            banks_swapped: self.banks_swapped,
+        }
+    }
+
+    fn apply(&mut self, delta: &Delta) {
+        for (phys, data, write_safe) in &delta.segments {
+            self.data[*phys .. *phys + data.len()].copy_from_slice(data);
+            self.write_safe[*phys .. *phys + write_safe.len()].copy_from_slice(write_safe);
+        }
+        self.banks_swapped = delta.banks_swapped;
+    }
 }
 
 /// It is possible to iterate over the sectors in the device, each element returning this.
@@ -298,7 +582,7 @@ impl<'a> Iterator for SectorIter<'a> {
 
 #[cfg(test)]
 mod test {
-    use super::{Flash, SimFlash, Error, ErrorKind, Result, Sector};
+    use super::{Elapsed, Flash, SimFlash, Error, ErrorKind, Result, Sector, Timing};
 
     #[test]
     fn test_flash() {
@@ -352,6 +636,73 @@ mod test {
         }
     }
 
+    #[test]
+    fn test_banks() {
+        let mut flash = SimFlash::new(vec![4096usize; 8], 1, 0xff);
+        assert!(flash.swap_banks().is_err());
+        flash.set_banks(0x2000, 0x4000, 0x2000);
+
+        flash.write(0x2000, &[1]).unwrap();
+        flash.write(0x4000, &[2]).unwrap();
+        flash.swap_banks().unwrap();
+
+        let mut buf = [0; 1];
+        flash.read(0x2000, &mut buf).unwrap();
+        assert_eq!(buf, [2]);
+        flash.read(0x4000, &mut buf).unwrap();
+        assert_eq!(buf, [1]);
+
+        // Accesses spanning a bank boundary are split up.
+        let mut buf = vec![0; 0x3000];
+        flash.read(0x1000, &mut buf).unwrap();
+        assert_eq!(buf[0x1000], 2);
+
+        // Writes and erases go through the mapping too.
+        flash.erase(0x2000, 0x1000).unwrap();
+        flash.swap_banks().unwrap();
+        let mut buf = [0; 1];
+        flash.read(0x2000, &mut buf).unwrap();
+        assert_eq!(buf, [1]);
+        flash.read(0x4000, &mut buf).unwrap();
+        assert_eq!(buf, [0xff]);
+    }
+
+    #[test]
+    fn test_multi_pass() {
+        for &erased_val in &[0, 0xff] {
+            let mut flash = SimFlash::new(vec![4096usize; 2], 1, erased_val);
+            flash.add_multi_pass_region(0, 16);
+
+            // Each pass moves one more bit away from the erased value.
+            for &bits in &[0x01, 0x03, 0x07, 0x07] {
+                flash.write(0, &[erased_val ^ bits]).unwrap();
+            }
+            let mut buf = [0; 1];
+            flash.read(0, &mut buf).unwrap();
+            assert_eq!(buf, [erased_val ^ 0x07]);
+        }
+    }
+
+    #[test]
+    #[should_panic(expected = "Write restoring erased bits")]
+    fn test_multi_pass_restore() {
+        let mut flash = SimFlash::new(vec![4096usize; 2], 1, 0xff);
+        flash.add_multi_pass_region(0, 16);
+
+        flash.write(0, &[0xf0]).unwrap();
+        flash.write(0, &[0xf8]).unwrap();
+    }
+
+    #[test]
+    #[should_panic(expected = "Write to unerased location")]
+    fn test_multi_pass_outside() {
+        let mut flash = SimFlash::new(vec![4096usize; 2], 1, 0xff);
+        flash.add_multi_pass_region(0, 16);
+
+        flash.write(16, &[0xf0]).unwrap();
+        flash.write(16, &[0xe0]).unwrap();
+    }
+
     // Helper checks for the result type.
     trait EChecker {
         fn is_bounds(&self) -> bool;
@@ -366,4 +717,105 @@ mod test {
             }
         }
     }
+
+    #[test]
+    fn test_corrupt_region() {
+        let mut flash = SimFlash::new(vec![4096usize; 4], 1, 0xff);
+        flash.add_corrupt_region(0x1000, 0x1000, 1);
+
+        // Writes outside of the region are left alone, and the first one inside is corrupted.
+        flash.write(0xffe, &[0x10, 0x20]).unwrap();
+        flash.write(0x1fff, &[0x30, 0x40]).unwrap();
+        let mut buf = [0; 2];
+        flash.read(0xffe, &mut buf).unwrap();
+        assert_eq!(buf, [0x10, 0x20]);
+        flash.read(0x1fff, &mut buf).unwrap();
+        assert_eq!(buf, [0x31, 0x40]);
+
+        // It is used up.
+        flash.write(0x1800, &[0x50]).unwrap();
+        let mut buf = [0; 1];
+        flash.read(0x1800, &mut buf).unwrap();
+        assert_eq!(buf, [0x50]);
+    }
+
+    #[test]
+    fn test_delta() {
+        let mut flash = SimFlash::new(vec![4096usize; 4], 1, 0xff);
+        flash.set_banks(0, 0x2000, 0x2000);
+        flash.write(0x1000, &[1; 16]).unwrap();
+        let before = flash.clone();
+
+        // Replaying the deltas of a write, a swap and an erase spanning the banks.
+        let mut deltas = Vec::new();
+        flash.write(0x1ff8, &[2; 16]).unwrap();
+        deltas.push(flash.delta(0x1ff8, 16));
+        flash.swap_banks().unwrap();
+        deltas.push(flash.delta(0, 0));
+        flash.erase(0x1000, 0x2000).unwrap();
+        deltas.push(flash.delta(0x1000, 0x2000));
+
+        let mut replay = before;
+        for delta in &deltas {
+            replay.apply(delta);
+        }
+        assert_eq!(replay.data, flash.data);
+        assert_eq!(replay.write_safe, flash.write_safe);
+        assert!(replay.banks_swapped());
+
+        // Erased locations can be written again.
+        replay.write(0x1000, &[3]).unwrap();
+    }
+
+    #[test]
+    fn test_timing() {
+        let mut flash = SimFlash::new(vec![4096usize; 4], 1, 0xff);
+        flash.set_timing(Timing { read: 1, program: 10, erase: 2 });
+
+        // Blocking operations add up.
+        flash.erase(0, 4096).unwrap();
+        flash.write(0, &[0; 16]).unwrap();
+        let mut buf = [0; 16];
+        flash.read(0, &mut buf).unwrap();
+        assert_eq!(flash.elapsed(), Elapsed { now: 8368, cpu: 16, busy: 8352 });
+
+        // Rejected operations take no time.
+        assert!(flash.erase(1, 4096).is_bounds());
+        assert!(flash.erase(0, 4095).is_bounds());
+        assert_eq!(flash.elapsed(), Elapsed { now: 8368, cpu: 16, busy: 8352 });
+
+        // Reads overlap with an operation started, and the next one waits for it.
+        flash.start_write(16, &[0; 16]).unwrap();
+        flash.read(0, &mut buf).unwrap();
+        assert!(flash.poll());
+        assert!(!flash.poll());
+        flash.start_write(32, &[0; 16]).unwrap();
+        flash.start_write(48, &[0; 16]).unwrap();
+        flash.read(0, &mut buf).unwrap();
+        assert_eq!(flash.elapsed(), Elapsed { now: 8704, cpu: 48, busy: 8832 });
+        assert!(flash.poll());
+        assert_eq!(flash.elapsed().now, 8848);
+    }
+
+    #[test]
+    fn test_start_write() {
+        let mut flash = SimFlash::new(vec![4096usize; 4], 1, 0xff);
+        let mut src = [1; 16];
+        let mut buf = [0; 16];
+
+        // The payload is copied when the write starts, and programmed when it completes.
+        flash.start_write(0, &src).unwrap();
+        src[0] = 2;
+        flash.read(0, &mut buf).unwrap();
+        assert_eq!(buf, [0xff; 16]);
+        flash.poll();
+        flash.read(0, &mut buf).unwrap();
+        assert_eq!(buf, [1; 16]);
+
+        // Starting another operation completes the write first.
+        flash.start_write(16, &src).unwrap();
+        flash.start_erase(4096, 4096).unwrap();
+        flash.read(16, &mut buf).unwrap();
+        assert_eq!(buf[0], 2);
+    }
 }
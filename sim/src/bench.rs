@@ -0,0 +1,91 @@
+//! Boot benchmarks
+//!
+//! Each scenario leaves the flash as a boot would find it, then boots once through
+//! `bootsim_bench_boot()`, which counts the flash operations bootutil issues.  These counts are
+//! exact, and so are the instruction counts of a tool collecting only within that function, such
+//! as `valgrind --tool=callgrind --toggle-collect=bootsim_bench_boot`.  `scripts/bootbench.py`
+//! runs the scenarios that way for several feature sets.
+
+use mcuboot_sys::{c, AreaDesc, FlashOps};
+use simflash::SimFlashMap;
+
+use crate::caps::Caps;
+use crate::{DeviceName, Run};
+
+/// The scenarios, in the order they are run:
+///
+/// * `none`: no upgrade pending.
+/// * `test`: a test upgrade pending, which is an encrypted swap with `enc-rsa` or `enc-kw`.
+/// * `resume`: the same upgrade, interrupted halfway through.
+/// * `revert`: the boot after the test upgrade, which reverts it (swap upgrades only).
+pub static SCENARIOS: &'static [&'static str] = &["none", "test", "resume", "revert"];
+
+/// Boot once after a cold reset.  Instruction counts are meant to be collected within this
+/// function only, so it is never inlined, and keeps its name.
+#[no_mangle]
+#[inline(never)]
+pub fn bootsim_bench_boot(flashmap: &mut SimFlashMap, areadesc: &AreaDesc) -> (i32, FlashOps) {
+    c::boot_go_counted(flashmap, areadesc)
+}
+
+/// Leave the flash as the boot of a scenario finds it.  Returns None if the scenario doesn't apply
+/// to this configuration.
+fn prepare(run: &Run, scenario: &str) -> Option<(SimFlashMap, AreaDesc)> {
+    if scenario == "none" {
+        let images = run.make_no_upgrade_image();
+        return Some((images.flashmap, images.areadesc));
+    }
+
+    let images = run.make_image();
+    let mut flashmap = images.flashmap.clone();
+    match scenario {
+        "test" => (),
+        "resume" => {
+            let mut counter = images.total_count.unwrap() / 2;
+            match c::boot_go(&mut flashmap, &images.areadesc, Some(&mut counter), false) {
+                (-0x13579, _) => (),
+                (x, _) => panic!("Unknown return: {}", x),
+            }
+        }
+        "revert" => {
+            if !Caps::SwapUpgrade.present() {
+                return None;
+            }
+            assert_eq!(c::boot_go(&mut flashmap, &images.areadesc, None, false), (0, 0));
+        }
+        _ => panic!("Unknown scenario: {}", scenario),
+    }
+    Some((flashmap, images.areadesc))
+}
+
+/// Run the given scenarios, or all of them, printing one line of counts per scenario.  Returns
+/// whether every boot succeeded.
+pub fn run_bench(device: DeviceName, align: u8, scenarios: &[String]) -> bool {
+    for s in scenarios {
+        if !SCENARIOS.contains(&s.as_str()) {
+            panic!("Unknown scenario: {}", s);
+        }
+    }
+
+    let run = Run::new(device, align, 0xff);
+    let mut ok = true;
+
+    println!("# scenario\tresult\treads\tread_bytes\twrites\twrite_bytes\terases\terase_bytes\t\
+              bank_swaps");
+    for &scenario in SCENARIOS {
+        if !scenarios.is_empty() && !scenarios.iter().any(|s| s == scenario) {
+            continue;
+        }
+        let (mut flashmap, areadesc) = match prepare(&run, scenario) {
+            Some(v) => v,
+            None => continue,
+        };
+
+        let (result, ops) = bootsim_bench_boot(&mut flashmap, &areadesc);
+        println!("{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}", scenario, result, ops.reads, ops.read_bytes,
+                 ops.writes, ops.write_bytes, ops.erases, ops.erase_bytes, ops.bank_swaps);
+        ok &= result == 0;
+    }
+
+    ok
+}
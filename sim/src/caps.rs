@@ -12,6 +12,14 @@ pub enum Caps {
     EncRsa           = (1 << 5),
     EncKw            = (1 << 6),
     ValidateSlot0    = (1 << 7),
+    SparseImages     = (1 << 8),
+    BankSwap         = (1 << 9),
+    BootToken        = (1 << 10),
+    StatusBitClear   = (1 << 11),
+    PicImages        = (1 << 12),
+    VerifyWrites     = (1 << 13),
+    OverlapCopy      = (1 << 14),
+    DeferredValidation = (1 << 15),
 }
 
 impl Caps {
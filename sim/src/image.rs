@@ -15,11 +15,17 @@ use aes_ctr::{
         StreamCipherCore,
     },
 };
+use ring::digest;
 
-use simflash::{Flash, SimFlashMap};
-use mcuboot_sys::{c, AreaDesc};
+use simflash::{Delta, Flash, SimFlashMap, Timing};
+use mcuboot_sys::{c, AreaDesc, Journal};
 use crate::caps::Caps;
-use crate::tlv::{TlvGen, TlvFlags, AES_SEC_KEY};
+use crate::tlv::{TlvGen, TlvFlags, TlvKinds, AES_SEC_KEY, RELOC_F_REL};
+
+const HDR_SIZE: usize = 32;
+
+/// Where the hash of images is split with deferred validation, relative to the image body.
+const DEFERRED_SPLIT: usize = 0x1100;
 
 impl Images {
     /// A simple upgrade without forced failures.
@@ -64,10 +70,14 @@ impl Images {
         let mut fails = 0;
         let total_flash_ops = self.total_count.unwrap();
 
-        // Let's try an image halfway through.
+        // The flash as an interruption at each step leaves it is replayed from a single run of
+        // the upgrade, only the boot resuming it is run for each step.
+        let (mut interrupted, journal) = record_upgrade(&self.flashmap, &self);
+        assert_eq!(journal.len(), total_flash_ops as usize);
+
         for i in 1 .. total_flash_ops {
             info!("Try interruption at {}", i);
-            let (flashmap, count) = try_upgrade(&self.flashmap, &self, Some(i));
+            let (flashmap, count) = resume_upgrade(&interrupted, &self, i);
             info!("Second boot, count={}", count);
             if !verify_image(&flashmap, &self.slots, 0, &self.upgrades) {
                 warn!("FAIL at step {} of {}", i, total_flash_ops);
@@ -92,6 +102,8 @@ impl Images {
                     fails += 1;
                 }
             }
+
+            apply_change(&mut interrupted, &journal[i as usize - 1]);
         }
 
         if fails > 0 {
@@ -151,12 +163,52 @@ impl Images {
         let mut fails = 0;
 
         if Caps::SwapUpgrade.present() {
+            let mut interrupted = self.flashmap.clone();
+            let (x, journal) = c::boot_go_journal(&mut interrupted.clone(), &self.areadesc);
+            assert_eq!(x, 0);
+
             for i in 1 .. (self.total_count.unwrap() - 1) {
                 info!("Try interruption at {}", i);
-                if try_revert_with_fail_at(&self.flashmap, &self, i) {
+                if try_revert_with_fail_at(&interrupted, &journal, &self, i) {
                     error!("Revert failed at interruption {}", i);
                     fails += 1;
                 }
+                apply_change(&mut interrupted, &journal[i as usize - 1]);
+            }
+        }
+
+        fails > 0
+    }
+
+    /// Check that replaying the journal of an upgrade leaves the flash as interrupting the
+    /// upgrade does, for a sample of the interruption points.
+    pub fn run_journal_replay(&self) -> bool {
+        let mut fails = 0;
+        let total_flash_ops = self.total_count.unwrap();
+        let step = (total_flash_ops / 8).max(1);
+
+        let (mut replayed, journal) = record_upgrade(&self.flashmap, &self);
+        let mut applied = 0;
+        for stop in (1 .. total_flash_ops).step_by(step as usize) {
+            let mut flashmap = self.flashmap.clone();
+            mark_permanent_upgrade(&mut flashmap, &self.slots[1]);
+            let mut counter = stop;
+            match c::boot_go(&mut flashmap, &self.areadesc, Some(&mut counter), false) {
+                (-0x13579, _) => (),
+                (x, _) => panic!("Unknown return: {}", x),
+            }
+
+            while applied < stop as usize - 1 {
+                apply_change(&mut replayed, &journal[applied]);
+                applied += 1;
+            }
+            for (dev_id, flash) in &flashmap {
+                let other = &replayed[dev_id];
+                if flash.delta(0, flash.device_size()) != other.delta(0, other.device_size()) {
+                    warn!("Replay differs on device {} at step {} of {}",
+                          dev_id, stop, total_flash_ops);
+                    fails += 1;
+                }
             }
         }
 
@@ -320,6 +372,65 @@ impl Images {
         fails > 0
     }
 
+    /// Change a byte within each fill range of the images.  An upgrade to such an image must not
+    /// be installed, and with slot 0 validation, such an image in slot 0 must not boot.
+    pub fn run_bad_fill(&self) -> bool {
+        if !Caps::SparseImages.present() {
+            return false;
+        }
+
+        let mut fails = 0;
+
+        let image = find_image(&self.upgrades, 0);
+        let img_size = u32::from_le_bytes([image[12], image[13], image[14], image[15]]) as usize;
+        let fills = sparse_fills(img_size);
+        if fills.is_empty() {
+            warn!("Upgrade image has no fill range");
+            fails += 1;
+        }
+
+        for &(off, _, _) in &fills {
+            info!("Try upgrade with a bad fill at 0x{:x}", off);
+
+            let mut flashmap = self.flashmap.clone();
+            corrupt_byte(&mut flashmap, &self.slots[1], HDR_SIZE + off);
+            let (result, _) = c::boot_go(&mut flashmap, &self.areadesc, None, false);
+            if result != 0 {
+                warn!("Failed first boot");
+                fails += 1;
+            }
+            if !verify_image(&flashmap, &self.slots, 0, &self.primaries) {
+                warn!("Upgrade with a bad fill at 0x{:x} was installed", off);
+                fails += 1;
+            }
+
+            // Deferred validation leaves what follows the split to the application.
+            if !Caps::ValidateSlot0.present() ||
+                    (Caps::DeferredValidation.present() && off >= DEFERRED_SPLIT) {
+                continue;
+            }
+
+            let mut flashmap = self.flashmap.clone();
+            {
+                let slot = &self.slots[1];
+                let flash = flashmap.get_mut(&slot.dev_id).unwrap();
+                flash.erase(slot.base_off, slot.len).unwrap();
+            }
+            corrupt_byte(&mut flashmap, &self.slots[0], HDR_SIZE + off);
+            let (result, _) = c::boot_go(&mut flashmap, &self.areadesc, None, true);
+            if result == 0 {
+                warn!("Booted slot 0 with a bad fill at 0x{:x}", off);
+                fails += 1;
+            }
+        }
+
+        if fails > 0 {
+            error!("Expected images with a bad fill to be rejected");
+        }
+
+        fails > 0
+    }
+
     fn trailer_sz(&self, align: usize) -> usize {
         c::boot_trailer_sz(align as u8) as usize
     }
@@ -443,9 +554,11 @@ impl Images {
             mark_permanent_upgrade(&mut flashmap, &self.slots[1]);
             self.mark_bad_status_with_rate(&mut flashmap, 0, 1.0);
 
-            // This is expected to fail while writing to bad regions...
+            // This is expected to fail while writing to bad regions, unless the
+            // swap was done by exchanging the flash banks, which writes no status.
             let (_, asserts) = c::boot_go(&mut flashmap, &self.areadesc, None, true);
-            if asserts == 0 {
+            let no_status = Caps::BankSwap.present() && self.banks_swapped(&flashmap);
+            if asserts == 0 && !no_status {
                 warn!("No assert() detected");
                 fails += 1;
             }
@@ -454,6 +567,471 @@ impl Images {
         }
     }
 
+    /// Test the boot token left in retained RAM.  A warm reset must not skip a swap which the
+    /// previous boot left pending, or which was requested since through bootutil, but otherwise
+    /// boots slot 0 again without touching flash.
+    pub fn run_warm_reset(&self) -> bool {
+        if !Caps::BootToken.present() {
+            return false;
+        }
+
+        let mut flashmap = self.flashmap.clone();
+        let mut ram = [0u8; c::RETAINED_RAM_SZ];
+        let mut fails = 0;
+
+        info!("Try warm resets with a boot token");
+
+        // This is a test upgrade, which leaves a revert pending.
+        let (result, _) = c::boot_go_retained(&mut flashmap, &self.areadesc, None, false,
+                                              &mut ram);
+        if result != 0 || !verify_image(&flashmap, &self.slots, 0, &self.upgrades) {
+            warn!("Failed upgrade before warm reset");
+            fails += 1;
+        }
+
+        let (result, _) = c::boot_go_retained(&mut flashmap, &self.areadesc, None, false,
+                                              &mut ram);
+        let expected = if Caps::SwapUpgrade.present() { &self.primaries } else { &self.upgrades };
+        if result != 0 || !verify_image(&flashmap, &self.slots, 0, expected) {
+            warn!("Warm reset skipped a revert");
+            fails += 1;
+        }
+
+        // Nothing is pending now, so the next warm reset uses the token.  Only a boot which
+        // doesn't bumps the flash generation, the first word of the retained RAM.
+        let mut warm = flashmap.clone();
+        let mut warm_ram = ram;
+        let (result, _) = c::boot_go_retained(&mut warm, &self.areadesc, None, false,
+                                              &mut warm_ram);
+        if result != 0 || warm_ram[..4] != ram[..4] {
+            warn!("Warm reset did not use the boot token");
+            fails += 1;
+        }
+
+        // Slots changed without going through bootutil make the token stale, so that the boot
+        // goes through flash again, whatever it finds there.
+        let mut erased = flashmap.clone();
+        let mut erased_ram = ram;
+        {
+            let slot = &self.slots[0];
+            let flash = erased.get_mut(&slot.dev_id).unwrap();
+            flash.erase(slot.base_off, slot.len).unwrap();
+        }
+        c::boot_go_retained(&mut erased, &self.areadesc, None, true, &mut erased_ram);
+        if erased_ram[..4] == ram[..4] {
+            warn!("Warm reset used the boot token with slot 0 erased");
+            fails += 1;
+        }
+
+        if Caps::SwapUpgrade.present() {
+            let mut marked = flashmap.clone();
+            let mut marked_ram = ram;
+            mark_upgrade(&mut marked, &self.slots[1]);
+            let (result, _) = c::boot_go_retained(&mut marked, &self.areadesc, None, false,
+                                                  &mut marked_ram);
+            if result != 0 || !verify_image(&marked, &self.slots, 0, &self.upgrades) {
+                warn!("Warm reset skipped an upgrade requested behind bootutil");
+                fails += 1;
+            }
+        }
+
+        // A swap requested through bootutil makes the token stale.
+        if Caps::SwapUpgrade.present() {
+            if c::boot_set_pending(&mut flashmap, &self.areadesc, true, &mut ram) != 0 {
+                warn!("Failed to set an upgrade pending");
+                fails += 1;
+            }
+            let (result, _) = c::boot_go_retained(&mut flashmap, &self.areadesc, None, false,
+                                                  &mut ram);
+            if result != 0 || !verify_image(&flashmap, &self.slots, 0, &self.upgrades) {
+                warn!("Warm reset skipped a pending upgrade");
+                fails += 1;
+            }
+        }
+
+        if fails > 0 {
+            error!("Error testing warm resets");
+        }
+
+        fails > 0
+    }
+
+    /// Run PIC images in place: an upgrade in slot 1 runs from there once set pending, with no
+    /// copy, and is erased if it doesn't confirm itself.
+    pub fn run_pic_in_place(&self) -> bool {
+        if !Caps::PicImages.present() || Caps::EncRsa.present() || Caps::EncKw.present() {
+            return false;
+        }
+
+        let mut fails = 0;
+
+        info!("Try running PIC images in place");
+
+        let boots_from = |flashmap: &mut SimFlashMap, expected: usize| -> bool {
+            let (result, slot, ram) = c::boot_go_pic(flashmap, &self.areadesc);
+            if result != 0 || slot as usize != expected {
+                warn!("Booted slot {} (result {}), expected slot {}", slot, result, expected);
+                return false;
+            }
+            verify_pic_ram(&ram, self.slots[expected].base_off as u32)
+        };
+
+        // Nothing pending: slot 0 runs.
+        let mut flashmap = self.flashmap.clone();
+        if !boots_from(&mut flashmap, 0) {
+            fails += 1;
+        }
+
+        // A test upgrade runs in place, leaving slot 0 alone, and is reverted on the next boot.
+        if c::boot_set_pending_slot(&mut flashmap, &self.areadesc, 1, false) != 0 {
+            warn!("Failed to set slot 1 pending");
+            fails += 1;
+        }
+        if !boots_from(&mut flashmap, 1) {
+            fails += 1;
+        }
+        if !verify_image(&flashmap, &self.slots, 0, &self.primaries) ||
+                !verify_image(&flashmap, &self.slots, 1, &self.upgrades) {
+            warn!("Running in place changed an image");
+            fails += 1;
+        }
+        if !boots_from(&mut flashmap, 0) {
+            fails += 1;
+        }
+        let mut magic = [0u8; 4];
+        {
+            let slot = &self.slots[1];
+            let flash = flashmap.get(&slot.dev_id).unwrap();
+            flash.read(slot.base_off, &mut magic).unwrap();
+            if magic.iter().any(|&b| b != flash.erased_val()) {
+                warn!("Unconfirmed image in slot 1 was not erased");
+                fails += 1;
+            }
+        }
+
+        // A confirmed upgrade keeps running in place.
+        let mut flashmap = self.flashmap.clone();
+        c::boot_set_pending_slot(&mut flashmap, &self.areadesc, 1, false);
+        if !boots_from(&mut flashmap, 1) {
+            fails += 1;
+        }
+        if c::boot_set_confirmed_slot(&mut flashmap, &self.areadesc, 1) != 0 {
+            warn!("Failed to confirm slot 1");
+            fails += 1;
+        }
+        for _ in 0 .. 2 {
+            if !boots_from(&mut flashmap, 1) {
+                fails += 1;
+            }
+        }
+
+        // An unconfirmed trial whose other slot was erased since has nothing to revert to, so it
+        // keeps running, from either slot, and stays unconfirmed.
+        for &(trial, empty) in &[(1, 0), (0, 1)] {
+            let mut flashmap = self.flashmap.clone();
+            c::boot_set_pending_slot(&mut flashmap, &self.areadesc, trial, false);
+            if !boots_from(&mut flashmap, trial) {
+                fails += 1;
+            }
+            {
+                let slot = &self.slots[empty];
+                let flash = flashmap.get_mut(&slot.dev_id).unwrap();
+                flash.erase(slot.base_off, slot.len).unwrap();
+            }
+            for _ in 0 .. 2 {
+                if !boots_from(&mut flashmap, trial) {
+                    fails += 1;
+                }
+            }
+            let images = if trial == 0 { &self.primaries } else { &self.upgrades };
+            if !verify_image(&flashmap, &self.slots, trial, images) {
+                warn!("Lone trial image in slot {} was changed", trial);
+                fails += 1;
+            }
+            if !verify_trailer(&flashmap, &self.slots, trial, BOOT_MAGIC_GOOD, BOOT_FLAG_UNSET,
+                               BOOT_FLAG_SET) {
+                warn!("Lone trial image in slot {} was confirmed", trial);
+                fails += 1;
+            }
+        }
+
+        if fails > 0 {
+            error!("Error running PIC images in place");
+        }
+
+        fails > 0
+    }
+
+    /// Upgrade with writes to the slots that seem to succeed, but store wrong data.  Each copy is
+    /// checked and redone when it doesn't match, so the upgrade must still complete; a copy that
+    /// keeps failing must make the bootloader give up.
+    pub fn run_verify_writes(&self) -> bool {
+        if !Caps::VerifyWrites.present() {
+            return false;
+        }
+
+        let mut fails = 0;
+
+        info!("Try upgrade with corrupted writes");
+
+        let mut flashmap = self.flashmap.clone();
+        mark_permanent_upgrade(&mut flashmap, &self.slots[1]);
+        for slot in &self.slots[0..2] {
+            self.corrupt_image_area(&mut flashmap, slot, 2);
+        }
+
+        let (result, asserts) = c::boot_go(&mut flashmap, &self.areadesc, None, true);
+        if result != 0 || asserts != 0 {
+            warn!("Upgrade with corrupted writes failed");
+            fails += 1;
+        }
+        if !verify_image(&flashmap, &self.slots, 0, &self.upgrades) {
+            warn!("Slot 0 mismatch after corrupted writes");
+            fails += 1;
+        }
+        if Caps::SwapUpgrade.present() && !self.banks_swapped(&flashmap) &&
+                !verify_image(&flashmap, &self.slots, 1, &self.primaries) {
+            warn!("Slot 1 mismatch after corrupted writes");
+            fails += 1;
+        }
+
+        // Exchanging flash banks doesn't write to the slots.
+        if !self.banks_swapped(&flashmap) {
+            let mut flashmap = self.flashmap.clone();
+            mark_permanent_upgrade(&mut flashmap, &self.slots[1]);
+            self.corrupt_image_area(&mut flashmap, &self.slots[0], usize::MAX);
+
+            let (_, asserts) = c::boot_go(&mut flashmap, &self.areadesc, None, true);
+            if asserts == 0 {
+                warn!("Upgrade went on after a copy kept failing");
+                fails += 1;
+            }
+        }
+
+        if fails > 0 {
+            error!("Error testing upgrade with corrupted writes");
+        }
+
+        fails > 0
+    }
+
+    /// Upgrade, then revert, with timed flash operations, checking that the virtual clock of the
+    /// device shows reads overlapping with programming.
+    pub fn run_overlap_copy(&self) -> bool {
+        // Each device has its own clock, so overlaps across devices don't show.
+        let dev_id = self.slots[0].dev_id;
+        if !Caps::OverlapCopy.present() || self.slots[1].dev_id != dev_id {
+            return false;
+        }
+
+        let mut fails = 0;
+
+        info!("Try overlapping reads with programming");
+
+        // The images are installed with a test upgrade pending.
+        let mut flashmap = self.flashmap.clone();
+
+        let mut expected = &self.upgrades;
+        let mut banks_swapped = false;
+        for step in &["Upgrade", "Revert"] {
+            flashmap.get_mut(&dev_id).unwrap().set_timing(Timing {
+                read: 20,
+                program: 40,
+                erase: 20,
+            });
+
+            let (result, asserts) = c::boot_go(&mut flashmap, &self.areadesc, None, true);
+            if result != 0 || asserts != 0 {
+                warn!("{} failed", step);
+                fails += 1;
+            }
+            if !verify_image(&flashmap, &self.slots, 0, expected) {
+                warn!("Slot 0 mismatch after {}", step);
+                fails += 1;
+            }
+
+            // Exchanging flash banks doesn't copy anything.
+            banks_swapped |= self.banks_swapped(&flashmap);
+            if !banks_swapped {
+                let elapsed = flashmap[&dev_id].elapsed();
+                info!("{} took {} us: {} us reading, {} us erasing and programming", step,
+                      elapsed.now / 1000, elapsed.cpu / 1000, elapsed.busy / 1000);
+                if elapsed.now >= elapsed.cpu + elapsed.busy {
+                    warn!("Nothing overlapped during {}", step);
+                    fails += 1;
+                }
+            }
+
+            if !Caps::SwapUpgrade.present() {
+                break;
+            }
+            expected = &self.primaries;
+        }
+
+        if fails > 0 {
+            error!("Error testing overlapped copies");
+        }
+
+        fails > 0
+    }
+
+    /// Boot images whose hash is split in two, the bootloader only checking the first part, and
+    /// check the rest the way the application would, a bounded number of bytes at a time.  A
+    /// corrupted second part must go unnoticed by the bootloader but fail the check, after which
+    /// a revert brings back the previous image; a corrupted first part, or fill range descriptor,
+    /// must stop the boot.
+    pub fn run_deferred_validation(&self) -> bool {
+        if !Caps::DeferredValidation.present() {
+            return false;
+        }
+
+        let mut fails = 0;
+
+        info!("Try deferred validation of slot 0");
+
+        // Booting slot 0 without an upgrade only reads the start of the image.
+        let dev_id = self.slots[0].dev_id;
+        let mut flashmap = self.flashmap.clone();
+        {
+            let slot = &self.slots[1];
+            let flash = flashmap.get_mut(&slot.dev_id).unwrap();
+            flash.erase(slot.base_off, slot.len).unwrap();
+        }
+        flashmap.get_mut(&dev_id).unwrap().set_timing(Timing { read: 1, program: 0, erase: 0 });
+        let (result, asserts) = c::boot_go(&mut flashmap, &self.areadesc, None, true);
+        if result != 0 || asserts != 0 {
+            warn!("Boot with deferred validation failed");
+            fails += 1;
+        }
+        let image = find_image(&self.primaries, 0);
+        let img_size = u32::from_le_bytes([image[12], image[13], image[14], image[15]]) as usize;
+        let read = flashmap[&dev_id].elapsed().cpu as usize;
+        info!("Boot read {} bytes of a {} byte image", read, img_size);
+        if read >= img_size / 2 {
+            warn!("Boot read most of slot 0");
+            fails += 1;
+        }
+
+        let (result, steps) = c::boot_deferred_check(&mut flashmap, &self.areadesc, 1024);
+        if result != 0 {
+            warn!("Deferred check of a good image failed");
+            fails += 1;
+        }
+        if steps as usize != (img_size - DEFERRED_SPLIT + 1023) / 1024 {
+            warn!("Deferred check took {} calls", steps);
+            fails += 1;
+        }
+
+        // Past the split, and past the fill ranges of sparse images.
+        let rest_off = HDR_SIZE + 5 * DEFERRED_SPLIT;
+        let mut corrupted = flashmap.clone();
+        corrupt_byte(&mut corrupted, &self.slots[0], rest_off);
+        let (result, asserts) = c::boot_go(&mut corrupted, &self.areadesc, None, true);
+        if result != 0 || asserts != 0 {
+            warn!("Boot checked past the split");
+            fails += 1;
+        }
+        let (result, _) = c::boot_deferred_check(&mut corrupted, &self.areadesc, 1024);
+        if result == 0 {
+            warn!("Deferred check missed a corrupted image");
+            fails += 1;
+        }
+
+        // Recording the hash of the corrupted rest in the TLVs breaks the signature, which the
+        // check must go by.
+        forge_rest_hash(&mut corrupted, &self.slots[0], img_size);
+        let (result, _) = c::boot_deferred_check(&mut corrupted, &self.areadesc, 1024);
+        if result == 0 {
+            warn!("Deferred check trusted a rewritten hash of the rest");
+            fails += 1;
+        }
+
+        let mut corrupted = flashmap.clone();
+        corrupt_byte(&mut corrupted, &self.slots[0], HDR_SIZE + DEFERRED_SPLIT - 1);
+        let (result, _) = c::boot_go(&mut corrupted, &self.areadesc, None, true);
+        if result == 0 {
+            warn!("Boot missed a corrupted start of image");
+            fails += 1;
+        }
+
+        // Shorten the last fill range, which lies past the split.  The boot loader uses the fill
+        // ranges before the rest is checked, so the first part covers their descriptor.
+        let fills = sparse_fills(img_size);
+        if !fills.is_empty() {
+            let len_off = HDR_SIZE + img_size + 4 + 12 * (fills.len() - 1) + 4 + 4;
+            let mut corrupted = flashmap.clone();
+            corrupt_byte(&mut corrupted, &self.slots[0], len_off);
+            let (result, _) = c::boot_go(&mut corrupted, &self.areadesc, None, true);
+            if result == 0 {
+                warn!("Boot missed a changed fill range");
+                fails += 1;
+            }
+        }
+
+        // Overwrite-only upgrades leave no previous image to go back to.
+        if Caps::OverwriteUpgrade.present() &&
+                c::boot_deferred_revert(&mut flashmap.clone(), &self.areadesc) == 0 {
+            warn!("Revert requested without a previous image");
+            fails += 1;
+        }
+
+        // A failed check goes back to the previous image, whether the upgrade was a test or not.
+        if Caps::SwapUpgrade.present() {
+            for &permanent in &[false, true] {
+                let mut flashmap = self.flashmap.clone();
+                if permanent {
+                    mark_permanent_upgrade(&mut flashmap, &self.slots[1]);
+                }
+                let (result, _) = c::boot_go(&mut flashmap, &self.areadesc, None, false);
+                if result != 0 || !verify_image(&flashmap, &self.slots, 0, &self.upgrades) {
+                    warn!("Upgrade failed");
+                    fails += 1;
+                }
+
+                corrupt_byte(&mut flashmap, &self.slots[0], rest_off);
+                let (result, _) = c::boot_deferred_check(&mut flashmap, &self.areadesc, 1024);
+                if result == 0 {
+                    warn!("Deferred check missed a corrupted upgrade");
+                    fails += 1;
+                }
+                if c::boot_deferred_revert(&mut flashmap, &self.areadesc) != 0 {
+                    warn!("Failed to request a revert");
+                    fails += 1;
+                }
+
+                let (result, _) = c::boot_go(&mut flashmap, &self.areadesc, None, false);
+                if result != 0 || !verify_image(&flashmap, &self.slots, 0, &self.primaries) {
+                    warn!("Failed to revert a corrupted upgrade (permanent: {})", permanent);
+                    fails += 1;
+                }
+            }
+        }
+
+        if fails > 0 {
+            error!("Error testing deferred validation");
+        }
+
+        fails > 0
+    }
+
+    /// Makes the next `count` writes to the image area of a slot, leaving out the trailer, store
+    /// wrong data.
+    fn corrupt_image_area(&self, flashmap: &mut SimFlashMap, slot: &SlotInfo, count: usize) {
+        let flash = flashmap.get_mut(&slot.dev_id).unwrap();
+        let len = slot.len - self.trailer_sz(flash.align());
+        flash.add_corrupt_region(slot.base_off, len, count);
+    }
+
+    /// Whether the last upgrade left the slots' flash banks exchanged.
+    fn banks_swapped(&self, flashmap: &SimFlashMap) -> bool {
+        if !Caps::BankSwap.present() {
+            return false;
+        }
+
+        let flash = flashmap.get(&self.slots[0].dev_id).unwrap();
+        flash.banks_swapped()
+    }
+
     /// Adds a new flash area that fails statistically
     fn mark_bad_status_with_rate(&self, flashmap: &mut SimFlashMap, slot: usize,
                                  rate: f32) {
@@ -518,6 +1096,44 @@ fn try_upgrade(flashmap: &SimFlashMap, images: &Images,
     (flashmap, count - counter)
 }
 
+/// Run an upgrade, recording the changes each of its flash operations makes.  Returns the flash
+/// as it was before the upgrade, and the journal.
+fn record_upgrade(flashmap: &SimFlashMap, images: &Images) -> (SimFlashMap, Journal) {
+    let mut flashmap = flashmap.clone();
+
+    mark_permanent_upgrade(&mut flashmap, &images.slots[1]);
+
+    let (x, journal) = c::boot_go_journal(&mut flashmap.clone(), &images.areadesc);
+    if x != 0 {
+        panic!("Unknown return: {}", x);
+    }
+
+    (flashmap, journal)
+}
+
+/// Boot from flash left by an upgrade interrupted at operation 'stop', such as a replay of its
+/// journal.  Returns the flash, and a count of the flash operations done in total, as
+/// `try_upgrade` does.
+fn resume_upgrade(interrupted: &SimFlashMap, images: &Images,
+                  stop: i32) -> (SimFlashMap, i32) {
+    let mut flashmap = interrupted.clone();
+
+    let mut counter = 0;
+    match c::boot_go(&mut flashmap, &images.areadesc, Some(&mut counter), false) {
+        (-0x13579, _) => panic!("Shouldn't stop again"),
+        (0, _) => (),
+        (x, _) => panic!("Unknown return: {}", x),
+    }
+
+    (flashmap, stop - counter)
+}
+
+/// Apply one change of a journal.
+fn apply_change(flashmap: &mut SimFlashMap, change: &(u8, Delta)) {
+    let (dev_id, ref delta) = *change;
+    flashmap.get_mut(&dev_id).unwrap().apply(delta);
+}
+
 fn try_revert(flashmap: &SimFlashMap, areadesc: &AreaDesc, count: usize) -> SimFlashMap {
     let mut flashmap = flashmap.clone();
 
@@ -529,14 +1145,15 @@ fn try_revert(flashmap: &SimFlashMap, areadesc: &AreaDesc, count: usize) -> SimF
     flashmap
 }
 
-fn try_revert_with_fail_at(flashmap: &SimFlashMap, images: &Images,
+/// Resume and revert a test upgrade, from flash left by an interruption at operation 'stop', as
+/// replayed from the journal of the upgrade.
+fn try_revert_with_fail_at(interrupted: &SimFlashMap, journal: &Journal, images: &Images,
                            stop: i32) -> bool {
-    let mut flashmap = flashmap.clone();
+    let mut flashmap = interrupted.clone();
     let mut fails = 0;
 
-    let mut counter = stop;
-    let (x, _) = c::boot_go(&mut flashmap, &images.areadesc, Some(&mut counter), false);
-    if x != -0x13579 {
+    // The upgrade must have reached operation 'stop' for an interruption there to happen.
+    if journal.len() < stop as usize {
         warn!("Should have stopped at interruption point");
         fails += 1;
     }
@@ -607,9 +1224,13 @@ fn try_random_fails(flashmap: &SimFlashMap, images: &Images,
     mark_permanent_upgrade(&mut flashmap, &images.slots[1]);
 
     let mut rng = rand::thread_rng();
-    let mut resets = vec![0i32; count];
+    let mut resets = Vec::with_capacity(count);
     let mut remaining_ops = total_ops;
-    for i in 0 .. count {
+    for _ in 0 .. count {
+        // A bank swap is too short to leave room for as many resets.
+        if Caps::BankSwap.present() && remaining_ops / 2 <= 1 {
+            break;
+        }
         let ops = Range::new(1, remaining_ops / 2);
         let reset_counter = ops.ind_sample(&mut rng);
         let mut counter = reset_counter;
@@ -618,7 +1239,7 @@ fn try_random_fails(flashmap: &SimFlashMap, images: &Images,
             (x, _) => panic!("Unknown return: {}", x),
         }
         remaining_ops -= reset_counter;
-        resets[i] = reset_counter;
+        resets.push(reset_counter);
     }
 
     match c::boot_go(&mut flashmap, &images.areadesc, None, false) {
@@ -643,15 +1264,34 @@ fn show_flash(flash: &dyn Flash) {
 
 /// Install a "program" into the given image.  This fakes the image header, or at least all of the
 /// fields used by the given code.  Returns a copy of the image that was written.
+/// With `pic` set, the image is position-independent, and its tables are described by
+/// `pic_tables()`.
 pub fn install_image(flashmap: &mut SimFlashMap, slots: &[SlotInfo], slot: usize, len: usize,
-                 bad_sig: bool) -> [Option<Vec<u8>>; 2] {
+                 bad_sig: bool, pic: bool) -> [Option<Vec<u8>>; 2] {
     let offset = slots[slot].base_off;
     let slot_len = slots[slot].len;
     let dev_id = slots[slot].dev_id;
 
     let mut tlv = make_tlv();
 
-    const HDR_SIZE: usize = 32;
+    let fills = sparse_fills(len);
+    for &(off, size, fill) in &fills {
+        tlv.add_sparse_range((HDR_SIZE + off) as u32, size as u32, fill);
+    }
+
+    // With deferred validation, the boot loader only checks the image up to a bit past its
+    // vector table; the application checks the rest.
+    if Caps::DeferredValidation.present() && len > DEFERRED_SPLIT {
+        tlv.set_split((HDR_SIZE + DEFERRED_SPLIT) as u32);
+    }
+
+    let tables = if pic { pic_tables() } else { vec![] };
+    for &(off, dst, flags, ref words) in &tables {
+        tlv.add_reloc((HDR_SIZE + off) as u32, dst, words.len() as u16, flags);
+    }
+
+    // PIC images run in place, ordered by version, so the one in slot 1 must be newer.
+    let major = if pic { slot + 1 } else { offset / (128 * 1024) };
 
     // Generate a boot header.  Note that the size doesn't include the header.
     let header = ImageHeader {
@@ -662,7 +1302,7 @@ pub fn install_image(flashmap: &mut SimFlashMap, slots: &[SlotInfo], slot: usize
         img_size: len as u32,
         flags: tlv.get_flags(),
         ver: ImageVersion {
-            major: (offset / (128 * 1024)) as u8,
+            major: major as u8,
             minor: 0,
             revision: 1,
             build_num: offset as u32,
@@ -679,6 +1319,16 @@ pub fn install_image(flashmap: &mut SimFlashMap, slots: &[SlotInfo], slot: usize
     // The core of the image itself is just pseudorandom data.
     let mut b_img = vec![0; len];
     splat(&mut b_img, offset);
+    for &(off, size, fill) in &fills {
+        for b in &mut b_img[off .. off + size] {
+            *b = fill;
+        }
+    }
+    for &(off, _, _, ref words) in &tables {
+        for (i, w) in words.iter().enumerate() {
+            b_img[off + 4 * i .. off + 4 * i + 4].copy_from_slice(&w.to_le_bytes());
+        }
+    }
 
     // TLV signatures work over plain image
     tlv.add_bytes(&b_img);
@@ -780,6 +1430,38 @@ pub fn install_image(flashmap: &mut SimFlashMap, slots: &[SlotInfo], slot: usize
     result
 }
 
+/// The tables of the PIC images, as (body offset, RAM address, reloc flags, words): a vector table
+/// with the initial stack pointer, which is left alone, followed by handlers relative to the
+/// header, and a small GOT.
+pub fn pic_tables() -> Vec<(usize, u32, u16, Vec<u32>)> {
+    let handlers = (1 .. 8).map(|i| HDR_SIZE as u32 + 0x100 * i + 1).collect();
+    let got = (0 .. 4).map(|i| HDR_SIZE as u32 + 0x2000 + 4 * i).collect();
+    vec![
+        (0, c::PIC_RAM_ADDR, 0, vec![0x20001000]),
+        (4, c::PIC_RAM_ADDR + 4, RELOC_F_REL, handlers),
+        (1024, c::PIC_RAM_ADDR + 0x40, RELOC_F_REL, got),
+    ]
+}
+
+/// Check the RAM tables of a PIC image running from `exec_addr`.
+fn verify_pic_ram(ram: &[u8], exec_addr: u32) -> bool {
+    for (_, dst, flags, words) in pic_tables() {
+        let base = (dst - c::PIC_RAM_ADDR) as usize;
+        for (i, &w) in words.iter().enumerate() {
+            let expected = if flags & RELOC_F_REL != 0 { w + exec_addr } else { w };
+            let off = base + 4 * i;
+            let mut got = [0u8; 4];
+            got.copy_from_slice(&ram[off .. off + 4]);
+            if u32::from_le_bytes(got) != expected {
+                warn!("PIC table word at {:#x} is {:#x}, expected {:#x}",
+                      dst as usize + 4 * i, u32::from_le_bytes(got), expected);
+                return false;
+            }
+        }
+    }
+    true
+}
+
 fn make_tlv() -> TlvGen {
     if Caps::EcdsaP224.present() {
         panic!("Ecdsa P224 not supported in Simulator");
@@ -983,6 +1665,65 @@ fn mark_permanent_upgrade(flashmap: &mut SimFlashMap, slot: &SlotInfo) {
     flash.write(off, &ok[..align]).unwrap();
 }
 
+/// Flip the bits of the byte at `off` in a slot, rewriting the sector holding it.
+fn corrupt_byte(flashmap: &mut SimFlashMap, slot: &SlotInfo, off: usize) {
+    let mut byte = [0];
+    flashmap[&slot.dev_id].read(slot.base_off + off, &mut byte).unwrap();
+    patch_byte(flashmap, slot, off, byte[0] ^ 0xff);
+}
+
+/// Set the byte at `off` in a slot, rewriting the sector holding it.
+fn patch_byte(flashmap: &mut SimFlashMap, slot: &SlotInfo, off: usize, value: u8) {
+    let flash = flashmap.get_mut(&slot.dev_id).unwrap();
+    let off = slot.base_off + off;
+    let sector = flash.sector_iter()
+        .find(|s| s.base <= off && off < s.base + s.size)
+        .unwrap();
+    let mut data = vec![0; sector.size];
+    flash.read(sector.base, &mut data).unwrap();
+    data[off - sector.base] = value;
+    flash.erase(sector.base, sector.size).unwrap();
+    flash.write(sector.base, &data).unwrap();
+}
+
+/// Record in the HASH_PARTS TLV of the image in a slot the hash of what follows the split, as it
+/// is in flash, without signing it again.
+fn forge_rest_hash(flashmap: &mut SimFlashMap, slot: &SlotInfo, img_size: usize) {
+    let mut image = vec![0; HDR_SIZE + img_size + 1024];
+    flashmap[&slot.dev_id].read(slot.base_off, &mut image).unwrap();
+
+    let mut rest = vec![];
+    let mut pos = HDR_SIZE + DEFERRED_SPLIT;
+    for &(off, len, _) in &sparse_fills(img_size) {
+        let (off, end) = (HDR_SIZE + off, HDR_SIZE + off + len);
+        if end > pos {
+            rest.extend_from_slice(&image[pos..off.max(pos)]);
+            pos = end;
+        }
+    }
+    rest.extend_from_slice(&image[pos..HDR_SIZE + img_size]);
+    let hash = digest::digest(&digest::SHA256, &rest);
+
+    let mut off = HDR_SIZE + img_size + 4;
+    while image[off] != TlvKinds::HASH_PARTS as u8 {
+        off += 4 + image[off + 2] as usize + ((image[off + 3] as usize) << 8);
+    }
+    for (i, &b) in hash.as_ref().iter().enumerate() {
+        patch_byte(flashmap, slot, off + 4 + 4 + i, b);
+    }
+}
+
+/// The fill ranges of a sparse image of the given length, as offset in the body, length and fill
+/// value.  There is one spanning several whole copy chunks, and a smaller, unaligned one.
+fn sparse_fills(len: usize) -> Vec<(usize, usize, u8)> {
+    let mut fills = vec![];
+    if Caps::SparseImages.present() && len >= 20 * 1024 {
+        fills.push((4096, 8192, 0xff));
+        fills.push((16384 + 100, 3000, 0x00));
+    }
+    fills
+}
+
 // Drop some pseudo-random gibberish onto the data.
 fn splat(data: &mut [u8], seed: usize) {
     let seed_block = [0x135782ea, 0x92184728, data.len() as u32, seed as u32];
@@ -6,6 +6,7 @@ use std::{
 };
 use serde_derive::Deserialize;
 
+mod bench;
 mod caps;
 mod image;
 mod tlv;
@@ -14,6 +15,7 @@ pub mod testlog;
 use simflash::{SimFlash, SimFlashMap};
 use mcuboot_sys::{c, AreaDesc, FlashId};
 
+use crate::caps::Caps;
 use crate::image::{
     Images,
     install_image,
@@ -29,6 +31,7 @@ Usage:
   bootsim sizes
   bootsim run --device TYPE [--align SIZE]
   bootsim runall
+  bootsim bench [--device TYPE] [--align SIZE] [--keep-random FILE] [<scenario>...]
   bootsim (--help | --version)
 
 Options:
@@ -37,6 +40,11 @@ Options:
   --device TYPE      MCU to simulate
                      Valid values: stm32f4, k64f
   --align SIZE       Flash write alignment
+  --keep-random FILE Reuse the image signatures and encrypted keys kept in
+                     FILE, keeping new ones
+
+The bench command boots once per scenario, and prints the flash operations
+each boot issued.  Scenarios: none, test, resume, revert (default: all).
 ";
 
 #[derive(Debug, Deserialize)]
@@ -45,9 +53,12 @@ struct Args {
     flag_version: bool,
     flag_device: Option<DeviceName>,
     flag_align: Option<AlignArg>,
+    flag_keep_random: Option<String>,
     cmd_sizes: bool,
     cmd_run: bool,
     cmd_runall: bool,
+    cmd_bench: bool,
+    arg_scenario: Vec<String>,
 }
 
 #[derive(Copy, Clone, Debug, Deserialize)]
@@ -118,6 +129,18 @@ pub fn main() {
         return;
     }
 
+    if args.cmd_bench {
+        let device = args.flag_device.unwrap_or(DeviceName::Stm32f4);
+        let align = args.flag_align.map(|x| x.0).unwrap_or(1);
+        if let Some(ref path) = args.flag_keep_random {
+            tlv::keep_random_tlvs(path);
+        }
+        if !bench::run_bench(device, align, &args.arg_scenario) {
+            process::exit(1);
+        }
+        return;
+    }
+
     let mut status = RunStatus::new();
     if args.cmd_run {
 
@@ -207,8 +230,8 @@ impl Run {
     /// Construct an `Images` that doesn't expect an upgrade to happen.
     pub fn make_no_upgrade_image(&self) -> Images {
         let mut flashmap = self.flashmap.clone();
-        let primaries = install_image(&mut flashmap, &self.slots, 0, 32784, false);
-        let upgrades = install_image(&mut flashmap, &self.slots, 1, 41928, false);
+        let primaries = install_image(&mut flashmap, &self.slots, 0, 32784, false, false);
+        let upgrades = install_image(&mut flashmap, &self.slots, 1, 41928, false, false);
         Images {
             flashmap: flashmap,
             areadesc: self.areadesc.clone(),
@@ -236,10 +259,25 @@ impl Run {
         images
     }
 
+    /// Construct an `Images` with position-independent images in both slots, and nothing pending.
+    pub fn make_pic_image(&self) -> Images {
+        let mut flashmap = self.flashmap.clone();
+        let primaries = install_image(&mut flashmap, &self.slots, 0, 32784, false, true);
+        let upgrades = install_image(&mut flashmap, &self.slots, 1, 41928, false, true);
+        Images {
+            flashmap: flashmap,
+            areadesc: self.areadesc.clone(),
+            slots: [self.slots[0].clone(), self.slots[1].clone()],
+            primaries: primaries,
+            upgrades: upgrades,
+            total_count: None,
+        }
+    }
+
     pub fn make_bad_slot1_image(&self) -> Images {
         let mut bad_flashmap = self.flashmap.clone();
-        let primaries = install_image(&mut bad_flashmap, &self.slots, 0, 32784, false);
-        let upgrades = install_image(&mut bad_flashmap, &self.slots, 1, 41928, true);
+        let primaries = install_image(&mut bad_flashmap, &self.slots, 0, 32784, false, false);
+        let upgrades = install_image(&mut bad_flashmap, &self.slots, 1, 41928, true, false);
         Images {
             flashmap: bad_flashmap,
             areadesc: self.areadesc.clone(),
@@ -306,15 +344,24 @@ impl RunStatus {
     }
 }
 
+/// Declare the flash banks holding the slots of a dual-bank device, when the bootloader may
+/// exchange them.
+fn set_banks(flash: &mut SimFlash, bank0: usize, bank1: usize, size: usize) {
+    if Caps::BankSwap.present() {
+        flash.set_banks(bank0, bank1, size);
+    }
+}
+
 /// Build the Flash and area descriptor for a given device.
 pub fn make_device(device: DeviceName, align: u8, erased_val: u8) -> (SimFlashMap, AreaDesc) {
-    match device {
+    let (mut flashmap, areadesc) = match device {
         DeviceName::Stm32f4 => {
             // STM style flash.  Large sectors, with a large scratch area.
-            let flash = SimFlash::new(vec![16 * 1024, 16 * 1024, 16 * 1024, 16 * 1024,
-                                      64 * 1024,
-                                      128 * 1024, 128 * 1024, 128 * 1024],
-                                      align as usize, erased_val);
+            let mut flash = SimFlash::new(vec![16 * 1024, 16 * 1024, 16 * 1024, 16 * 1024,
+                                          64 * 1024,
+                                          128 * 1024, 128 * 1024, 128 * 1024],
+                                          align as usize, erased_val);
+            set_banks(&mut flash, 0x020000, 0x040000, 0x020000);
             let dev_id = 0;
             let mut areadesc = AreaDesc::new();
             areadesc.add_flash_sectors(dev_id, &flash);
@@ -328,7 +375,8 @@ pub fn make_device(device: DeviceName, align: u8, erased_val: u8) -> (SimFlashMa
         }
         DeviceName::K64f => {
             // NXP style flash.  Small sectors, one small sector for scratch.
-            let flash = SimFlash::new(vec![4096; 128], align as usize, erased_val);
+            let mut flash = SimFlash::new(vec![4096; 128], align as usize, erased_val);
+            set_banks(&mut flash, 0x020000, 0x040000, 0x020000);
 
             let dev_id = 0;
             let mut areadesc = AreaDesc::new();
@@ -344,7 +392,8 @@ pub fn make_device(device: DeviceName, align: u8, erased_val: u8) -> (SimFlashMa
         DeviceName::K64fBig => {
             // Simulating an STM style flash on top of an NXP style flash.  Underlying flash device
             // uses small sectors, but we tell the bootloader they are large.
-            let flash = SimFlash::new(vec![4096; 128], align as usize, erased_val);
+            let mut flash = SimFlash::new(vec![4096; 128], align as usize, erased_val);
+            set_banks(&mut flash, 0x020000, 0x040000, 0x020000);
 
             let dev_id = 0;
             let mut areadesc = AreaDesc::new();
@@ -360,7 +409,8 @@ pub fn make_device(device: DeviceName, align: u8, erased_val: u8) -> (SimFlashMa
         DeviceName::Nrf52840 => {
             // Simulating the flash on the nrf52840 with partitions set up so that the scratch size
             // does not divide into the image size.
-            let flash = SimFlash::new(vec![4096; 128], align as usize, erased_val);
+            let mut flash = SimFlash::new(vec![4096; 128], align as usize, erased_val);
+            set_banks(&mut flash, 0x008000, 0x03c000, 0x034000);
 
             let dev_id = 0;
             let mut areadesc = AreaDesc::new();
@@ -392,5 +442,18 @@ pub fn make_device(device: DeviceName, align: u8, erased_val: u8) -> (SimFlashMa
             flashmap.insert(1, flash1);
             (flashmap, areadesc)
         }
+    };
+
+    // The bit-clearing status encoding programs the status bytes more than once, in the trailer
+    // of slot 0 or of the scratch area.  Anything else programmed twice is still caught.
+    if Caps::StatusBitClear.present() {
+        let trailer = c::boot_trailer_sz(align) as usize;
+        for &id in &[FlashId::Image0, FlashId::ImageScratch] {
+            let (off, len, dev_id) = areadesc.find(id);
+            let flash = flashmap.get_mut(&dev_id).unwrap();
+            flash.add_multi_pass_region(off + len - trailer, trailer);
+        }
     }
+
+    (flashmap, areadesc)
 }
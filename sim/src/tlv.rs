@@ -8,8 +8,15 @@
 //! Because of this header, we have to make two passes.  The first pass will compute the size of
 //! the TLV, and the second pass will build the data for the TLV.
 
+use lazy_static::lazy_static;
 use pem;
 use base64;
+use std::{
+    fs::{self, OpenOptions},
+    io::Write,
+    path::{Path, PathBuf},
+    sync::Mutex,
+};
 use ring::{digest, rand};
 use ring::signature::{
     RsaKeyPair,
@@ -20,6 +27,47 @@ use ring::signature::{
 use untrusted;
 use mcuboot_sys::c;
 
+lazy_static! {
+    /// The file randomized TLVs are kept in, if any; see `keep_random_tlvs()`.
+    static ref RANDOM_TLV_FILE: Mutex<Option<PathBuf>> = Mutex::new(None);
+}
+
+/// Keep the randomized TLVs made from now on, signatures and encrypted keys, in the given file,
+/// and reuse those already in it for the same kind of TLV over the same data.  The work of
+/// verifying an ECDSA signature, or decrypting an RSA-OAEP key, depends on its random part;
+/// reusing them lets the boot of an unchanged image be measured again to the instruction.
+pub fn keep_random_tlvs<P: AsRef<Path>>(path: P) {
+    *RANDOM_TLV_FILE.lock().unwrap() = Some(path.as_ref().to_path_buf());
+}
+
+/// Return the kept TLV of the given kind made from the data, or make one with `make`, keeping it
+/// if randomized TLVs are kept.  Each line of the file holds the kind, the hash of the data and
+/// the TLV value, the last two in base64.
+fn kept_tlv<F>(kind: TlvKinds, data: &[u8], make: F) -> Vec<u8>
+    where F: FnOnce() -> Vec<u8>
+{
+    let file = RANDOM_TLV_FILE.lock().unwrap();
+    let path = match *file {
+        Some(ref path) => path,
+        None => return make(),
+    };
+
+    let key = format!("{:02x} {}", kind as u8,
+                      base64::encode(digest::digest(&digest::SHA256, data).as_ref()));
+    if let Ok(text) = fs::read_to_string(path) {
+        for line in text.lines() {
+            if line.starts_with(&key) && line[key.len()..].starts_with(' ') {
+                return base64::decode(&line[key.len() + 1..]).unwrap();
+            }
+        }
+    }
+
+    let value = make();
+    let mut f = OpenOptions::new().create(true).append(true).open(path).unwrap();
+    writeln!(f, "{} {}", key, base64::encode(&value)).unwrap();
+    value
+}
+
 #[repr(u8)]
 #[derive(Copy, Clone, PartialEq, Eq)]
 #[allow(dead_code)] // TODO: For now
@@ -31,6 +79,9 @@ pub enum TlvKinds {
     ECDSA256 = 0x22,
     ENCRSA2048 = 0x30,
     ENCKW128 = 0x31,
+    SPARSE = 0x40,
+    RELOC = 0x50,
+    HASH_PARTS = 0x60,
 }
 
 #[allow(dead_code, non_camel_case_types)]
@@ -39,13 +90,21 @@ pub enum TlvFlags {
     NON_BOOTABLE = 0x02,
     ENCRYPTED = 0x04,
     RAM_LOAD = 0x20,
+    SPARSE = 0x40,
+    HASH_PARTS = 0x80,
 }
 
+/// Flag of a reloc whose words are offsets from the start of the image header.
+pub const RELOC_F_REL: u16 = 0x0001;
+
 pub struct TlvGen {
     flags: u32,
     kinds: Vec<TlvKinds>,
     size: u16,
     payload: Vec<u8>,
+    sparse: Vec<(u32, u32, u8)>,
+    relocs: Vec<(u32, u32, u16, u16)>,
+    split: Option<u32>,
 }
 
 pub const AES_SEC_KEY: &[u8; 16] = b"0123456789ABCDEF";
@@ -59,6 +118,9 @@ impl TlvGen {
             kinds: vec![TlvKinds::SHA256],
             size: 4 + 32,
             payload: vec![],
+            sparse: vec![],
+            relocs: vec![],
+            split: None,
         }
     }
 
@@ -69,6 +131,9 @@ impl TlvGen {
             kinds: vec![TlvKinds::SHA256, TlvKinds::RSA2048],
             size: 4 + 32 + 4 + 32 + 4 + 256,
             payload: vec![],
+            sparse: vec![],
+            relocs: vec![],
+            split: None,
         }
     }
 
@@ -79,6 +144,9 @@ impl TlvGen {
             kinds: vec![TlvKinds::SHA256, TlvKinds::ECDSA256],
             size: 4 + 32 + 4 + 32 + 4 + 72,
             payload: vec![],
+            sparse: vec![],
+            relocs: vec![],
+            split: None,
         }
     }
 
@@ -89,6 +157,9 @@ impl TlvGen {
             kinds: vec![TlvKinds::SHA256, TlvKinds::ENCRSA2048],
             size: 4 + 32 + 4 + 256,
             payload: vec![],
+            sparse: vec![],
+            relocs: vec![],
+            split: None,
         }
     }
 
@@ -99,6 +170,9 @@ impl TlvGen {
             kinds: vec![TlvKinds::SHA256, TlvKinds::RSA2048, TlvKinds::ENCRSA2048],
             size: 4 + 32 + 4 + 32 + 4 + 256 + 4 + 256,
             payload: vec![],
+            sparse: vec![],
+            relocs: vec![],
+            split: None,
         }
     }
 
@@ -109,6 +183,9 @@ impl TlvGen {
             kinds: vec![TlvKinds::SHA256, TlvKinds::ENCKW128],
             size: 4 + 32 + 4 + 24,
             payload: vec![],
+            sparse: vec![],
+            relocs: vec![],
+            split: None,
         }
     }
 
@@ -119,6 +196,9 @@ impl TlvGen {
             kinds: vec![TlvKinds::SHA256, TlvKinds::RSA2048, TlvKinds::ENCKW128],
             size: 4 + 32 + 4 + 32 + 4 + 256 + 4 + 24,
             payload: vec![],
+            sparse: vec![],
+            relocs: vec![],
+            split: None,
         }
     }
 
@@ -129,17 +209,139 @@ impl TlvGen {
             kinds: vec![TlvKinds::SHA256, TlvKinds::ECDSA256, TlvKinds::ENCKW128],
             size: 4 + 32 + 4 + 32 + 4 + 72 + 4 + 24,
             payload: vec![],
+            sparse: vec![],
+            relocs: vec![],
+            split: None,
         }
     }
 
     /// Retrieve the header flags for this configuration.  This can be called at any time.
     pub fn get_flags(&self) -> u32 {
-        self.flags
+        let mut flags = self.flags;
+        if !self.sparse.is_empty() {
+            flags |= TlvFlags::SPARSE as u32;
+        }
+        if !self.relocs.is_empty() {
+            flags |= TlvFlags::PIC as u32;
+        }
+        if self.split.is_some() {
+            flags |= TlvFlags::HASH_PARTS as u32;
+        }
+        flags
     }
 
     /// Retrieve the size that the TLV will occupy.  This can be called at any time.
     pub fn get_size(&self) -> u16 {
-        4 + self.size
+        let mut size = 4 + self.size;
+        if !self.sparse.is_empty() {
+            size += 4 + 12 * self.sparse.len() as u16;
+        }
+        if !self.relocs.is_empty() {
+            size += 4 + 12 * self.relocs.len() as u16;
+        }
+        if self.split.is_some() {
+            size += 4 + 4 + 32;
+        }
+        size
+    }
+
+    /// Declare a fill range of the image, with the offset relative to the start of the header.
+    /// Ranges must be added in order, and before the header flags or size are retrieved.  The
+    /// range bytes are still added with `add_bytes`, but are left out of the hash.
+    pub fn add_sparse_range(&mut self, off: u32, len: u32, fill: u8) {
+        self.sparse.push((off, len, fill));
+    }
+
+    /// Declare a run of `count` words at `off` (relative to the start of the header) to be copied
+    /// to RAM at `dst`, which makes this a PIC image.  With `IMAGE_RELOC_F_REL` in `flags`, the
+    /// words are offsets from the start of the header.
+    pub fn add_reloc(&mut self, off: u32, dst: u32, count: u16, flags: u16) {
+        self.relocs.push((off, dst, count, flags));
+    }
+
+    /// Hash the image in two parts, split at `off` (relative to the start of the header), so that
+    /// the first part can be checked on its own.  Must be called before the header flags or size
+    /// are retrieved.
+    pub fn set_split(&mut self, off: u32) {
+        self.split = Some(off);
+    }
+
+    /// Encode the payload of the reloc TLV.
+    fn reloc_descriptor(&self) -> Vec<u8> {
+        let mut desc = vec![];
+        for &(off, dst, count, flags) in &self.relocs {
+            desc.extend_from_slice(&[off as u8, (off >> 8) as u8,
+                                     (off >> 16) as u8, (off >> 24) as u8]);
+            desc.extend_from_slice(&[dst as u8, (dst >> 8) as u8,
+                                     (dst >> 16) as u8, (dst >> 24) as u8]);
+            desc.extend_from_slice(&[count as u8, (count >> 8) as u8,
+                                     flags as u8, (flags >> 8) as u8]);
+        }
+        desc
+    }
+
+    /// Encode the payload of the sparse TLV.
+    fn sparse_descriptor(&self) -> Vec<u8> {
+        let mut desc = vec![];
+        for &(off, len, fill) in &self.sparse {
+            desc.extend_from_slice(&[off as u8, (off >> 8) as u8,
+                                     (off >> 16) as u8, (off >> 24) as u8]);
+            desc.extend_from_slice(&[len as u8, (len >> 8) as u8,
+                                     (len >> 16) as u8, (len >> 24) as u8]);
+            desc.extend_from_slice(&[fill, 0, 0, 0]);
+        }
+        desc
+    }
+
+    /// The payload from `start` to `end`, minus any fill ranges.
+    fn hashed_range(&self, start: usize, end: usize) -> Vec<u8> {
+        let mut result = vec![];
+        let mut pos = start;
+        for &(off, len, _) in &self.sparse {
+            let (off, range_end) = (off as usize, (off + len) as usize);
+            if range_end <= pos || off >= end {
+                continue;
+            }
+            if off > pos {
+                result.extend_from_slice(&self.payload[pos..off]);
+            }
+            pos = range_end.min(end);
+        }
+        if pos < end {
+            result.extend_from_slice(&self.payload[pos..end]);
+        }
+        result
+    }
+
+    /// The first part of a two-part hash, or the whole image otherwise: the payload up to the
+    /// split, minus any fill ranges, followed by the sparse descriptor and the reloc descriptor.
+    fn hashed_first(&self) -> Vec<u8> {
+        let end = self.split.map_or(self.payload.len(), |split| split as usize);
+        let mut result = self.hashed_range(0, end);
+        result.extend_from_slice(&self.sparse_descriptor());
+        result.extend_from_slice(&self.reloc_descriptor());
+        result
+    }
+
+    /// The data covered by the hash and signatures: the hashed data, or for a two-part hash, the
+    /// hashes of both parts.
+    fn hashed_payload(&self) -> Vec<u8> {
+        match self.split {
+            None => self.hashed_first(),
+            Some(_) => {
+                let first = self.hashed_first();
+                let mut result = digest::digest(&digest::SHA256, &first).as_ref().to_vec();
+                result.extend_from_slice(self.rest_hash().as_ref());
+                result
+            }
+        }
+    }
+
+    /// The hash of the second part of a two-part hash: the payload after the split, minus any
+    /// fill ranges.
+    fn rest_hash(&self) -> digest::Digest {
+        let start = self.split.unwrap_or(0) as usize;
+        digest::digest(&digest::SHA256, &self.hashed_range(start, self.payload.len()))
     }
 
     /// Add bytes to the covered hash.
@@ -157,8 +359,38 @@ impl TlvGen {
         result.push((size & 0xFF) as u8);
         result.push(((size >> 8) & 0xFF) as u8);
 
+        if !self.sparse.is_empty() {
+            let desc = self.sparse_descriptor();
+            result.push(TlvKinds::SPARSE as u8);
+            result.push(0);
+            result.push((desc.len() & 0xFF) as u8);
+            result.push(((desc.len() >> 8) & 0xFF) as u8);
+            result.extend_from_slice(&desc);
+        }
+
+        if !self.relocs.is_empty() {
+            let desc = self.reloc_descriptor();
+            result.push(TlvKinds::RELOC as u8);
+            result.push(0);
+            result.push((desc.len() & 0xFF) as u8);
+            result.push(((desc.len() >> 8) & 0xFF) as u8);
+            result.extend_from_slice(&desc);
+        }
+
+        if let Some(split) = self.split {
+            result.push(TlvKinds::HASH_PARTS as u8);
+            result.push(0);
+            result.push(4 + 32);
+            result.push(0);
+            result.extend_from_slice(&[split as u8, (split >> 8) as u8,
+                                       (split >> 16) as u8, (split >> 24) as u8]);
+            result.extend_from_slice(self.rest_hash().as_ref());
+        }
+
+        let payload = self.hashed_payload();
+
         if self.kinds.contains(&TlvKinds::SHA256) {
-            let hash = digest::digest(&digest::SHA256, &self.payload);
+            let hash = digest::digest(&digest::SHA256, &payload);
             let hash = hash.as_ref();
 
             assert!(hash.len() == 32);
@@ -182,14 +414,18 @@ impl TlvGen {
             result.extend_from_slice(hash);
 
             // For now assume PSS.
-            let key_bytes = pem::parse(include_bytes!("../../root-rsa-2048.pem").as_ref()).unwrap();
-            assert_eq!(key_bytes.tag, "RSA PRIVATE KEY");
-            let key_bytes = untrusted::Input::from(&key_bytes.contents);
-            let key_pair = RsaKeyPair::from_der(key_bytes).unwrap();
-            let rng = rand::SystemRandom::new();
-            let mut signature = vec![0; key_pair.public_modulus_len()];
+            let signature = kept_tlv(TlvKinds::RSA2048, &payload, || {
+                let key_bytes = pem::parse(include_bytes!("../../root-rsa-2048.pem").as_ref())
+                    .unwrap();
+                assert_eq!(key_bytes.tag, "RSA PRIVATE KEY");
+                let key_bytes = untrusted::Input::from(&key_bytes.contents);
+                let key_pair = RsaKeyPair::from_der(key_bytes).unwrap();
+                let rng = rand::SystemRandom::new();
+                let mut signature = vec![0; key_pair.public_modulus_len()];
+                key_pair.sign(&RSA_PSS_SHA256, &rng, &payload, &mut signature).unwrap();
+                signature
+            });
             assert_eq!(signature.len(), 256);
-            key_pair.sign(&RSA_PSS_SHA256, &rng, &self.payload, &mut signature).unwrap();
 
             result.push(TlvKinds::RSA2048 as u8);
             result.push(0);
@@ -209,21 +445,24 @@ impl TlvGen {
             result.push(0);
             result.extend_from_slice(keyhash);
 
-            let key_bytes = pem::parse(include_bytes!("../../root-ec-p256-pkcs8.pem").as_ref()).unwrap();
-            assert_eq!(key_bytes.tag, "PRIVATE KEY");
+            let signature = kept_tlv(TlvKinds::ECDSA256, &payload, || {
+                let key_bytes = pem::parse(include_bytes!("../../root-ec-p256-pkcs8.pem")
+                                           .as_ref()).unwrap();
+                assert_eq!(key_bytes.tag, "PRIVATE KEY");
 
-            let key_bytes = untrusted::Input::from(&key_bytes.contents);
-            let key_pair = EcdsaKeyPair::from_pkcs8(&ECDSA_P256_SHA256_ASN1_SIGNING,
-                                                    key_bytes).unwrap();
-            let rng = rand::SystemRandom::new();
-            let payload = untrusted::Input::from(&self.payload);
-            let signature = key_pair.sign(&rng, payload).unwrap();
+                let key_bytes = untrusted::Input::from(&key_bytes.contents);
+                let key_pair = EcdsaKeyPair::from_pkcs8(&ECDSA_P256_SHA256_ASN1_SIGNING,
+                                                        key_bytes).unwrap();
+                let rng = rand::SystemRandom::new();
+                let payload = untrusted::Input::from(&payload);
+                key_pair.sign(&rng, payload).unwrap().as_ref().to_vec()
+            });
 
             result.push(TlvKinds::ECDSA256 as u8);
             result.push(0);
 
             // signature must be padded...
-            let mut signature = signature.as_ref().to_vec();
+            let mut signature = signature;
             while signature.len() < 72 {
                 signature.push(0);
                 signature[1] += 1;
@@ -239,10 +478,12 @@ impl TlvGen {
                                        .as_ref()).unwrap();
             assert_eq!(key_bytes.tag, "PUBLIC KEY");
 
-            let encbuf = match c::rsa_oaep_encrypt(&key_bytes.contents, AES_SEC_KEY) {
-                Ok(v) => v,
-                Err(_) => panic!("Failed to encrypt secret key"),
-            };
+            let encbuf = kept_tlv(TlvKinds::ENCRSA2048, AES_SEC_KEY, || {
+                match c::rsa_oaep_encrypt(&key_bytes.contents, AES_SEC_KEY) {
+                    Ok(v) => v.to_vec(),
+                    Err(_) => panic!("Failed to encrypt secret key"),
+                }
+            });
 
             assert!(encbuf.len() == 256);
             result.push(TlvKinds::ENCRSA2048 as u8);
@@ -27,3 +27,10 @@ sim_test!(perm_with_random_fails, make_image, run_perm_with_random_fails_5);
 sim_test!(norevert, make_image, run_norevert);
 sim_test!(status_write_fails_complete, make_image, run_with_status_fails_complete);
 sim_test!(status_write_fails_with_reset, make_image, run_with_status_fails_with_reset);
+sim_test!(warm_reset, make_image, run_warm_reset);
+sim_test!(pic_in_place, make_pic_image, run_pic_in_place);
+sim_test!(verify_writes, make_image, run_verify_writes);
+sim_test!(overlap_copy, make_image, run_overlap_copy);
+sim_test!(journal_replay, make_image, run_journal_replay);
+sim_test!(deferred_validation, make_image, run_deferred_validation);
+sim_test!(bad_fill, make_image, run_bad_fill);